@@ -45,7 +45,8 @@ endfunction()
 # Adds a C test program target with the given name and source files. Options are
 # the same as `add_c_program`. The `main()` function of the program must run the
 # tests; it must exit with status zero if all tests pass, or non-zero if some
-# test fails.
+# test fails. (If the tests are defined with `TEST(name)` and the program
+# doesn't define `main()`, libipd supplies one that runs them.)
 #
 # This command defines the preprocessor macro IPD_TESTING, which means your code
 # can test whether it is being compiled for testing via `#ifdef`:
@@ -64,6 +65,38 @@ function(add_c_test_program name)
 endfunction()
 
 
+# ADD_C_BENCHMARK_PROGRAM – Adds a C program target for timing code with
+# libipd's `BENCH`. Options are the same as `add_c_program`, but the program
+# is always built with optimization and without undefined behavior sanitizer,
+# which would skew the timings.
+#
+# Benchmarks aren't tests, so they aren't run by `ctest`. Instead, each one
+# gets a target `bench_‹NAME›` that builds and runs it, and the target `bench`
+# runs them all.
+#
+# ## Example
+#
+# Build and register the benchmark `list_bench` from list_bench.c, then run
+# it with `make bench_list_bench`:
+#
+# ```
+# add_c_benchmark_program(list_bench list_bench.c)
+# ```
+function(add_c_benchmark_program name)
+    add_c_program(${name} NO_UBSAN ${ARGN})
+    target_supported_c_compile_options(${name} -O2)
+
+    if(NOT TARGET bench)
+        add_custom_target(bench)
+    endif()
+
+    add_custom_target(bench_${name}
+            COMMAND ${name}
+            USES_TERMINAL)
+    add_dependencies(bench bench_${name})
+endfunction()
+
+
 # ADD_CXX_PROGRAM – Adds a C++ program target with the given name, built from
 # the given source files. Sets the language to C++ 14 and enables undefined
 # behavior sanitizer by default.
@@ -80,6 +113,10 @@ endfunction()
 #   - NO_UBSAN – disable undefined behavior sanitizer
 #   - CXX17    – enable C++ 2017
 #   - CXX20    – (experimental) enable C++ 2020
+#   - IPD_ALLOC
+#              – allocate with libipd's `operator new` and `operator
+#                delete`, so that allocation limits, tracing, and
+#                statistics apply to C++ allocations too
 #   - DEFINES ‹A›=‹B›...
 #              – like `#define ‹A› ‹B›`...
 #
@@ -91,6 +128,13 @@ endfunction()
 # add_program(Pong pong.cxx ASAN)
 # ```
 #
+# Build the program `lru` so that its `new`s count against
+# `RTIPD_ALLOC_LIMIT_PEAK`:
+#
+# ```
+# add_cxx_program(lru lru.cxx IPD_ALLOC)
+# ```
+#
 # Build the program Frogger from the three listed source files:
 # against GE211 and using C++ 2017:
 #
@@ -151,14 +195,14 @@ function(_ipd_add_program lang target)
     if(lang STREQUAL "CXX")
         set(cee 0)
         set(cxx 1)
-        set(flags "CXX17;CXX20;${flags}")
+        set(flags "CXX17;CXX20;IPD_ALLOC;${flags}")
     elseif(lang STREQUAL "C")
         set(cee 1)
         set(cxx 0)
     else()
         set(cee 1)
         set(cxx 1)
-        set(flags "CXX17;CXX20;${flags}")
+        set(flags "CXX17;CXX20;IPD_ALLOC;${flags}")
     endif()
 
     cmake_parse_arguments(pa
@@ -196,6 +240,10 @@ function(_ipd_add_program lang target)
         endif()
     endif(pa_ASAN)
 
+    if(pa_IPD_ALLOC)
+        target_link_libraries(${target} ipd_new)
+    endif()
+
     _ipd_os_setup(${target})
 
     foreach(def ${pa_DEFINES})
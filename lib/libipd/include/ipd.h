@@ -4,6 +4,7 @@
 #include "libipd_alloc.h"
 #include "libipd_io.h"
 #include "libipd_test.h"
+#include "libipd_bench.h"
 
 #ifdef LIBIPD_HAS_POSIX
 #   include "libipd_program_test.h"
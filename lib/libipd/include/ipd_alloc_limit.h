@@ -2,6 +2,10 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Removes any allocation limit.
 void alloc_limit_set_no_limit(void);
 
@@ -10,3 +14,20 @@ void alloc_limit_set_peak(size_t n);
 
 // Limits subsequent gross allocations to `n` bytes total.
 void alloc_limit_set_total(size_t n);
+
+// Makes the `n`th allocation from now on (counting from 1) fail, as
+// if out of memory. Zero means fail none.
+void alloc_fail_at(size_t n);
+
+// Makes each allocation from now on fail with probability `p`. The
+// choice is a function of `seed` and the allocation's number, so the
+// same seed fails the same allocations.
+void alloc_fail_randomly(double p, unsigned long seed);
+
+// Returns the number of allocations attempted since the last call to
+// `alloc_fail_at` or `alloc_fail_randomly`.
+size_t alloc_fail_count(void);
+
+#ifdef __cplusplus
+}
+#endif
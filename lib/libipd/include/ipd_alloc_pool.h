@@ -0,0 +1,22 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Serves subsequent small allocations from size-class pools rather
+// than from the C library, which is much faster for programs that make
+// many small allocations.
+void alloc_pool_enable(void);
+
+// Goes back to the C library for subsequent allocations. Blocks already
+// allocated from the pools can still be freed or reallocated.
+void alloc_pool_disable(void);
+
+// Frees every block allocated from the pools at once. Pointers to them
+// must not be used afterward.
+void alloc_pool_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
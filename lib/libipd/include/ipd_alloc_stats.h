@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number of entries in `alloc_stats.size_classes`.
+#define ALLOC_STATS_SIZE_CLASSES 64
+
+// What the allocation runtime has seen since the program started (or
+// since the last `alloc_stats_reset()`).
+struct alloc_stats
+{
+    // Bytes in blocks currently allocated, and the most there have
+    // been at once. These count each block's usable size as reported
+    // by the allocator, which may be a little more than was requested.
+    size_t live_bytes;
+    size_t peak_bytes;
+
+    // Number of calls to each function (whether or not they succeeded).
+    // `realloc_calls` includes calls to `reallocf`.
+    size_t malloc_calls;
+    size_t calloc_calls;
+    size_t realloc_calls;
+    size_t free_calls;
+
+    // Total bytes requested by successful allocations.
+    size_t total_bytes;
+
+    // Successful allocations by requested size: `size_classes[0]`
+    // counts requests for 0 bytes, and `size_classes[k]` counts
+    // requests for at least 2^(k-1) but fewer than 2^k bytes. The last
+    // class also counts everything larger.
+    size_t size_classes[ALLOC_STATS_SIZE_CLASSES];
+};
+
+// Stores the current statistics in `*out`.
+void alloc_stats_get(struct alloc_stats* out);
+
+// Zeroes the counters and lowers `peak_bytes` to `live_bytes`.
+void alloc_stats_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// BENCH(NAME, FN, ARG) times calls to `FN(ARG)`, where `FN` is a
+// function taking a `void*`, and prints how long each call took. It
+// first calls `FN` for a while to warm up caches and branch predictors,
+// and to find out how many calls to time together so that each sample
+// lasts long enough to measure; then it takes several such samples and
+// reports the mean, median, standard deviation, and minimum time per
+// call. It returns those statistics too.
+//
+// Example:
+//
+//     static void sum_list(void* arg)
+//     {
+//         long sum = list_sum(arg);
+//         bench_do_not_optimize(&sum);
+//     }
+//
+//     int main(void)
+//     {
+//         struct list* list = make_list(1000);
+//         BENCH("sum 1000", sum_list, list);
+//     }
+//
+// prints something like
+//
+//     sum 1000: mean 1.21 µs, median 1.20 µs, stddev 0.03 µs, min 1.18 µs
+//         (20 samples of 8192 calls)
+//
+#define BENCH(NAME,FN,ARG) \
+    libipd_do_bench((NAME),(FN),(ARG),__FILE__,__LINE__)
+
+// What BENCH measured, in nanoseconds per call.
+struct bench_stats
+{
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    double max;
+    size_t samples;             // how many samples were taken
+    size_t calls_per_sample;    // how many calls each sample timed
+};
+
+// Keeps the compiler from optimizing away the computation of whatever
+// `p` points to, as it might if nothing uses the result, by making it
+// think that the memory there is read. (Defined below.)
+static inline void bench_do_not_optimize(void const* p);
+
+// Tells BENCH to take `n` samples (20 by default). (Setting the
+// environment variable RTIPD_BENCH_SAMPLES=N does the same.)
+void bench_set_samples(size_t n);
+
+// Tells BENCH to warm up for `seconds` seconds (0.1 by default), and to
+// time enough calls in each sample to take about `seconds / 10` (but at
+// least one call). (Setting the environment variable
+// RTIPD_BENCH_WARMUP=S does the same.)
+void bench_set_warmup(double seconds);
+
+// Also writes each result to `dest`, which names a format and a file
+// as in `csv:results.csv` or `json:results.json`, or NULL to stop. The
+// file may also be `&N` for file descriptor N. Returns whether it could
+// open the file. (Setting the environment variable RTIPD_BENCH_OUTPUT
+// does the same.)
+bool bench_set_output(char const* dest);
+
+
+/*
+ * IMPLEMENTATION DETAILS. The full API is documented above. Below this
+ * point are implementation details that you don't need to understand in
+ * order to use this library.
+ */
+
+// Helper function used by `BENCH` macro above.
+struct bench_stats libipd_do_bench(
+        char const* name,
+        void (*fn)(void*),
+        void* arg,
+        char const* file,
+        int line);
+
+// An empty asm statement costs nothing, but the compiler can't see
+// that it doesn't read the memory.
+static inline void bench_do_not_optimize(void const* p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+#else
+    static void const* volatile sink;
+    sink = p;
+#endif
+}
@@ -47,17 +47,165 @@
 #define CHECK_STRING(A,B)   DISPATCH_CHECK(string, A,B)
 #define CHECK_POINTER(A,B)  DISPATCH_CHECK(pointer, A,B)
 
+// CHECK_MEMORY_EQ(A, B, N) checks that the N bytes at A and B are
+// the same.
+// CHECK_ARRAY_EQ(A, B, N) checks that the first N elements of arrays A
+// and B are the same. (It compares their bytes, so it's for integers,
+// characters, and pointers, not floating point or padded structs.)
+// CHECK_DOUBLE_ARRAY_NEAR(A, B, N, ABS, REL, ULPS) checks that each of
+// the first N doubles in A is near the one in B: within ABS of it,
+// within REL times the larger of their magnitudes, or within ULPS units
+// in the last place. (Pass 0 for any you don't want.) NaNs are near
+// only NaNs.
+//
+// Each counts as one check, and on failure shows where A and B first
+// differ, with a few of the bytes or elements around it.
+//
+// Examples:
+//
+//   int squares[] = {0, 1, 4, 9, 16};
+//   double halves[] = {0.0, 0.5, 1.0}, wholes[] = {0.0, 1.0, 2.0};
+//
+//   CHECK_ARRAY_EQ( make_squares(5), squares, 5 );
+//   CHECK_MEMORY_EQ( "hello", "help", 3 );
+//   CHECK_DOUBLE_ARRAY_NEAR( scale(halves, 2), wholes, 3, 0, 1e-12, 4 );
+//
+#define CHECK_MEMORY_EQ(A,B,N) \
+    libipd_do_check_memory((A),(B),(N),#A,#B,__FILE__,__LINE__)
+#define CHECK_ARRAY_EQ(A,B,N) \
+    libipd_do_check_array((A),(B),(N),sizeof *(A),sizeof *(B), \
+                          LIBIPD_ELEM_KIND(*(A)),#A,#B,__FILE__,__LINE__)
+#define CHECK_DOUBLE_ARRAY_NEAR(A,B,N,ABS,REL,ULPS) \
+    libipd_do_check_double_array_near((A),(B),(N),(ABS),(REL),(ULPS), \
+                                      #A,#B,__FILE__,__LINE__)
+
 // RUN_TEST takes a function with no arguments and no results, and
 // calls it as a test. (This means it prints progress and success or
 // failure information.)
 #define RUN_TEST(F)         libipd_do_run_test((F),#F,__FILE__,__LINE__)
 
+// RUN_TEST_TIMEOUT is like RUN_TEST, but gives the test `S` seconds to
+// finish (overriding `set_test_timeout` below). A test that runs longer
+// is killed, along with any processes it started, and reported as
+// timed out.
+#define RUN_TEST_TIMEOUT(F,S) \
+    libipd_do_run_test_timeout((F),#F,(S),__FILE__,__LINE__)
+
+// RUN_TESTS_WITH_FIXTURE(SETUP, TEARDOWN, TESTS...) calls `SETUP()`
+// once, then runs each of the test functions TESTS as RUN_TEST does, and
+// calls `TEARDOWN()` once they've all finished. Since each test runs in
+// a child process forked after `SETUP` returns, the tests all see what
+// `SETUP` built (in global variables, say) without paying to build it
+// again, and whatever one test changes, the others don't see. Either of
+// `SETUP` and `TEARDOWN` may be NULL. Returns whether every test passed.
+//
+// Example:
+//
+//     static struct index* the_index;
+//
+//     static void build_index(void) { the_index = index_load("big.txt"); }
+//     static void free_index(void) { index_free(the_index); }
+//
+//     RUN_TESTS_WITH_FIXTURE(build_index, free_index,
+//                            test_lookup, test_prefix, test_missing);
+#define RUN_TESTS_WITH_FIXTURE(SETUP,TEARDOWN,...) \
+    libipd_do_run_tests_with_fixture((SETUP),(TEARDOWN), \
+        (void (*[])(void)){__VA_ARGS__}, \
+        sizeof (void (*[])(void)){__VA_ARGS__} / sizeof (void (*)(void)), \
+        #__VA_ARGS__,__FILE__,__LINE__)
+
+// RUN_OOM_SWEEP is like RUN_TEST, but also checks how the test copes
+// with running out of memory. It runs the test once to count its
+// allocations, and then once more for each allocation N, making the
+// Nth allocation fail. (The runs happen in parallel.) The sweep fails
+// if any run crashes, or leaks more memory than the test does when no
+// allocation fails. Checks that fail only because an allocation did
+// are not counted against it.
+#define RUN_OOM_SWEEP(F)    libipd_do_run_oom_sweep((F),#F,__FILE__,__LINE__)
+
+// TEST(N) defines a test function named `N` and registers it, so that
+// you don't have to RUN_TEST it yourself. If your program doesn't
+// define `main`, libipd's runs every registered test, or just those
+// selected by the command-line arguments (see `run_registered_tests`
+// below).
+//
+// Example:
+//
+//     TEST(reverse_empty)
+//     {
+//         CHECK_STRING( reverse(""), "" );
+//     }
+#define TEST(N)             TAGGED_TEST(N, "")
+
+// TAGGED_TEST(N, TAGS) is like TEST, but also gives the test the tags
+// in the string `TAGS`, separated by spaces or commas, which the
+// command line can then select or exclude tests by.
+//
+// Example:
+//
+//     TAGGED_TEST(reverse_huge, "slow string")
+//     {
+//         ...
+//     }
+#define TAGGED_TEST(N,TAGS) LIBIPD_DEFINE_TEST(N,TAGS)
+
+// Runs the tests registered by TEST and TAGGED_TEST, in the order they
+// were defined, and returns 0; or if `argv` asks for it, lists them or
+// prints usage and returns 0, or complains and returns 2. The
+// arguments are:
+//
+//     --list       list the selected tests instead of running them
+//     --tag=TAG    select only tests with a tag matching TAG (or
+//                  with a tag matching any TAG, if given more than
+//                  once); --tag=!TAG excludes tests with such a tag
+//     PATTERN      select only tests whose names match PATTERN (or
+//                  any PATTERN, if given more than once); !PATTERN
+//                  excludes the tests it matches
+//
+// TAGs and PATTERNs may use the wildcards `*` and `?`.
+int run_registered_tests(int argc, char* argv[]);
+
 // Initializes the test system. The first check will call this
 // automatically, but calling it yourself will ensure that you see the
 // empty test results if your test program exits before getting to the
 // its check.
 void start_testing(void);
 
+// RUN_TEST reports how much each test allocates. If `enabled`, it also
+// fails any test that returns with more bytes allocated than it started
+// with. (Setting the environment variable RTIPD_FAIL_ON_LEAK=1 does the
+// same.)
+void fail_tests_that_leak(bool enabled);
+
+// Lets RUN_TEST run up to `jobs` tests at once (or one per processor,
+// if `jobs` is 0). RUN_TEST then returns before its test finishes, but
+// each test's output and result are still printed in order. (Setting
+// the environment variable RTIPD_JOBS=N does the same.)
+void run_tests_in_parallel(size_t jobs);
+
+// If `enabled`, RUN_TEST calls each test in this process, one at a time,
+// instead of forking a child process for it. That's faster when the
+// program has a large heap, and crashes, timeouts, and calls to exit(3)
+// are still caught and reported, but a test that corrupts memory can
+// break the tests after it. (Setting the environment variable
+// RTIPD_TEST_IN_PROCESS=1 does the same.)
+void run_tests_in_process(bool enabled);
+
+// Gives every test run by RUN_TEST `seconds` seconds to finish, or as
+// long as it takes if `seconds` is 0 (the default). (Setting the
+// environment variable RTIPD_TEST_TIMEOUT=S does the same.)
+void set_test_timeout(double seconds);
+
+// If `enabled`, RUN_TEST also prints how much CPU time, memory, page
+// faults, and context switches each test used. (Setting the environment
+// variable RTIPD_TEST_RESOURCES=1 does the same.)
+void show_test_resources(bool enabled);
+
+// Lists the `n` slowest tests, and the `n` that needed the most memory,
+// along with the test results at exit. (Setting the environment
+// variable RTIPD_TEST_SUMMARY=N does the same.)
+void summarize_test_resources(size_t n);
+
 
 /*
  * IMPLEMENTATION DETAILS. The full API is documented above. Below this
@@ -133,6 +281,69 @@ bool libipd_do_check_pointer(
         char const* file,
         int line);
 
+// Helper function used by `CHECK_MEMORY_EQ` macro above.
+bool libipd_do_check_memory(
+        void const* have,
+        void const* want,
+        size_t size,            // bytes to compare
+        char const* expr_have,
+        char const* expr_want,
+        char const* file,
+        int line);
+
+// How `CHECK_ARRAY_EQ` shows elements, chosen by their type.
+enum libipd_elem_kind
+{
+    LIBIPD_ELEM_BYTES,          // in hex, for types not listed below
+    LIBIPD_ELEM_SIGNED,
+    LIBIPD_ELEM_UNSIGNED,
+    LIBIPD_ELEM_CHAR,
+    LIBIPD_ELEM_FLOAT,
+};
+
+#define LIBIPD_ELEM_KIND(X) _Generic((X), \
+    char:               LIBIPD_ELEM_CHAR, \
+    signed char:        LIBIPD_ELEM_SIGNED, \
+    short:              LIBIPD_ELEM_SIGNED, \
+    int:                LIBIPD_ELEM_SIGNED, \
+    long:               LIBIPD_ELEM_SIGNED, \
+    long long:          LIBIPD_ELEM_SIGNED, \
+    _Bool:              LIBIPD_ELEM_UNSIGNED, \
+    unsigned char:      LIBIPD_ELEM_UNSIGNED, \
+    unsigned short:     LIBIPD_ELEM_UNSIGNED, \
+    unsigned int:       LIBIPD_ELEM_UNSIGNED, \
+    unsigned long:      LIBIPD_ELEM_UNSIGNED, \
+    unsigned long long: LIBIPD_ELEM_UNSIGNED, \
+    float:              LIBIPD_ELEM_FLOAT, \
+    double:             LIBIPD_ELEM_FLOAT, \
+    default:            LIBIPD_ELEM_BYTES)
+
+// Helper function used by `CHECK_ARRAY_EQ` macro above.
+bool libipd_do_check_array(
+        void const* have,
+        void const* want,
+        size_t count,           // elements to compare
+        size_t have_elem_size,
+        size_t want_elem_size,
+        enum libipd_elem_kind kind,
+        char const* expr_have,
+        char const* expr_want,
+        char const* file,
+        int line);
+
+// Helper function used by `CHECK_DOUBLE_ARRAY_NEAR` macro above.
+bool libipd_do_check_double_array_near(
+        double const* have,
+        double const* want,
+        size_t count,
+        double abs_tolerance,
+        double rel_tolerance,
+        unsigned long ulp_tolerance,
+        char const* expr_have,
+        char const* expr_want,
+        char const* file,
+        int line);
+
 // Helper function used by `RUN_TEST` macro above.
 //
 bool libipd_do_run_test(
@@ -141,6 +352,61 @@ bool libipd_do_run_test(
         char const* file,
         int line);
 
+// Helper function used by `RUN_TEST_TIMEOUT` macro above.
+//
+bool libipd_do_run_test_timeout(
+        void (*test_fn)(void),
+        char const* source_expr,
+        double timeout,         // seconds, or 0 for no limit
+        char const* file,
+        int line);
+
+// Helper function used by `RUN_TESTS_WITH_FIXTURE` macro above.
+//
+bool libipd_do_run_tests_with_fixture(
+        void (*setup)(void),    // or NULL
+        void (*teardown)(void), // or NULL
+        void (*test_fns[])(void),
+        size_t test_count,
+        char const* source_exprs, // source of `test_fns`, comma-separated
+        char const* file,
+        int line);
+
+// Helper function used by `RUN_OOM_SWEEP` macro above.
+//
+bool libipd_do_run_oom_sweep(
+        void (*test_fn)(void),
+        char const* source_expr,
+        char const* file,
+        int line);
+
+// A test registered by `TEST` or `TAGGED_TEST` above.
+struct libipd_test_case
+{
+    void (*test_fn)(void);
+    char const* name;
+    char const* tags;
+    char const* file;
+    int line;
+    struct libipd_test_case* next;
+};
+
+// Helper used by `TAGGED_TEST` macro above. Adds `test` to the list
+// that `run_registered_tests` runs.
+void libipd_register_test(struct libipd_test_case* test);
+
+// Declares the test function, then defines a constructor, which runs
+// before `main`, to register it, and finally starts the function's
+// definition so that the body following the macro becomes its body.
+#define LIBIPD_DEFINE_TEST(N,TAGS) \
+    static void N(void); \
+    static struct libipd_test_case libipd_test_case_##N = \
+        {N, #N, (TAGS), __FILE__, __LINE__, NULL}; \
+    __attribute__((constructor)) \
+    static void libipd_register_test_##N(void) \
+    { libipd_register_test(&libipd_test_case_##N); } \
+    static void N(void)
+
 // We're going to override exit(3) with a function that complains if
 // it's called in the midst of a test.
 #ifndef LIBIPD_RAW_EXIT
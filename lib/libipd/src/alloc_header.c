@@ -0,0 +1,135 @@
+#define _XOPEN_SOURCE 700
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "alloc_header.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// The header occupies the last bytes of a 16-byte granule, so that the
+// user pointer stays aligned for any type.
+#define GRANULE   16
+
+_Static_assert(sizeof(struct alloc_header) <= GRANULE,
+               "alloc_header must fit in a granule");
+
+bool alloc_header_enabled  = false;
+bool alloc_header_canaries = false;
+
+// Chosen at startup, so that a stray write is unlikely to reproduce
+// a canary by accident. Each block's canaries also mix in its address,
+// so copying one block over another doesn't copy valid canaries.
+static uint64_t canary_secret;
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= UINT64_C(0xBF58476D1CE4E5B9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94D049BB133111EB);
+    x ^= x >> 31;
+    return x;
+}
+
+void alloc_header_enable(bool canaries)
+{
+    canary_secret = mix64((uint64_t)time(NULL)
+                          ^ ((uint64_t)getpid() << 32)
+                          ^ (uint64_t)(uintptr_t)&canary_secret);
+
+    alloc_header_canaries = canaries;
+    alloc_header_enabled  = true;
+}
+
+static inline uint64_t back_canary(void const* p)
+{
+    return canary_secret ^ (uint64_t)(uintptr_t)p;
+}
+
+// Only 16 bits, since the header needs the rest of its room for the
+// epoch. The back canary is the full 64.
+static inline uint16_t front_canary(void const* p)
+{
+    return (uint16_t)(back_canary(p) >> 48);
+}
+
+static inline size_t trailer_size(void)
+{
+    return alloc_header_canaries ? sizeof(uint64_t) : 0;
+}
+
+static inline size_t header_space(size_t alignment)
+{
+    return alignment > GRANULE ? alignment : GRANULE;
+}
+
+size_t alloc_header_block_size(size_t size, size_t alignment)
+{
+    if (alignment > GRANULE * (size_t)UINT16_MAX) return 0;
+
+    size_t extra = header_space(alignment) + trailer_size();
+    return size <= SIZE_MAX - extra ? size + extra : 0;
+}
+
+void* alloc_header_wrap(void* block, size_t size, size_t alignment,
+                        unsigned epoch)
+{
+    size_t space = header_space(alignment);
+    char* p = (char*)block + space;
+
+    struct alloc_header* header = alloc_header_of(p);
+    header->size   = size;
+    header->epoch  = (uint32_t)epoch;
+    header->offset = (uint16_t)(space / GRANULE);
+    header->guard  = 0;
+
+    if (alloc_header_canaries) {
+        uint64_t canary = back_canary(p);
+        header->guard = front_canary(p);
+        memcpy(p + size, &canary, sizeof canary);
+    }
+
+    return p;
+}
+
+void* alloc_header_block(void const* p)
+{
+    return (void*)((uintptr_t)p - GRANULE * alloc_header_of(p)->offset);
+}
+
+static _Noreturn void
+report_corruption(void const* p, char const* op, char const* what)
+{
+    fprintf(stderr,
+            "libipd_alloc: %s(%p): %s\n"
+            "  (block of %zu bytes)\n",
+            op, p, what, alloc_header_of(p)->size);
+    abort();
+}
+
+void alloc_header_check(void const* p, char const* op, bool freeing)
+{
+    if (!alloc_header_canaries) return;
+
+    struct alloc_header* header = alloc_header_of(p);
+
+    if (header->guard != front_canary(p)) {
+        if (header->guard == (uint16_t)~front_canary(p))
+            report_corruption(p, op, "block was already freed");
+        else
+            report_corruption(p, op, "header overwritten "
+                    "(write before the block, or double free?)");
+    }
+
+    uint64_t canary;
+    memcpy(&canary, (char const*)p + header->size, sizeof canary);
+    if (canary != back_canary(p))
+        report_corruption(p, op,
+                "guard overwritten (heap buffer overflow)");
+
+    if (freeing) header->guard = (uint16_t)~front_canary(p);
+}
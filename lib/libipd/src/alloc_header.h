@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Inline block headers for alloc_rt.c. When enabled (by the
+// RTIPD_ALLOC_HEADERS or RTIPD_ALLOC_CANARY environment variable),
+// every block is allocated with a small header just before the pointer
+// we return, which records the size requested and the limit epoch it
+// was charged in. Then freeing a block needs no table lookup to refund
+// it. With canaries, the header and the word just past the end of the
+// block also hold guard values, which are checked when the block is
+// freed or reallocated.
+//
+// Headers must be chosen before the first allocation, since blocks
+// with and without them can't be told apart.
+
+struct alloc_header
+{
+    size_t   size;      // bytes requested
+    uint32_t epoch;     // `limit_epoch` in alloc_rt.c
+    uint16_t guard;     // front canary (if enabled)
+    uint16_t offset;    // 16-byte units from the block start to the user
+};
+
+// Whether blocks have headers, and whether they have canaries too. Set
+// once by `alloc_header_enable`.
+extern bool alloc_header_enabled;
+extern bool alloc_header_canaries;
+
+// Turns on headers, and canaries if `canaries`. Call once, before any
+// allocation.
+void alloc_header_enable(bool canaries);
+
+// How many bytes to allocate, aligned to `alignment` (at least 16), for
+// a block that holds `size` usable bytes and its header. Returns 0 on
+// overflow.
+size_t alloc_header_block_size(size_t size, size_t alignment);
+
+// Writes the header (and trailing canary) for a block of `size` user
+// bytes into the fresh block `block`, and returns the user pointer.
+void* alloc_header_wrap(void* block, size_t size, size_t alignment,
+                        unsigned epoch);
+
+// Returns the start of the block under user pointer `p`.
+void* alloc_header_block(void const* p);
+
+// Returns the header of user pointer `p`.
+static inline struct alloc_header*
+alloc_header_of(void const* p)
+{
+    return (struct alloc_header*)((uintptr_t)p - sizeof(struct alloc_header));
+}
+
+// Checks the canaries of `p`, if enabled, reporting corruption and
+// aborting if they have been overwritten. `op` names the operation
+// for the report. If `freeing`, also poisons the front canary so that
+// a second free is caught too.
+void alloc_header_check(void const* p, char const* op, bool freeing);
@@ -0,0 +1,195 @@
+// Replacements for C++'s global operator new and operator delete that
+// allocate through the allocation runtime, so that C++ code is subject
+// to the same limits, failure injection, tracing, profiling, and
+// statistics as C code. Programs get these by linking the `ipd_new`
+// library (which `add_cxx_program(... IPD_ALLOC)` does for them).
+//
+// Every form of new is counted as a malloc, and every form of delete as
+// a free. The sizes passed to sized delete are ignored, since the
+// runtime knows how big each block is.
+
+#include "alloc_rt.h"
+
+#include <cstddef>
+#include <new>
+
+#ifdef __GNUC__
+#   define CALLER()  __builtin_return_address(0)
+#else
+#   define CALLER()  nullptr
+#endif
+
+#if defined(__cpp_aligned_new) && defined(LIBIPD_HAS_POSIX)
+#   define ALIGNED_NEW 1
+#else
+#   define ALIGNED_NEW 0
+#endif
+
+namespace {
+
+// Allocates like operator new: on failure, calls the new-handler and
+// tries again until there is no new-handler. Returns nullptr only then.
+void* allocate(std::size_t size, std::size_t alignment, void const* site)
+{
+    if (size == 0) size = 1;
+
+    for (;;) {
+        void* result = alignment
+            ? rtipd_aligned_alloc_at(alignment, size, site)
+            : rtipd_malloc_at(size, site);
+        if (result) return result;
+
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) return nullptr;
+        handler();
+    }
+}
+
+void* allocate_or_throw(std::size_t size, std::size_t alignment,
+                        void const* site)
+{
+    void* result = allocate(size, alignment, site);
+    if (!result) throw std::bad_alloc();
+    return result;
+}
+
+#if ALIGNED_NEW
+// aligned_alloc(3) wants a multiple of the alignment, and at least a
+// pointer's worth.
+std::size_t alignment_of(std::align_val_t al)
+{
+    std::size_t alignment = static_cast<std::size_t>(al);
+    return alignment < sizeof(void*) ? sizeof(void*) : alignment;
+}
+
+std::size_t round_up(std::size_t size, std::size_t alignment)
+{
+    if (size == 0) size = 1;
+    std::size_t rounded = (size + alignment - 1) / alignment * alignment;
+    return rounded < size ? size : rounded;
+}
+#endif
+
+} // end anonymous namespace
+
+///
+/// NEW
+///
+
+void* operator new(std::size_t size)
+{
+    return allocate_or_throw(size, 0, CALLER());
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocate_or_throw(size, 0, CALLER());
+}
+
+void* operator new(std::size_t size, std::nothrow_t const&) noexcept
+{
+    return allocate(size, 0, CALLER());
+}
+
+void* operator new[](std::size_t size, std::nothrow_t const&) noexcept
+{
+    return allocate(size, 0, CALLER());
+}
+
+#if ALIGNED_NEW
+void* operator new(std::size_t size, std::align_val_t al)
+{
+    std::size_t alignment = alignment_of(al);
+    return allocate_or_throw(round_up(size, alignment), alignment, CALLER());
+}
+
+void* operator new[](std::size_t size, std::align_val_t al)
+{
+    std::size_t alignment = alignment_of(al);
+    return allocate_or_throw(round_up(size, alignment), alignment, CALLER());
+}
+
+void* operator new(std::size_t size, std::align_val_t al,
+                   std::nothrow_t const&) noexcept
+{
+    std::size_t alignment = alignment_of(al);
+    return allocate(round_up(size, alignment), alignment, CALLER());
+}
+
+void* operator new[](std::size_t size, std::align_val_t al,
+                     std::nothrow_t const&) noexcept
+{
+    std::size_t alignment = alignment_of(al);
+    return allocate(round_up(size, alignment), alignment, CALLER());
+}
+#endif
+
+///
+/// DELETE
+///
+
+void operator delete(void* p) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete(void* p, std::nothrow_t const&) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete[](void* p, std::nothrow_t const&) noexcept
+{
+    rtipd_free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* p, std::size_t) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    rtipd_free(p);
+}
+#endif
+
+#if ALIGNED_NEW
+void operator delete(void* p, std::align_val_t) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete(void* p, std::align_val_t,
+                     std::nothrow_t const&) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t,
+                       std::nothrow_t const&) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept
+{
+    rtipd_free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept
+{
+    rtipd_free(p);
+}
+#endif
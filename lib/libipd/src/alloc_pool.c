@@ -0,0 +1,223 @@
+// MAP_ANONYMOUS and MAP_NORESERVE are extensions:
+#define _GNU_SOURCE
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "alloc_pool.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include <pthread.h>
+
+#ifdef LIBIPD_HAS_POSIX
+#   include <sys/mman.h>
+#endif
+
+// Slabs are committed a slab at a time from an arena that is reserved
+// (but not committed) all at once.
+#define SLAB_SIZE   ((size_t)1 << 16)
+
+#if UINTPTR_MAX > 0xFFFFFFFFu
+#   define ARENA_SIZE  ((size_t)1 << 32)
+#else
+#   define ARENA_SIZE  ((size_t)1 << 28)
+#endif
+
+#define ARENA_SLABS  (ARENA_SIZE / SLAB_SIZE)
+
+// Sixteen-byte steps up to 128, and then four classes per doubling.
+// Every class is a multiple of 16, so every block is suitably aligned
+// for any type. Class 0 means that a slab hasn't been assigned yet.
+static size_t const class_size[] = {
+    0,
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256,
+    320, 384, 448, 512,
+    640, 768, 896, 1024,
+};
+
+#define CLASSES  (sizeof class_size / sizeof *class_size)
+
+// The class for each request size, in units of 16 bytes (rounded up).
+static uint8_t class_of_granule[ALLOC_POOL_MAX_SIZE / 16 + 1];
+
+static struct size_class
+{
+    _Alignas(64)
+    pthread_mutex_t lock;
+    void*           free_list;  // freed blocks, linked through word 0
+    char*           carve;      // next never-used block in newest slab
+    char*           carve_end;
+    size_t          live_bytes;
+}       classes[CLASSES];
+
+static pthread_once_t  pool_once  = PTHREAD_ONCE_INIT;
+static _Atomic(char*)  arena      = NULL;
+static _Atomic size_t  slabs_used = 0;
+
+// The size class of every slab handed out so far.
+static _Atomic uint8_t slab_class[ARENA_SLABS];
+
+static void reserve_arena(void)
+{
+    for (size_t c = 0; c < CLASSES; ++c)
+        pthread_mutex_init(&classes[c].lock, NULL);
+
+    size_t c = 1;
+    for (size_t g = 0; g < sizeof class_of_granule; ++g) {
+        while (class_size[c] < 16 * g) ++c;
+        class_of_granule[g] = (uint8_t)c;
+    }
+    class_of_granule[0] = 1;
+
+#ifdef LIBIPD_HAS_POSIX
+    void* base = mmap(NULL, ARENA_SIZE, PROT_NONE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base != MAP_FAILED) arena = base;
+#endif
+}
+
+bool alloc_pool_init(void)
+{
+    pthread_once(&pool_once, &reserve_arena);
+    return arena != NULL;
+}
+
+static inline size_t class_of(size_t size)
+{
+    return size <= ALLOC_POOL_MAX_SIZE
+        ? class_of_granule[(size + 15) / 16]
+        : 0;
+}
+
+size_t alloc_pool_size_class(size_t size)
+{
+    return class_size[class_of(size)];
+}
+
+// Commits a fresh slab for class `c`, which is locked.
+static bool new_slab(struct size_class* sc, size_t c)
+{
+#ifdef LIBIPD_HAS_POSIX
+    size_t index = atomic_fetch_add_explicit(&slabs_used, 1,
+                                             memory_order_relaxed);
+    if (index >= ARENA_SLABS) return false;
+
+    char* slab = arena + index * SLAB_SIZE;
+    if (mprotect(slab, SLAB_SIZE, PROT_READ | PROT_WRITE) != 0)
+        return false;
+
+    atomic_store_explicit(&slab_class[index], (uint8_t)c,
+                          memory_order_relaxed);
+
+    sc->carve     = slab;
+    sc->carve_end = slab + SLAB_SIZE / class_size[c] * class_size[c];
+    return true;
+#else
+    (void) sc;
+    (void) c;
+    return false;
+#endif
+}
+
+void* alloc_pool_malloc(size_t size)
+{
+    size_t c = class_of(size);
+    if (!c || !arena) return NULL;
+
+    struct size_class* sc = &classes[c];
+    void* result = NULL;
+
+    pthread_mutex_lock(&sc->lock);
+
+    if (sc->free_list) {
+        result = sc->free_list;
+        sc->free_list = *(void**)result;
+    } else if (sc->carve < sc->carve_end || new_slab(sc, c)) {
+        result = sc->carve;
+        sc->carve += class_size[c];
+    }
+
+    if (result) sc->live_bytes += class_size[c];
+
+    pthread_mutex_unlock(&sc->lock);
+    return result;
+}
+
+// Returns the class of `p`, or 0 if it isn't a pool block.
+static inline size_t class_of_block(void const* p)
+{
+    char const* base = atomic_load_explicit(&arena, memory_order_relaxed);
+    uintptr_t offset = (uintptr_t)p - (uintptr_t)base;
+
+    if (!base || offset >= ARENA_SIZE) return 0;
+
+    return atomic_load_explicit(&slab_class[offset / SLAB_SIZE],
+                                memory_order_relaxed);
+}
+
+size_t alloc_pool_block_size(void const* p)
+{
+    return class_size[class_of_block(p)];
+}
+
+bool alloc_pool_free(void* p)
+{
+    size_t c = class_of_block(p);
+    if (!c) return false;
+
+    struct size_class* sc = &classes[c];
+
+    pthread_mutex_lock(&sc->lock);
+    *(void**)p = sc->free_list;
+    sc->free_list = p;
+    sc->live_bytes -= class_size[c];
+    pthread_mutex_unlock(&sc->lock);
+
+    return true;
+}
+
+size_t alloc_pool_live_bytes(void)
+{
+    size_t total = 0;
+
+    for (size_t c = 1; c < CLASSES; ++c) {
+        pthread_mutex_lock(&classes[c].lock);
+        total += classes[c].live_bytes;
+        pthread_mutex_unlock(&classes[c].lock);
+    }
+
+    return total;
+}
+
+void alloc_pool_release_all(void)
+{
+    if (!arena) return;
+
+    size_t used = slabs_used;
+    if (used > ARENA_SLABS) used = ARENA_SLABS;
+
+    for (size_t c = 1; c < CLASSES; ++c) {
+        struct size_class* sc = &classes[c];
+        pthread_mutex_lock(&sc->lock);
+        sc->free_list  = NULL;
+        sc->carve      = sc->carve_end = NULL;
+        sc->live_bytes = 0;
+        pthread_mutex_unlock(&sc->lock);
+    }
+
+    for (size_t i = 0; i < used; ++i)
+        slab_class[i] = 0;
+
+#ifdef LIBIPD_HAS_POSIX
+    // Mapping fresh pages over the used slabs discards their contents
+    // and returns them to the reserved-only state.
+    if (used) {
+        mmap(arena, used * SLAB_SIZE, PROT_NONE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    }
+#endif
+
+    slabs_used = 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A pooled backend for alloc_rt.c. Small blocks come from per-size-class
+// free lists carved from 64 KiB slabs, which are in turn carved from a
+// single region of reserved address space. That makes telling whether
+// a block is ours a range check, and releasing every block one call.
+
+// The largest request the pool serves.
+#define ALLOC_POOL_MAX_SIZE  1024
+
+// Reserves the pool's address space, if that hasn't been done yet.
+// Returns false if it can't be.
+bool alloc_pool_init(void);
+
+// Returns the size of the blocks the pool would use for a request of
+// `size` bytes, or 0 if it wouldn't serve it.
+size_t alloc_pool_size_class(size_t size);
+
+// Returns a block of `alloc_pool_size_class(size)` bytes, or NULL if
+// `size` is too large or the pool is exhausted (or not initialized).
+void* alloc_pool_malloc(size_t size);
+
+// Returns the size of pool block `p`, or 0 if `p` isn't a pool block.
+size_t alloc_pool_block_size(void const* p);
+
+// Returns `p` to its free list, if it's a pool block; otherwise returns
+// false and does nothing.
+bool alloc_pool_free(void* p);
+
+// The total size of the pool blocks currently allocated.
+size_t alloc_pool_live_bytes(void);
+
+// Frees every pool block at once, and gives the memory back to the
+// operating system. Must not race with other pool calls.
+void alloc_pool_release_all(void);
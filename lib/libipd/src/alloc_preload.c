@@ -0,0 +1,205 @@
+// A replacement for the C library's allocator that routes every
+// allocation through the allocation runtime, for use with LD_PRELOAD.
+// This lets allocation limits, tracing, and profiling apply to programs
+// (and libraries) that weren't compiled against <ipd.h>.
+//
+// Only glibc is supported, since we rely on its __libc_* entry points
+// to reach the real allocator without going through dlsym(3), which
+// itself allocates.
+//
+// Every function that hands out a block or looks inside one has to be
+// here, since blocks with headers or from the pools mean nothing to
+// the C library.
+
+#define _GNU_SOURCE
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "alloc_rt.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// The rest of the library is built with hidden visibility, so that a
+// program with its own copy of the runtime doesn't capture our calls.
+#define PRELOAD_API  __attribute__((visibility("default")))
+
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void  __libc_free(void*);
+void* __libc_memalign(size_t, size_t);
+void* __libc_pvalloc(size_t);
+
+// Runs `EXPR` with `rtipd_in_runtime` set, so that the runtime's own
+// calls to the functions below go straight to the C library.
+#define IN_RUNTIME(RESULT, EXPR) \
+    do { \
+        rtipd_in_runtime = true; \
+        RESULT = (EXPR); \
+        rtipd_in_runtime = false; \
+    } while (false)
+
+#define CALLER()  __builtin_return_address(0)
+
+PRELOAD_API void* malloc(size_t size)
+{
+    if (rtipd_in_runtime) return __libc_malloc(size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_malloc_at(size, CALLER()));
+    return result;
+}
+
+PRELOAD_API void* calloc(size_t nmemb, size_t size)
+{
+    if (rtipd_in_runtime) return __libc_calloc(nmemb, size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_calloc_at(nmemb, size, CALLER()));
+    return result;
+}
+
+PRELOAD_API void* realloc(void* ptr, size_t size)
+{
+    if (rtipd_in_runtime) return __libc_realloc(ptr, size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_realloc_at(ptr, size, CALLER()));
+    return result;
+}
+
+PRELOAD_API void* reallocarray(void* ptr, size_t nmemb, size_t size)
+{
+    if (size && nmemb > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if (rtipd_in_runtime) return __libc_realloc(ptr, nmemb * size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_realloc_at(ptr, nmemb * size, CALLER()));
+    return result;
+}
+
+PRELOAD_API void free(void* ptr)
+{
+    if (rtipd_in_runtime) {
+        __libc_free(ptr);
+        return;
+    }
+
+    rtipd_in_runtime = true;
+    rtipd_free(ptr);
+    rtipd_in_runtime = false;
+}
+
+PRELOAD_API void* aligned_alloc(size_t alignment, size_t size)
+{
+    if (rtipd_in_runtime) return __libc_memalign(alignment, size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_aligned_alloc_at(alignment, size, CALLER()));
+    return result;
+}
+
+PRELOAD_API void* memalign(size_t alignment, size_t size)
+{
+    if (rtipd_in_runtime) return __libc_memalign(alignment, size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_aligned_alloc_at(alignment, size, CALLER()));
+    return result;
+}
+
+PRELOAD_API void* valloc(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    if (rtipd_in_runtime) return __libc_memalign(page, size);
+
+    void* result;
+    IN_RUNTIME(result, rtipd_aligned_alloc_at(page, size, CALLER()));
+    return result;
+}
+
+// Like valloc, but rounds the size up to a whole number of pages (and
+// at least one).
+PRELOAD_API void* pvalloc(size_t size)
+{
+    if (rtipd_in_runtime) return __libc_pvalloc(size);
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = size / page + (size % page != 0);
+    if (!pages) pages = 1;
+
+    if (pages > SIZE_MAX / page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void* result;
+    IN_RUNTIME(result,
+               rtipd_aligned_alloc_at(page, pages * page, CALLER()));
+    return result;
+}
+
+PRELOAD_API int posix_memalign(void** out, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void*) != 0 ||
+            (alignment & (alignment - 1)) != 0 || alignment == 0)
+        return EINVAL;
+
+    // Unlike the other functions, this one doesn't set errno.
+    int saved_errno = errno;
+    void* result;
+
+    if (rtipd_in_runtime)
+        result = __libc_memalign(alignment, size);
+    else
+        IN_RUNTIME(result,
+                   rtipd_aligned_alloc_at(alignment, size, CALLER()));
+
+    errno = saved_errno;
+
+    if (!result) return ENOMEM;
+
+    *out = result;
+    return 0;
+}
+
+// The C library doesn't export its own malloc_usable_size under
+// another name, so we look it up the first time the runtime needs it.
+// That's always in the runtime, so dlsym(3) allocates from the C
+// library.
+static size_t libc_usable_size(void* ptr)
+{
+    static size_t (*_Atomic real)(void*) = NULL;
+
+    size_t (*fn)(void*) = atomic_load_explicit(&real, memory_order_relaxed);
+    if (!fn) {
+        *(void**)&fn = dlsym(RTLD_NEXT, "malloc_usable_size");
+        if (!fn) return 0;
+        atomic_store_explicit(&real, fn, memory_order_relaxed);
+    }
+
+    return fn(ptr);
+}
+
+// Blocks with headers or from the pools aren't the C library's to
+// measure.
+PRELOAD_API size_t malloc_usable_size(void* ptr)
+{
+    if (rtipd_in_runtime) return libc_usable_size(ptr);
+
+    size_t result;
+    IN_RUNTIME(result, rtipd_usable_size(ptr));
+    return result;
+}
@@ -0,0 +1,265 @@
+// dladdr(3) is a GNU/BSD extension:
+#define _GNU_SOURCE
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "alloc_profile.h"
+#include "alloc_rt.h"
+#include "rt_env.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#ifdef LIBIPD_HAS_POSIX
+#   include <dlfcn.h>
+#endif
+
+#define EV_PROFILE     "RTIPD_ALLOC_PROFILE"
+
+// How many rows of each table to print.
+#define REPORT_ROWS    25
+
+#define MIN_SITES      256
+
+struct site_stats
+{
+    void const* site;           // NULL means the slot is empty
+    size_t      live_bytes;
+    size_t      peak_bytes;
+    size_t      live_blocks;
+    size_t      total_bytes;
+    size_t      total_blocks;
+};
+
+// An open-addressing table of call sites. There are usually only a few
+// hundred, so one lock suffices.
+static pthread_mutex_t    sites_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct site_stats* sites      = NULL;
+static size_t             sites_cap  = 0;
+static size_t             sites_used = 0;
+
+static FILE* profile_out = NULL;
+static pid_t profile_pid;
+
+static size_t site_bucket(void const* site, size_t cap)
+{
+    uint64_t h = (uint64_t)(uintptr_t)site * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(h >> 32) & (cap - 1);
+}
+
+static struct site_stats*
+probe_site(struct site_stats* table, size_t cap, void const* site)
+{
+    size_t i = site_bucket(site, cap);
+
+    while (table[i].site && table[i].site != site)
+        i = (i + 1) & (cap - 1);
+
+    return &table[i];
+}
+
+// Requires `sites_lock`. Returns NULL if out of memory.
+static struct site_stats* find_site(void const* site)
+{
+    if (2 * (sites_used + 1) > sites_cap) {
+        size_t new_cap = sites_cap ? 2 * sites_cap : MIN_SITES;
+        struct site_stats* bigger = calloc(new_cap, sizeof *bigger);
+        if (!bigger) return NULL;
+
+        for (size_t i = 0; i < sites_cap; ++i) {
+            if (sites[i].site)
+                *probe_site(bigger, new_cap, sites[i].site) = sites[i];
+        }
+
+        free(sites);
+        sites     = bigger;
+        sites_cap = new_cap;
+    }
+
+    struct site_stats* stats = probe_site(sites, sites_cap, site);
+    if (!stats->site) {
+        stats->site = site;
+        ++sites_used;
+    }
+
+    return stats;
+}
+
+void alloc_profile_alloc(void const* site, size_t size)
+{
+    pthread_mutex_lock(&sites_lock);
+
+    struct site_stats* stats = find_site(site);
+    if (stats) {
+        stats->live_bytes   += size;
+        stats->live_blocks  += 1;
+        stats->total_bytes  += size;
+        stats->total_blocks += 1;
+        if (stats->live_bytes > stats->peak_bytes)
+            stats->peak_bytes = stats->live_bytes;
+    }
+
+    pthread_mutex_unlock(&sites_lock);
+}
+
+void alloc_profile_free(void const* site, size_t size)
+{
+    pthread_mutex_lock(&sites_lock);
+
+    struct site_stats* stats = find_site(site);
+    if (stats) {
+        stats->live_bytes  -= size;
+        stats->live_blocks -= 1;
+    }
+
+    pthread_mutex_unlock(&sites_lock);
+}
+
+
+///
+/// REPORTING
+///
+
+// Prints `site` as an address plus, if we can find them, the nearest
+// symbol and the offset into its object file (for addr2line(1)).
+static void print_site(void const* site)
+{
+    if (!site) {
+        fprintf(profile_out, "(unknown)");
+        return;
+    }
+
+    fprintf(profile_out, "%p", site);
+
+#ifdef LIBIPD_HAS_POSIX
+    Dl_info info;
+    if (dladdr(site, &info) && info.dli_fname) {
+        char const* pc = site;
+
+        if (info.dli_sname) {
+            fprintf(profile_out, " %s+0x%zx", info.dli_sname,
+                    (size_t)(pc - (char const*)info.dli_saddr));
+        }
+
+        char const* base = strrchr(info.dli_fname, '/');
+        fprintf(profile_out, " (%s+0x%zx)",
+                base ? base + 1 : info.dli_fname,
+                (size_t)(pc - (char const*)info.dli_fbase));
+    }
+#endif
+}
+
+static int by_peak_bytes(void const* a, void const* b)
+{
+    size_t x = ((struct site_stats const*)a)->peak_bytes;
+    size_t y = ((struct site_stats const*)b)->peak_bytes;
+    return (x < y) - (x > y);
+}
+
+// Ties are broken by live blocks, so that sites with only zero-byte
+// blocks outstanding still sort ahead of sites with none.
+static int by_live_bytes(void const* a, void const* b)
+{
+    struct site_stats const* x = a;
+    struct site_stats const* y = b;
+
+    if (x->live_bytes != y->live_bytes)
+        return (x->live_bytes < y->live_bytes) -
+            (x->live_bytes > y->live_bytes);
+
+    return (x->live_blocks < y->live_blocks) -
+        (x->live_blocks > y->live_blocks);
+}
+
+static void print_more(size_t shown, size_t total)
+{
+    if (total > shown)
+        fprintf(profile_out, "  ... and %zu more call sites\n",
+                total - shown);
+}
+
+static void print_profile(void)
+{
+    // Forked children (such as test cases) inherit our handler, but the
+    // profile belongs to the process that started it.
+    if (getpid() != profile_pid) return;
+
+    rtipd_in_runtime = true;
+    pthread_mutex_lock(&sites_lock);
+
+    // Compact the table in place; we're done with it.
+    size_t n = 0;
+    for (size_t i = 0; i < sites_cap; ++i) {
+        if (sites[i].site) sites[n++] = sites[i];
+    }
+
+    fprintf(profile_out, "\nrtipd heap profile (%zu call sites)\n\n", n);
+    fprintf(profile_out, "%12s %12s %12s %10s  %s\n",
+            "peak bytes", "total bytes", "live bytes", "allocs",
+            "call site");
+
+    qsort(sites, n, sizeof *sites, &by_peak_bytes);
+
+    size_t shown = n < REPORT_ROWS ? n : REPORT_ROWS;
+    for (size_t i = 0; i < shown; ++i) {
+        fprintf(profile_out, "%12zu %12zu %12zu %10zu  ",
+                sites[i].peak_bytes, sites[i].total_bytes,
+                sites[i].live_bytes, sites[i].total_blocks);
+        print_site(sites[i].site);
+        fprintf(profile_out, "\n");
+    }
+    print_more(shown, n);
+
+    qsort(sites, n, sizeof *sites, &by_live_bytes);
+
+    size_t leaks = 0, leaked_bytes = 0, leaked_blocks = 0;
+    while (leaks < n && sites[leaks].live_blocks) {
+        leaked_bytes  += sites[leaks].live_bytes;
+        leaked_blocks += sites[leaks].live_blocks;
+        ++leaks;
+    }
+
+    if (leaks) {
+        fprintf(profile_out,
+                "\nUnfreed at exit: %zu bytes in %zu blocks "
+                "from %zu sites\n\n",
+                leaked_bytes, leaked_blocks, leaks);
+        fprintf(profile_out, "%12s %10s  %s\n",
+                "bytes", "blocks", "call site");
+
+        shown = leaks < REPORT_ROWS ? leaks : REPORT_ROWS;
+        for (size_t i = 0; i < shown; ++i) {
+            fprintf(profile_out, "%12zu %10zu  ",
+                    sites[i].live_bytes, sites[i].live_blocks);
+            print_site(sites[i].site);
+            fprintf(profile_out, "\n");
+        }
+        print_more(shown, leaks);
+    } else {
+        fprintf(profile_out, "\nNo blocks unfreed at exit.\n");
+    }
+
+    fflush(profile_out);
+
+    free(sites);
+    sites = NULL;
+    sites_cap = sites_used = 0;
+
+    pthread_mutex_unlock(&sites_lock);
+    rtipd_in_runtime = false;
+}
+
+bool alloc_profile_init(void)
+{
+    profile_out = rtipd_env_open(EV_PROFILE, "w");
+    if (!profile_out) return false;
+
+    profile_pid = getpid();
+    atexit(&print_profile);
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Heap profiling by call site, for alloc_rt.c. When enabled (by the
+// RTIPD_ALLOC_PROFILE environment variable), the allocation runtime
+// reports every allocation and deallocation here along with the
+// return address of the allocating call, and at exit we print a table
+// of call sites by peak live bytes and another of unfreed blocks.
+
+// Reads the environment and returns whether profiling is enabled. Call
+// once.
+bool alloc_profile_init(void);
+
+// Records that `size` bytes were allocated from `site`.
+void alloc_profile_alloc(void const* site, size_t size);
+
+// Records that `size` bytes allocated from `site` were freed.
+void alloc_profile_free(void const* site, size_t size);
@@ -3,21 +3,32 @@
 #define LIBIPD_RAW_EXIT
 
 #include "ipd_alloc_limit.h"
+#include "ipd_alloc_pool.h"
 #include "ipd.h"
+#include "alloc_header.h"
+#include "alloc_pool.h"
+#include "alloc_profile.h"
+#include "alloc_rt.h"
+#include "alloc_stats.h"
+#include "alloc_table.h"
+#include "alloc_timeline.h"
+#include "alloc_trace_format.h"
+#include "rt_env.h"
 
-#include <ctype.h>
 #include <errno.h>
-#include <limits.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <stdlib.h>
 #include <stdnoreturn.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include <pthread.h>
+
 #define EV_PEAK   "RTIPD_ALLOC_LIMIT_PEAK"
 #define EV_TOTAL  "RTIPD_ALLOC_LIMIT_TOTAL"
 
@@ -25,62 +36,282 @@
 #define EV_PEAK2  "RTIPD_HEAP_LIMIT"
 #define EV_TOTAL2 "RTIPD_ALLOC_LIMIT"
 
+#define EV_TRACE            "RTIPD_TRACE"
+#define EV_TRACE_FORMAT     "RTIPD_TRACE_FORMAT"
+#define EV_TRACE_SAMPLE     "RTIPD_TRACE_SAMPLE"
+#define EV_TRACE_MIN_SIZE   "RTIPD_TRACE_MIN_SIZE"
+
+#define EV_FAIL_AT          "RTIPD_ALLOC_FAIL_AT"
+#define EV_FAIL_RATE        "RTIPD_ALLOC_FAIL_RATE"
+#define EV_FAIL_SEED        "RTIPD_ALLOC_FAIL_SEED"
+
+#define EV_POOL             "RTIPD_ALLOC_POOL"
+#define EV_HEADERS          "RTIPD_ALLOC_HEADERS"
+#define EV_CANARY           "RTIPD_ALLOC_CANARY"
+#define EV_STATS            "RTIPD_ALLOC_STATS"
+
+_Thread_local bool rtipd_in_runtime = false;
+
+
 ///
 /// TRACING
 ///
 
-static bool trace_is_init = false;
-static FILE* trace_out    = NULL;
+// Each thread formats its trace lines (or binary records) into its own
+// buffer, which is written to `trace_out` a block at a time. Since
+// stdio locks the stream for each fwrite(3), blocks from different
+// threads never interleave, although events from different threads
+// may be reordered.
+
+#define TRACE_BUFFER_SIZE  (64 * 1024)
+#define TRACE_LINE_MAX     256
+
+struct trace_buffer
+{
+    pthread_mutex_t      lock;
+    size_t               fill;
+    struct trace_buffer* next;
+    uint32_t             thread;        // for binary records
+    unsigned long        sample_count;  // only touched by owner
+    char                 data[TRACE_BUFFER_SIZE];
+};
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static FILE* _Atomic  trace_out  = NULL;
+
+static enum {
+    TRACE_TEXT,     // one formatted line per call, before the call
+    TRACE_BINARY    // one `struct rtipd_trace_record` per call, after
+}       trace_format = TRACE_TEXT;
+
+// Binary traces keep only every `trace_sample_every`th event, and only
+// allocations of at least `trace_min_size` bytes. (Frees have no size,
+// so the size threshold doesn't apply to them.)
+static unsigned long trace_sample_every = 1;
+static size_t        trace_min_size     = 0;
+
+// Every live thread's buffer, so that we can flush them all at exit.
+static pthread_mutex_t      trace_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_buffer* trace_list      = NULL;
+static _Atomic uint32_t     trace_threads   = 0;
 
+// Has a destructor to flush and free the buffer when its thread exits.
+static pthread_key_t trace_key;
+
+static _Thread_local struct trace_buffer* my_trace_buffer = NULL;
+
+// Requires buf->lock.
 static void
-close_trace_out(void)
+flush_trace_buffer_locked(struct trace_buffer* buf)
 {
-    if (trace_out) {
-        fclose(trace_out);
-        trace_out = NULL;
+    if (buf->fill) {
+        fwrite(buf->data, 1, buf->fill, trace_out);
+        buf->fill = 0;
     }
 }
 
 static void
-tracing_init_once(void)
+flush_trace_buffer(struct trace_buffer* buf)
+{
+    pthread_mutex_lock(&buf->lock);
+    flush_trace_buffer_locked(buf);
+    pthread_mutex_unlock(&buf->lock);
+}
+
+static void
+release_trace_buffer(void* arg)
 {
-    if (trace_is_init) return;
+    struct trace_buffer* buf = arg;
 
-    atexit(&close_trace_out);
+    rtipd_in_runtime = true;
+    flush_trace_buffer(buf);
 
-    const char* trace_dst = getenv("RTIPD_TRACE");
-    if (! trace_dst) {
-        // all set
-    } else if (trace_dst[0] == '&' && trace_dst[1] != 0) {
-        char* endptr;
-        long fd = strtol(&trace_dst[1], &endptr, 10);
-        if (*endptr == 0 && 0 <= fd && fd <= (long)INT_MAX) {
-            trace_out = fdopen((int)fd, "w");
+    pthread_mutex_lock(&trace_list_lock);
+    for (struct trace_buffer** cur = &trace_list; *cur; cur = &(*cur)->next) {
+        if (*cur == buf) {
+            *cur = buf->next;
+            break;
         }
+    }
+    pthread_mutex_unlock(&trace_list_lock);
+
+    pthread_mutex_destroy(&buf->lock);
+    free(buf);
+    rtipd_in_runtime = false;
+}
+
+// We flush rather than close, because other threads may still be
+// tracing while the main thread runs the exit handlers.
+static void
+flush_trace_out(void)
+{
+    rtipd_in_runtime = true;
+
+    pthread_mutex_lock(&trace_list_lock);
+    for (struct trace_buffer* buf = trace_list; buf; buf = buf->next)
+        flush_trace_buffer(buf);
+    pthread_mutex_unlock(&trace_list_lock);
+
+    fflush(trace_out);
+
+    rtipd_in_runtime = false;
+}
+
+static void
+trace_format_init(void)
+{
+    char const* format = getenv(EV_TRACE_FORMAT);
+    if (!format || !*format || strcmp(format, "text") == 0) {
+        trace_format = TRACE_TEXT;
+    } else if (strcmp(format, "binary") == 0) {
+        trace_format = TRACE_BINARY;
     } else {
-        trace_out = fopen(trace_dst, "w");
+        rtipd_bad_env_var(EV_TRACE_FORMAT, format);
+    }
+
+    char const* sample = getenv(EV_TRACE_SAMPLE);
+    if (sample && *sample) {
+        char* end;
+        trace_sample_every = strtoul(sample, &end, 10);
+        if (*end || trace_sample_every == 0)
+            rtipd_bad_env_var(EV_TRACE_SAMPLE, sample);
     }
 
-    trace_is_init = true;
+    rtipd_env_size(EV_TRACE_MIN_SIZE, &trace_min_size);
+}
+
+static bool
+write_trace_header(FILE* out)
+{
+    struct rtipd_trace_header header = {
+        .byte_order  = RTIPD_TRACE_BYTE_ORDER,
+        .version     = RTIPD_TRACE_VERSION,
+        .record_size = sizeof(struct rtipd_trace_record),
+    };
+    memcpy(header.magic, RTIPD_TRACE_MAGIC, sizeof header.magic);
+
+    return fwrite(&header, sizeof header, 1, out) == 1;
+}
+
+static void
+tracing_init(void)
+{
+    if (! getenv(EV_TRACE)) {
+        return;
+    }
+
+    trace_format_init();
+    FILE* out = rtipd_env_open(EV_TRACE,
+                               trace_format == TRACE_BINARY ? "wb" : "w");
+
+    if (out && trace_format == TRACE_BINARY && !write_trace_header(out)) {
+        fclose(out);
+        out = NULL;
+    }
+
+    if (out) {
+        pthread_key_create(&trace_key, &release_trace_buffer);
+        trace_out = out;
+        atexit(&flush_trace_out);
+    }
 }
 
 static bool
 alloc_trace_is_enabled(void)
 {
-    tracing_init_once();
+    pthread_once(&trace_once, &tracing_init);
     return trace_out != NULL;
 }
 
+static struct trace_buffer*
+get_trace_buffer(void)
+{
+    if (my_trace_buffer) return my_trace_buffer;
+
+    struct trace_buffer* buf = malloc(sizeof *buf);
+    if (!buf) return NULL;
+
+    pthread_mutex_init(&buf->lock, NULL);
+    buf->fill         = 0;
+    buf->thread       = ++trace_threads;
+    buf->sample_count = 0;
+
+    pthread_mutex_lock(&trace_list_lock);
+    buf->next  = trace_list;
+    trace_list = buf;
+    pthread_mutex_unlock(&trace_list_lock);
+
+    pthread_setspecific(trace_key, buf);
+    return my_trace_buffer = buf;
+}
+
+static void
+trace_append(struct trace_buffer* buf, void const* data, size_t len)
+{
+    pthread_mutex_lock(&buf->lock);
+    if (buf->fill + len > sizeof buf->data)
+        flush_trace_buffer_locked(buf);
+    memcpy(buf->data + buf->fill, data, len);
+    buf->fill += len;
+    pthread_mutex_unlock(&buf->lock);
+}
+
 static void
 alloc_tracef(char const* format, ...)
 {
-    if (!alloc_trace_is_enabled()) return;
+    if (!alloc_trace_is_enabled() || trace_format != TRACE_TEXT) return;
+
+    char line[TRACE_LINE_MAX];
 
     va_list ap;
     va_start(ap, format);
-    vfprintf(trace_out, format, ap);
+    int len = vsnprintf(line, sizeof line - 1, format, ap);
     va_end(ap);
-    fprintf(trace_out, "\n");
+
+    if (len < 0) return;
+    if ((size_t)len > sizeof line - 2) len = sizeof line - 2;
+    line[len++] = '\n';
+
+    struct trace_buffer* buf = get_trace_buffer();
+    if (buf)
+        trace_append(buf, line, (size_t)len);
+    else
+        fwrite(line, 1, (size_t)len, trace_out);
+}
+
+// Records a completed call in a binary trace. `pointer` is passed as
+// an integer, since the block it referred to may be gone by now.
+static void
+alloc_trace_event(enum rtipd_trace_op op,
+                  uintptr_t pointer,
+                  void const* result,
+                  size_t size)
+{
+    if (!alloc_trace_is_enabled() || trace_format != TRACE_BINARY) return;
+
+    if (op != RTIPD_TRACE_FREE && size < trace_min_size) return;
+
+    struct trace_buffer* buf = get_trace_buffer();
+    if (!buf) return;
+
+    if (trace_sample_every > 1 &&
+            buf->sample_count++ % trace_sample_every != 0)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct rtipd_trace_record record = {
+        .timestamp = (uint64_t)now.tv_sec * 1000000000u
+                     + (uint64_t)now.tv_nsec,
+        .pointer   = pointer,
+        .result    = (uintptr_t)result,
+        .size      = size,
+        .thread    = buf->thread,
+        .op        = (uint8_t)op,
+    };
+
+    trace_append(buf, &record, sizeof record);
 }
 
 
@@ -88,214 +319,567 @@ alloc_tracef(char const* format, ...)
 /// ALLOCATION INSTRUMENTATION
 ///
 
-// A linked list mapping pointers to allocation sizes.
-typedef struct alloc_record
-{
-    void*  pointer;
-    size_t size;
-    struct alloc_record* next;
-}       *alloc_list_t;
-
 // The state of the allocation limit system:
-static enum {
+static _Atomic enum alloc_limit_mode {
     UNINITIALIZED,
     NO_LIMIT,
     LIMIT_TOTAL, // limit total bytes allocated ever (free irrelevant)
     LIMIT_PEAK   // limit total bytes allocated at once (free helps)
 }       alloc_limit_state = UNINITIALIZED;
 
+static pthread_once_t alloc_rt_once = PTHREAD_ONCE_INIT;
+
 // Remaining bytes allowed to allocate. If the state is LIMIT_PEAK then
 // free() adds to this, whereas with LIMIT_TOTAL this number is monotone
-// decreasing (unless you reset it explicitly).
-static size_t bytes_remaining;
-
-// A map from every allocated pointer to its size.
-static alloc_list_t allocation_list = NULL;
+// decreasing (unless you reset it explicitly). Allocations reserve
+// their bytes before calling malloc(3) and refund them if it fails, so
+// concurrent threads can never overdraw the budget.
+static _Atomic size_t bytes_remaining;
+
+// Incremented whenever a new limit is set. Only blocks remembered
+// during the current epoch were charged against the current limit, so
+// only they are refunded when freed.
+static _Atomic unsigned limit_epoch = 0;
+
+// Whether we're profiling allocations by call site (RTIPD_ALLOC_PROFILE).
+// Set once during initialization.
+static bool profiling = false;
+
+// Whether we're recording heap usage over time (RTIPD_ALLOC_TIMELINE).
+// Set once during initialization.
+static bool timeline = false;
+
+// Whether small blocks come from the pools; see ALLOCATION BACKEND.
+static _Atomic bool pooling = false;
+
+// Whether pooling has ever been on, in which case pool blocks may be
+// live, so every free must check for them.
+static _Atomic bool pooled_ever = false;
+
+// Whether we keep the statistics behind <ipd_alloc_stats.h>. On unless
+// RTIPD_ALLOC_STATS=0. (Attempts for alloc_fail_count() are counted
+// either way, since RUN_OOM_SWEEP needs them.)
+static bool counting = true;
+
+// A map from every allocated pointer to its size, split into shards
+// by pointer so that threads freeing unrelated blocks rarely contend.
+// We only maintain it when it's needed: for profiling, or for peak
+// limits when blocks don't have headers to record their sizes (or when
+// pooling, since alloc_pool_reset() needs to find the pooled blocks).
+#define TABLE_SHARDS  64
+
+static struct table_shard
+{
+    _Alignas(64)
+    pthread_mutex_t    lock;
+    struct alloc_table table;
+}       allocation_shards[TABLE_SHARDS];
+
+static pthread_once_t shards_once = PTHREAD_ONCE_INIT;
+
+// The return address of the instrumented function, which is the call
+// site in the user's code.
+#ifdef __GNUC__
+#   define CALLER()  __builtin_return_address(0)
+#else
+#   define CALLER()  NULL
+#endif
+
+static void set_limit(enum alloc_limit_mode, size_t);
+static void set_pooling(bool);
+static void fail_init(void);
+static void select_dispatch(void);
 
-static noreturn void
-bad_env_var(char const* name, char const* value)
+static void
+alloc_rt_init(void)
 {
-    fprintf(stderr, "rtipd_alloc: could not understand %s value: ‘%s’",
-            name, value);
-    exit(254);
+    size_t n;
+    unsigned long pool, headers, stats;
+
+    profiling = alloc_profile_init();
+    timeline  = alloc_timeline_init();
+    fail_init();
+
+    // The timeline samples the statistics, so it needs them.
+    if (rtipd_env_ulong(EV_STATS, &stats) && !stats && !timeline)
+        counting = false;
+
+    if (rtipd_env_ulong(EV_CANARY, &headers) && headers)
+        alloc_header_enable(true);
+    else if (rtipd_env_ulong(EV_HEADERS, &headers) && headers)
+        alloc_header_enable(false);
+
+    if (rtipd_env_ulong(EV_POOL, &pool))
+        set_pooling(pool != 0);
+
+    if (rtipd_env_size(EV_TOTAL, &n) || rtipd_env_size(EV_TOTAL2, &n))
+        set_limit(LIMIT_TOTAL, n);
+
+    else if (rtipd_env_size(EV_PEAK, &n) || rtipd_env_size(EV_PEAK2, &n))
+        set_limit(LIMIT_PEAK, n);
+
+    else
+        set_limit(NO_LIMIT, 0);
+
+    select_dispatch();
 }
 
-static bool
-get_limit(char const* const name, size_t* const out)
+#define ENSURE_ALLOC_DEBUG_INIT() \
+    if (alloc_limit_state == UNINITIALIZED) \
+        pthread_once(&alloc_rt_once, &alloc_rt_init)
+
+static void init_shards(void)
 {
-    char *const original = getenv(name),
-         *begin = original,
-         *end;
-    unsigned long size;
+    for (size_t i = 0; i < TABLE_SHARDS; ++i) {
+        pthread_mutex_init(&allocation_shards[i].lock, NULL);
+        allocation_shards[i].table =
+            (struct alloc_table) ALLOC_TABLE_INIT;
+    }
+}
 
-    if (!begin) return false;
+// Locks and returns the shard responsible for `p`.
+static struct table_shard* lock_shard(void const* p)
+{
+    pthread_once(&shards_once, &init_shards);
 
-    while (isspace(*begin)) ++begin;
-    if (!*begin) return false;
+    uintptr_t bits = (uintptr_t)p >> 4;
+    struct table_shard* shard =
+        &allocation_shards[(bits ^ (bits >> 12)) % TABLE_SHARDS];
 
-    size = strtoul(begin, &end, 10);
-    if (begin == end)
-        bad_env_var(name, original);
+    pthread_mutex_lock(&shard->lock);
+    return shard;
+}
 
-    while (isspace(*end)) ++end;
+static void unlock_shard(struct table_shard* shard)
+{
+    pthread_mutex_unlock(&shard->lock);
+}
 
-    switch (*end) {
-    case 'B': case 'b': case 0:
-        *out = size;
-        return true;
+static void forget_everything(void)
+{
+    pthread_once(&shards_once, &init_shards);
 
-    case 'K': case 'k':
-        *out = size << 10;
-        return true;
+    for (size_t i = 0; i < TABLE_SHARDS; ++i) {
+        struct table_shard* shard = &allocation_shards[i];
+        pthread_mutex_lock(&shard->lock);
+        alloc_table_clear(&shard->table);
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
 
-    case 'M': case 'm':
-        *out = size << 20;
-        return true;
+static bool tracking_is_enabled(void)
+{
+    return profiling ||
+        (alloc_limit_state == LIMIT_PEAK &&
+             (!alloc_header_enabled || pooling));
+}
 
-    case 'G': case 'g':
-        *out = size << 30;
-        return true;
+static void remember_entry(struct alloc_entry entry)
+{
+    struct table_shard* shard = lock_shard(entry.pointer);
+    bool ok = alloc_table_insert(&shard->table, entry);
+    unlock_shard(shard);
 
-    default:
-        bad_env_var(name, original);
+    if (!ok) {
+        perror("libipd_alloc");
+        exit(255);
     }
 }
 
-static void
-alloc_limit_init_once(void)
+static void remember_allocation(void* p, size_t n, void const* site)
 {
-    size_t n;
+    struct alloc_entry entry = {p, n, site, limit_epoch};
+    remember_entry(entry);
+}
 
-    if (get_limit(EV_TOTAL, &n) || get_limit(EV_TOTAL2, &n))
-        alloc_limit_set_total(n);
+// Removes `p` from the table, storing its entry in `*out`. If `p`
+// wasn't there, returns false and leaves `*out` with size 0.
+static bool forget_allocation(void* p, struct alloc_entry* out)
+{
+    *out = (struct alloc_entry) {p, 0, NULL, 0};
 
-    else if (get_limit(EV_PEAK, &n) || get_limit(EV_PEAK2, &n))
-        alloc_limit_set_peak(n);
+    struct table_shard* shard = lock_shard(p);
+    bool found = alloc_table_remove(&shard->table, p, out);
+    unlock_shard(shard);
 
-    else
-        alloc_limit_set_no_limit();
+    return found;
 }
 
-#define ENSURE_ALLOC_DEBUG_INIT() \
-    if (alloc_limit_state == UNINITIALIZED) alloc_limit_init_once()
+// How much freeing the block described by `entry` gives back to the
+// current peak limit.
+static size_t charged_size(struct alloc_entry const* entry)
+{
+    return alloc_limit_state == LIMIT_PEAK && entry->epoch == limit_epoch
+        ? entry->size
+        : 0;
+}
+
+// Likewise, for a block with a header, which has room for 32 bits of
+// the epoch: enough for billions of limits before one could be mistaken
+// for another.
+static size_t header_charged_size(void const* p)
+{
+    struct alloc_header const* header = alloc_header_of(p);
+
+    return alloc_limit_state == LIMIT_PEAK &&
+            header->epoch == (uint32_t)limit_epoch
+        ? header->size
+        : 0;
+}
 
-static alloc_list_t
-find_alloc_record(void* p)
+static bool alloc_limit_is_active(void)
 {
-    for (alloc_list_t cur = allocation_list; cur; cur = cur->next) {
-        if (cur->pointer == p) {
-            return cur;
+    return alloc_limit_state == LIMIT_TOTAL ||
+        alloc_limit_state == LIMIT_PEAK;
+}
+
+// Takes `n` bytes from the budget, if there is one and `n` fits.
+static bool alloc_limit_may_alloc(size_t n)
+{
+    if (!alloc_limit_is_active()) return true;
+
+    size_t have = atomic_load_explicit(&bytes_remaining,
+                                       memory_order_relaxed);
+    do {
+        if (n > have) {
+            alloc_tracef(
+                    "libipd_alloc: preventing allocation of %zu bytes "
+                    "because\nremaining limit is %zu",
+                    n, have);
+            errno = ENOMEM;
+            return false;
         }
+    } while (!atomic_compare_exchange_weak_explicit(
+                &bytes_remaining, &have, have - n,
+                memory_order_relaxed, memory_order_relaxed));
+
+    return true;
+}
+
+static void alloc_limit_refund(size_t n)
+{
+    if (alloc_limit_is_active() && n)
+        atomic_fetch_add_explicit(&bytes_remaining, n,
+                                  memory_order_relaxed);
+}
+
+static void* alloc_limit_did_alloc(void* p, size_t n, void const* site)
+{
+    if (!p) {
+        alloc_limit_refund(n);
+        return NULL;
+    }
+
+    if (tracking_is_enabled()) {
+        remember_allocation(p, n, site);
+        if (profiling) alloc_profile_alloc(site, n);
     }
 
-    return NULL;
+    return p;
 }
 
-static size_t
-lookup_and_forget_size(void* p)
+static void alloc_limit_will_free(void* p)
 {
-    size_t size = 0;
+    if (alloc_header_enabled)
+        alloc_limit_refund(header_charged_size(p));
 
-    for (alloc_list_t* cur = &allocation_list; *cur; cur = &(*cur)->next) {
-        if ((*cur)->pointer == p) {
-            alloc_list_t victim = *cur;
-            *cur = victim->next;
-            size = victim->size;
-            free(victim);
-            break;
-        }
+    if (!tracking_is_enabled()) return;
+
+    struct alloc_entry entry;
+    if (forget_allocation(p, &entry)) {
+        if (!alloc_header_enabled)
+            alloc_limit_refund(charged_size(&entry));
+        if (profiling) alloc_profile_free(entry.site, entry.size);
     }
+}
+
 
-    return size;
+///
+/// INJECTING ALLOCATION FAILURE
+///
+
+// Independently of any byte limit, we can fail one particular
+// allocation, or fail allocations at random. Either way we number the
+// allocations from 1, so a given number or seed always fails the same
+// ones (in a single-threaded program).
+
+static _Atomic enum {
+    FAIL_NEVER,
+    FAIL_AT,        // fail allocation number `fail_at`
+    FAIL_RANDOMLY   // fail those whose hash is below `fail_threshold`
+}       fail_mode = FAIL_NEVER;
+
+static _Atomic size_t fail_attempts = 0;
+static size_t         fail_at;
+static uint64_t       fail_threshold;
+static uint64_t       fail_seed;
+
+// The SplitMix64 finalizer.
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= UINT64_C(0xBF58476D1CE4E5B9);
+    x ^= x >> 27;
+    x *= UINT64_C(0x94D049BB133111EB);
+    x ^= x >> 31;
+    return x;
 }
 
-static void forget_everything(void)
+static void set_fail_at(size_t n)
 {
-    alloc_list_t list = allocation_list;
-    allocation_list = NULL;
+    fail_at       = n;
+    fail_attempts = 0;
+    fail_mode     = n ? FAIL_AT : FAIL_NEVER;
+}
+
+static void set_fail_randomly(double p, unsigned long seed)
+{
+    if (p >= 1)
+        fail_threshold = UINT64_MAX;
+    else if (p > 0)
+        fail_threshold = (uint64_t)(p * 18446744073709551616.0);
+    else
+        fail_threshold = 0;
 
-    while (list) {
-        alloc_list_t victim = list;
-        list = list->next;
-        free(victim);
+    fail_seed     = mix64(seed);
+    fail_attempts = 0;
+    fail_mode     = fail_threshold ? FAIL_RANDOMLY : FAIL_NEVER;
+}
+
+static void fail_init(void)
+{
+    unsigned long n, seed = 0;
+    double p;
+
+    if (rtipd_env_ulong(EV_FAIL_AT, &n))
+        set_fail_at(n);
+
+    else if (rtipd_env_double(EV_FAIL_RATE, &p)) {
+        if (!(0 <= p && p <= 1))
+            rtipd_bad_env_var(EV_FAIL_RATE, getenv(EV_FAIL_RATE));
+        rtipd_env_ulong(EV_FAIL_SEED, &seed);
+        set_fail_randomly(p, seed);
     }
 }
 
-static void remember_allocation(void* p, size_t n)
+// Counts an allocation attempt and decides whether to fail it.
+static bool alloc_fail_injected(void)
 {
-    alloc_list_t node = malloc(sizeof *node);
-    if (!node) {
-        perror("libipd_alloc");
-        exit(255);
+    size_t n = 1 + atomic_fetch_add_explicit(&fail_attempts, 1,
+                                             memory_order_relaxed);
+    bool fail;
+
+    switch (fail_mode) {
+    case FAIL_AT:
+        fail = n == fail_at;
+        break;
+    case FAIL_RANDOMLY:
+        fail = mix64(fail_seed ^ n) < fail_threshold;
+        break;
+    default:
+        return false;
+    }
+
+    if (fail) {
+        alloc_tracef("libipd_alloc: injecting failure of allocation #%zu",
+                     n);
+        errno = ENOMEM;
     }
 
-    node->pointer = p;
-    node->size = n;
-    node->next = allocation_list;
-    allocation_list = node;
+    return fail;
 }
 
-static void forget_allocation(void* p)
+
+///
+/// ALLOCATION BACKEND
+///
+
+// Where blocks actually come from: the C library, or, while pooling is
+// on, size-class pools for small blocks (see alloc_pool.h). Pool blocks
+// may outlive pooling being turned off, so freeing and reallocating
+// always check whether a block is from the pool.
+//
+// With inline headers (see alloc_header.h), the raw_* functions below
+// allocate the whole block, and the backend_* functions above them add
+// and remove the header. Otherwise they're the same.
+
+static void set_pooling(bool on)
 {
-    bytes_remaining += lookup_and_forget_size(p);
+    pooling = on && alloc_pool_init();
+    if (pooling) pooled_ever = true;
 }
 
-static bool alloc_limit_may_alloc(size_t n)
+static inline void*
+raw_malloc(size_t size)
 {
-    if ((alloc_limit_state == LIMIT_TOTAL || alloc_limit_state == LIMIT_PEAK)
-            && n > bytes_remaining)
-    {
-        alloc_tracef(
-                "libipd_alloc: preventing allocation of %zu bytes "
-                "because\nremaining limit is %zu",
-                n, bytes_remaining);
-        errno = ENOMEM;
-        return false;
+    if (pooling) {
+        void* result = alloc_pool_malloc(size);
+        if (result) return result;
     }
 
-    return true;
+    return malloc(size);
 }
 
-static void* alloc_limit_did_alloc(void* p, size_t n)
+static inline void*
+raw_calloc(size_t nmemb, size_t size)
 {
-    if (!p) return NULL;
+    if (pooling && (size == 0 || nmemb <= ALLOC_POOL_MAX_SIZE / size)) {
+        void* result = alloc_pool_malloc(nmemb * size);
+        if (result) return memset(result, 0, nmemb * size);
+    }
 
-    if (alloc_limit_state == LIMIT_PEAK)
-        remember_allocation(p, n);
+    return calloc(nmemb, size);
+}
 
-    if (alloc_limit_state == LIMIT_PEAK ||
-            alloc_limit_state == LIMIT_TOTAL)
-        bytes_remaining -= n;
+static inline void
+raw_free(void* ptr)
+{
+    if (!alloc_pool_free(ptr)) free(ptr);
+}
 
-    return p;
+static inline void*
+raw_realloc(void* ptr, size_t new_size)
+{
+    size_t old_size = alloc_pool_block_size(ptr);
+    if (!old_size) return realloc(ptr, new_size);
+
+    if (new_size && alloc_pool_size_class(new_size) == old_size)
+        return ptr;
+
+    // Like realloc(ptr, 0), we free the block and return NULL.
+    void* new_ptr = NULL;
+    if (new_size) {
+        new_ptr = raw_malloc(new_size);
+        if (!new_ptr) return NULL;
+        memcpy(new_ptr, ptr, new_size < old_size ? new_size : old_size);
+    }
+
+    alloc_pool_free(ptr);
+    return new_ptr;
 }
 
-static void alloc_limit_will_free(void* p)
+// With headers, the statistics count the sizes requested rather than
+// the sizes of the blocks, so alloc_pool_reset() can't ask the pool how
+// much it's discarding. Instead we keep count here.
+static _Atomic size_t pooled_header_bytes = 0;
+
+static inline void
+count_pooled(void const* block, size_t size, bool allocated)
+{
+    if (!alloc_pool_block_size(block)) return;
+
+    if (allocated)
+        atomic_fetch_add_explicit(&pooled_header_bytes, size,
+                                  memory_order_relaxed);
+    else
+        atomic_fetch_sub_explicit(&pooled_header_bytes, size,
+                                  memory_order_relaxed);
+}
+
+static inline void*
+backend_malloc(size_t size)
+{
+    if (!alloc_header_enabled) return raw_malloc(size);
+
+    size_t n = alloc_header_block_size(size, 0);
+    void* block = n ? raw_malloc(n) : NULL;
+    if (!block) return NULL;
+
+    count_pooled(block, size, true);
+    return alloc_header_wrap(block, size, 0, limit_epoch);
+}
+
+static inline void*
+backend_calloc(size_t nmemb, size_t size)
 {
-    if (alloc_limit_state == LIMIT_PEAK)
-        forget_allocation(p);
+    if (!alloc_header_enabled) return raw_calloc(nmemb, size);
+
+    if (nmemb && size > SIZE_MAX / nmemb) return NULL;
+
+    void* result = backend_malloc(nmemb * size);
+    return result ? memset(result, 0, nmemb * size) : NULL;
 }
 
+static inline void
+backend_free(void* ptr)
+{
+    if (alloc_header_enabled) {
+        alloc_header_check(ptr, "free", true);
+        size_t size = alloc_header_of(ptr)->size;
+        ptr = alloc_header_block(ptr);
+        count_pooled(ptr, size, false);
+    }
+
+    raw_free(ptr);
+}
+
+static inline void*
+backend_realloc(void* ptr, size_t new_size)
+{
+    if (!alloc_header_enabled) return raw_realloc(ptr, new_size);
+
+    alloc_header_check(ptr, "realloc", false);
+
+    if (!new_size) {
+        backend_free(ptr);
+        return NULL;
+    }
+
+    // Aligned blocks keep their (larger) header space.
+    size_t old_size = alloc_header_of(ptr)->size;
+    size_t space = 16 * (size_t)alloc_header_of(ptr)->offset;
+    void* old_block = alloc_header_block(ptr);
+
+    size_t n = alloc_header_block_size(new_size, space);
+    void* block = n ? raw_realloc(old_block, n) : NULL;
+    if (!block) return NULL;
+
+    count_pooled(old_block, old_size, false);
+    count_pooled(block, new_size, true);
+    return alloc_header_wrap(block, new_size, space, limit_epoch);
+}
+
+#ifdef LIBIPD_HAS_POSIX
+static inline void*
+backend_aligned_alloc(size_t alignment, size_t size)
+{
+    if (!alloc_header_enabled) return aligned_alloc(alignment, size);
+
+    size_t n = alloc_header_block_size(size, alignment);
+    void* block = n ? aligned_alloc(alignment > 16 ? alignment : 16, n)
+                    : NULL;
+    return block
+        ? alloc_header_wrap(block, size, alignment, limit_epoch)
+        : NULL;
+}
+#endif
+
 
 ///
 /// WRAPPERS FOR MALLOC/FREE API
 ///
 
 static inline void*
-quiet_calloc(size_t nmemb, size_t size)
+quiet_calloc(size_t nmemb, size_t size, void const* site)
 {
-    if (size <= SIZE_MAX / nmemb &&
+    if (alloc_fail_injected()) return NULL;
+
+    if ((nmemb == 0 || size <= SIZE_MAX / nmemb) &&
             alloc_limit_may_alloc(nmemb * size))
-        return alloc_limit_did_alloc(calloc(nmemb, size), nmemb * size);
+        return alloc_limit_did_alloc(backend_calloc(nmemb, size),
+                                     nmemb * size,
+                                     site);
     else
         return NULL;
 }
 
 static inline void*
-quiet_malloc(size_t size)
+quiet_malloc(size_t size, void const* site)
 {
+    if (alloc_fail_injected()) return NULL;
+
     if (alloc_limit_may_alloc(size))
-        return alloc_limit_did_alloc(malloc(size), size);
+        return alloc_limit_did_alloc(backend_malloc(size), size, site);
     else
         return NULL;
 }
@@ -305,146 +889,641 @@ quiet_free(void *ptr)
 {
     if (ptr) {
         alloc_limit_will_free(ptr);
-        free(ptr);
+        backend_free(ptr);
     }
 }
 
 static inline void*
 realloc_with_total_limit(void *ptr, size_t new_size)
 {
-    if (alloc_limit_may_alloc(new_size))
-        return alloc_limit_did_alloc(realloc(ptr, new_size), new_size);
-    else
+    if (alloc_limit_may_alloc(new_size)) {
+        void* new_ptr = backend_realloc(ptr, new_size);
+        if (!new_ptr) alloc_limit_refund(new_size);
+        return new_ptr;
+    } else {
         return NULL;
+    }
 }
 
+// Reallocates a block whose old size matters, for peak limits or
+// profiling (or both). The size comes from the block's header, if it
+// has one, or else from the table.
 static inline void*
-realloc_with_peak_limit(void *ptr, size_t new_size)
+realloc_tracked(void *ptr, size_t new_size, void const* site)
 {
-    alloc_list_t node = find_alloc_record(ptr);
-    size_t old_size   = node ? node->size : 0;
+    // No other thread may legitimately touch `ptr` while we resize it,
+    // so it's safe to take its entry out of the table in the meantime.
+    struct alloc_entry old = {ptr, 0, NULL, 0};
+    bool found = tracking_is_enabled() && forget_allocation(ptr, &old);
+
+    size_t old_charged = alloc_header_enabled
+        ? header_charged_size(ptr)
+        : charged_size(&old);
+    size_t needed;
+
+    switch (alloc_limit_state) {
+    case LIMIT_PEAK:
+        needed = new_size > old_charged ? new_size - old_charged : 0;
+        break;
+    case LIMIT_TOTAL:
+        needed = new_size;
+        break;
+    default:
+        needed = 0;
+        break;
+    }
 
-    size_t needed = new_size > old_size ? new_size - old_size : 0;
-    if (!alloc_limit_may_alloc(needed))
+    void* new_ptr = NULL;
+
+    if (alloc_limit_may_alloc(needed)) {
+        new_ptr = backend_realloc(ptr, new_size);
+        if (!new_ptr) alloc_limit_refund(needed);
+    }
+
+    // realloc(ptr, 0) may free the block and return NULL, in which case
+    // there is nothing to put back.
+    if (!new_ptr && new_size == 0) {
+        alloc_limit_refund(old_charged);
+        if (profiling && found) alloc_profile_free(old.site, old.size);
         return NULL;
+    }
 
-    ptr = realloc(ptr, new_size);
-    if (!ptr)
+    // On failure the old block is still live, so put it back:
+    if (!new_ptr) {
+        if (found) remember_entry(old);
         return NULL;
+    }
 
-    // Unsigned arithmetic, so this works even when new_size < old_size:
-    size_t change_in_size = new_size - old_size;
+    // The block may have moved, so it's re-keyed rather than updated.
+    if (old_charged > new_size)
+        alloc_limit_refund(old_charged - new_size);
+    if (tracking_is_enabled())
+        remember_allocation(new_ptr, new_size, site);
 
-    bytes_remaining -= change_in_size;
-    if (node) {
-        node->size  += change_in_size;
-    } else {
-        remember_allocation(ptr, new_size);
+    if (profiling) {
+        if (found) alloc_profile_free(old.site, old.size);
+        alloc_profile_alloc(site, new_size);
     }
 
-    return ptr;
+    return new_ptr;
 }
 
 static inline void*
-quiet_realloc(void *ptr, size_t new_size)
+quiet_realloc(void *ptr, size_t new_size, void const* site)
 {
-    if (!ptr) return quiet_malloc(new_size);
+    if (!ptr) return quiet_malloc(new_size, site);
+
+    // Shrinking to nothing frees rather than allocates.
+    if (new_size && alloc_fail_injected()) return NULL;
+
+    if (tracking_is_enabled() || alloc_limit_state == LIMIT_PEAK)
+        return realloc_tracked(ptr, new_size, site);
 
     switch (alloc_limit_state) {
     case NO_LIMIT:
-        return realloc(ptr, new_size);
+        return backend_realloc(ptr, new_size);
 
     case LIMIT_TOTAL:
         return realloc_with_total_limit(ptr, new_size);
 
-    case LIMIT_PEAK:
-        return realloc_with_peak_limit(ptr, new_size);
-
     default:
         return NULL;
     }
 }
 
 static inline void*
-quiet_reallocf(void *ptr, size_t new_size)
+quiet_reallocf(void *ptr, size_t new_size, void const* site)
 {
-    void* result = quiet_realloc(ptr, new_size);
-    if (!result) quiet_free(ptr);
+    void* result = quiet_realloc(ptr, new_size, site);
+    if (!result && new_size) quiet_free(ptr);
     return result;
 }
 
 
+///
+/// INSTRUMENTED CALLS
+///
+
+// Counts a call in the statistics, and then in the timeline (which
+// samples the statistics' live byte count).
+static inline void
+record_call(enum alloc_stats_call call, size_t requested,
+            void const* result, size_t released)
+{
+    if (!counting) return;
+    alloc_stats_record(call, requested, result, released);
+    if (timeline) alloc_timeline_tick(result != NULL, requested);
+}
+
+static void* instrumented_calloc(size_t nmemb, size_t size, void const* site)
+{
+    alloc_tracef("calloc(%zu, %zu)", nmemb, size);
+
+    void* result = quiet_calloc(nmemb, size, site);
+    alloc_trace_event(RTIPD_TRACE_CALLOC, 0, result, nmemb * size);
+    record_call(ALLOC_STATS_CALLOC, nmemb * size, result, 0);
+    return result;
+}
+
+static void* instrumented_malloc(size_t size, void const* site)
+{
+    alloc_tracef("malloc(%zu)", size);
+
+    void* result = quiet_malloc(size, site);
+    alloc_trace_event(RTIPD_TRACE_MALLOC, 0, result, size);
+    record_call(ALLOC_STATS_MALLOC, size, result, 0);
+    return result;
+}
+
+static void instrumented_free(void *ptr)
+{
+    alloc_tracef("free(%p)", ptr);
+
+    uintptr_t old_ptr = (uintptr_t)ptr;
+    size_t released = counting ? alloc_stats_block_size(ptr) : 0;
+    quiet_free(ptr);
+    alloc_trace_event(RTIPD_TRACE_FREE, old_ptr, NULL, 0);
+    record_call(ALLOC_STATS_FREE, 0, NULL, released);
+}
+
+// How much of `ptr` (of usable size `old_size`) a call to realloc or
+// reallocf that returned `result` gave back. On failure realloc leaves
+// the old block alone, except that realloc(ptr, 0) may free it.
+static size_t
+realloc_released(size_t old_size, void* result, size_t size, bool reallocf)
+{
+    return result || size == 0 || reallocf ? old_size : 0;
+}
+
+static void* instrumented_realloc(void *ptr, size_t size, void const* site)
+{
+    alloc_tracef("realloc(%p, %zu)", ptr, size);
+
+    uintptr_t old_ptr = (uintptr_t)ptr;
+    size_t old_size = counting ? alloc_stats_block_size(ptr) : 0;
+    void* result = quiet_realloc(ptr, size, site);
+    alloc_trace_event(RTIPD_TRACE_REALLOC, old_ptr, result, size);
+    record_call(ALLOC_STATS_REALLOC, size, result,
+                realloc_released(old_size, result, size, false));
+    return result;
+}
+
+static void* instrumented_reallocf(void *ptr, size_t size, void const* site)
+{
+    alloc_tracef("reallocf(%p, %zu)", ptr, size);
+
+    uintptr_t old_ptr = (uintptr_t)ptr;
+    size_t old_size = counting ? alloc_stats_block_size(ptr) : 0;
+    void* result = quiet_reallocf(ptr, size, site);
+    alloc_trace_event(RTIPD_TRACE_REALLOCF, old_ptr, result, size);
+    record_call(ALLOC_STATS_REALLOC, size, result,
+                realloc_released(old_size, result, size, true));
+    return result;
+}
+
+#ifdef LIBIPD_HAS_POSIX
+// Only the replacement allocators need this, so it's traced and
+// counted as a malloc.
+static void* instrumented_aligned_alloc(size_t alignment, size_t size,
+                                        void const* site)
+{
+    alloc_tracef("aligned_alloc(%zu, %zu)", alignment, size);
+
+    void* result = !alloc_fail_injected() && alloc_limit_may_alloc(size)
+        ? alloc_limit_did_alloc(backend_aligned_alloc(alignment, size),
+                                size, site)
+        : NULL;
+    alloc_trace_event(RTIPD_TRACE_MALLOC, 0, result, size);
+    record_call(ALLOC_STATS_MALLOC, size, result, 0);
+    return result;
+}
+#endif
+
+
+///
+/// COUNTED CALLS
+///
+
+// When there's no limit, no failure injection, no pooling, no headers,
+// and no tracing, profiling, or timeline, the only thing left to do is
+// keep the statistics, so these go straight to the C library and then
+// count the call.
+
+static inline void count_attempt(void)
+{
+    atomic_fetch_add_explicit(&fail_attempts, 1, memory_order_relaxed);
+}
+
+static void* counted_calloc(size_t nmemb, size_t size, void const* site)
+{
+    (void) site;
+
+    count_attempt();
+    void* result = calloc(nmemb, size);
+    alloc_stats_record(ALLOC_STATS_CALLOC, nmemb * size, result, 0);
+    return result;
+}
+
+static void* counted_malloc(size_t size, void const* site)
+{
+    (void) site;
+
+    count_attempt();
+    void* result = malloc(size);
+    alloc_stats_record(ALLOC_STATS_MALLOC, size, result, 0);
+    return result;
+}
+
+static void counted_free(void *ptr)
+{
+    size_t released = alloc_stats_block_size(ptr);
+    free(ptr);
+    alloc_stats_record(ALLOC_STATS_FREE, 0, NULL, released);
+}
+
+static void* counted_realloc(void *ptr, size_t size, void const* site)
+{
+    (void) site;
+
+    // As in quiet_realloc, shrinking to nothing isn't an attempt.
+    if (!ptr || size) count_attempt();
+
+    size_t old_size = alloc_stats_block_size(ptr);
+    void* result = realloc(ptr, size);
+    alloc_stats_record(ALLOC_STATS_REALLOC, size, result,
+                       realloc_released(old_size, result, size, false));
+    return result;
+}
+
+static void* counted_reallocf(void *ptr, size_t size, void const* site)
+{
+    (void) site;
+
+    if (!ptr || size) count_attempt();
+
+    size_t old_size = alloc_stats_block_size(ptr);
+    void* result = realloc(ptr, size);
+    if (!result && size) free(ptr);
+    alloc_stats_record(ALLOC_STATS_REALLOC, size, result,
+                       realloc_released(old_size, result, size, true));
+    return result;
+}
+
+#ifdef LIBIPD_HAS_POSIX
+static void* counted_aligned_alloc(size_t alignment, size_t size,
+                                   void const* site)
+{
+    (void) site;
+
+    count_attempt();
+    void* result = aligned_alloc(alignment, size);
+    alloc_stats_record(ALLOC_STATS_MALLOC, size, result, 0);
+    return result;
+}
+#endif
+
+
+///
+/// PLAIN CALLS
+///
+
+// With statistics off too (RTIPD_ALLOC_STATS=0), there's nothing to do
+// but count the attempt and call the C library.
+
+static void* plain_calloc(size_t nmemb, size_t size, void const* site)
+{
+    (void) site;
+
+    count_attempt();
+    return calloc(nmemb, size);
+}
+
+static void* plain_malloc(size_t size, void const* site)
+{
+    (void) site;
+
+    count_attempt();
+    return malloc(size);
+}
+
+static void plain_free(void *ptr)
+{
+    free(ptr);
+}
+
+static void* plain_realloc(void *ptr, size_t size, void const* site)
+{
+    (void) site;
+
+    if (!ptr || size) count_attempt();
+    return realloc(ptr, size);
+}
+
+static void* plain_reallocf(void *ptr, size_t size, void const* site)
+{
+    (void) site;
+
+    if (!ptr || size) count_attempt();
+    void* result = realloc(ptr, size);
+    if (!result && size) free(ptr);
+    return result;
+}
+
+#ifdef LIBIPD_HAS_POSIX
+static void* plain_aligned_alloc(size_t alignment, size_t size,
+                                 void const* site)
+{
+    (void) site;
+
+    count_attempt();
+    return aligned_alloc(alignment, size);
+}
+#endif
+
+
+///
+/// DISPATCH
+///
+
+// The public functions make one indirect call through `dispatch`, which
+// points to whichever of the tables below does no more than the current
+// settings require. It starts out pointing to a table that initializes
+// the runtime and then calls through the table that chose.
+
+struct alloc_functions
+{
+    void* (*calloc)(size_t, size_t, void const*);
+    void* (*malloc)(size_t, void const*);
+    void  (*free)(void*);
+    void* (*realloc)(void*, size_t, void const*);
+    void* (*reallocf)(void*, size_t, void const*);
+#ifdef LIBIPD_HAS_POSIX
+    void* (*aligned_alloc)(size_t, size_t, void const*);
+#endif
+};
+
+#ifdef LIBIPD_HAS_POSIX
+#   define ALLOC_FUNCTIONS(PREFIX) \
+    { PREFIX##_calloc, PREFIX##_malloc, PREFIX##_free, \
+      PREFIX##_realloc, PREFIX##_reallocf, PREFIX##_aligned_alloc }
+#else
+#   define ALLOC_FUNCTIONS(PREFIX) \
+    { PREFIX##_calloc, PREFIX##_malloc, PREFIX##_free, \
+      PREFIX##_realloc, PREFIX##_reallocf }
+#endif
+
+static struct alloc_functions const
+        instrumented_functions = ALLOC_FUNCTIONS(instrumented),
+        counted_functions      = ALLOC_FUNCTIONS(counted),
+        plain_functions        = ALLOC_FUNCTIONS(plain);
+
+static void* init_calloc(size_t, size_t, void const*);
+static void* init_malloc(size_t, void const*);
+static void  init_free(void*);
+static void* init_realloc(void*, size_t, void const*);
+static void* init_reallocf(void*, size_t, void const*);
+#ifdef LIBIPD_HAS_POSIX
+static void* init_aligned_alloc(size_t, size_t, void const*);
+#endif
+
+static struct alloc_functions const
+        init_functions = ALLOC_FUNCTIONS(init);
+
+static struct alloc_functions const* _Atomic dispatch = &init_functions;
+
+#define DISPATCH(FUNCTION) \
+    (atomic_load_explicit(&dispatch, memory_order_relaxed)->FUNCTION)
+
+// Called whenever a setting that affects the choice changes. Headers
+// and live pool blocks are forever, so they keep us instrumented.
+static void select_dispatch(void)
+{
+    bool instrumented =
+        alloc_limit_state != NO_LIMIT ||
+        fail_mode != FAIL_NEVER ||
+        pooled_ever ||
+        alloc_header_enabled ||
+        profiling ||
+        timeline ||
+        alloc_trace_is_enabled();
+
+    dispatch = instrumented ? &instrumented_functions
+             : counting     ? &counted_functions
+             :                &plain_functions;
+}
+
+static void* init_calloc(size_t nmemb, size_t size, void const* site)
+{
+    pthread_once(&alloc_rt_once, &alloc_rt_init);
+    return DISPATCH(calloc)(nmemb, size, site);
+}
+
+static void* init_malloc(size_t size, void const* site)
+{
+    pthread_once(&alloc_rt_once, &alloc_rt_init);
+    return DISPATCH(malloc)(size, site);
+}
+
+static void init_free(void* ptr)
+{
+    pthread_once(&alloc_rt_once, &alloc_rt_init);
+    DISPATCH(free)(ptr);
+}
+
+static void* init_realloc(void* ptr, size_t size, void const* site)
+{
+    pthread_once(&alloc_rt_once, &alloc_rt_init);
+    return DISPATCH(realloc)(ptr, size, site);
+}
+
+static void* init_reallocf(void* ptr, size_t size, void const* site)
+{
+    pthread_once(&alloc_rt_once, &alloc_rt_init);
+    return DISPATCH(reallocf)(ptr, size, site);
+}
+
+#ifdef LIBIPD_HAS_POSIX
+static void* init_aligned_alloc(size_t alignment, size_t size,
+                                void const* site)
+{
+    pthread_once(&alloc_rt_once, &alloc_rt_init);
+    return DISPATCH(aligned_alloc)(alignment, size, site);
+}
+#endif
+
+
 /////
 ///// PUBLIC API FUNCTIONS
 /////
 
 
 ///
-/// TRACING WRAPPERS
+/// MALLOC/FREE API
 ///
 
+void* rtipd_calloc_at(size_t nmemb, size_t size, void const* site)
+{
+    return DISPATCH(calloc)(nmemb, size, site);
+}
+
 void* rtipd_calloc(size_t nmemb, size_t size)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("calloc(%zu, %zu)", nmemb, size);
+    return DISPATCH(calloc)(nmemb, size, CALLER());
+}
 
-    return quiet_calloc(nmemb, size);
+void* rtipd_malloc_at(size_t size, void const* site)
+{
+    return DISPATCH(malloc)(size, site);
 }
 
 void* rtipd_malloc(size_t size)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("malloc(%zu)", size);
-
-    return quiet_malloc(size);
+    return DISPATCH(malloc)(size, CALLER());
 }
 
 void rtipd_free(void *ptr)
+{
+    DISPATCH(free)(ptr);
+}
+
+void rtipd_alloc_init(void)
 {
     ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("free(%p)", ptr);
+}
 
-    quiet_free(ptr);
+size_t rtipd_usable_size(void const* ptr)
+{
+    return alloc_stats_block_size(ptr);
 }
 
-void* rtipd_realloc(void *ptr, size_t size)
+void* rtipd_realloc_at(void *ptr, size_t size, void const* site)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("realloc(%p, %zu)", ptr, size);
+    return DISPATCH(realloc)(ptr, size, site);
+}
 
-    return quiet_realloc(ptr, size);
+void* rtipd_realloc(void *ptr, size_t size)
+{
+    return DISPATCH(realloc)(ptr, size, CALLER());
 }
 
 void* rtipd_reallocf(void *ptr, size_t size)
 {
-    ENSURE_ALLOC_DEBUG_INIT();
-    alloc_tracef("reallocf(%p, %zu)", ptr, size);
-
-    return quiet_reallocf(ptr, size);
+    return DISPATCH(reallocf)(ptr, size, CALLER());
 }
 
+#ifdef LIBIPD_HAS_POSIX
+void* rtipd_aligned_alloc_at(size_t alignment, size_t size,
+                             void const* site)
+{
+    return DISPATCH(aligned_alloc)(alignment, size, site);
+}
+#endif
 
 ///
 /// SIMULATING ALLOCATION FAILURE
 ///
 
+// When profiling, the table must keep describing every live block, so
+// instead of clearing it we start a new epoch, which stops earlier
+// blocks from being refunded against the new limit.
+static void set_limit(enum alloc_limit_mode mode, size_t n)
+{
+    bytes_remaining = n;
+    ++limit_epoch;
+    alloc_limit_state = mode;
+
+    if (!profiling) forget_everything();
+}
+
 void alloc_limit_set_no_limit(void)
 {
-    alloc_limit_state = NO_LIMIT;
-    forget_everything();
-    bytes_remaining = 0;
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_limit(NO_LIMIT, 0);
+    select_dispatch();
 }
 
 void alloc_limit_set_total(size_t n)
 {
-    alloc_limit_state = LIMIT_TOTAL;
-    forget_everything();
-    bytes_remaining = n;
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_limit(LIMIT_TOTAL, n);
+    select_dispatch();
 }
 
 void alloc_limit_set_peak(size_t n)
 {
-    alloc_limit_state = LIMIT_PEAK;
-    forget_everything();
-    bytes_remaining = n;
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_limit(LIMIT_PEAK, n);
+    select_dispatch();
+}
+
+void alloc_fail_at(size_t n)
+{
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_fail_at(n);
+    select_dispatch();
+}
+
+void alloc_fail_randomly(double p, unsigned long seed)
+{
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_fail_randomly(p, seed);
+    select_dispatch();
+}
+
+size_t alloc_fail_count(void)
+{
+    return fail_attempts;
+}
+
+///
+/// POOLING
+///
+
+void alloc_pool_enable(void)
+{
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_pooling(true);
+    select_dispatch();
+}
+
+void alloc_pool_disable(void)
+{
+    ENSURE_ALLOC_DEBUG_INIT();
+    set_pooling(false);
+    select_dispatch();
+}
+
+// Drops a pool block from the table, refunding it as if freed.
+static bool forget_pool_entry(struct alloc_entry const* entry, void* ctx)
+{
+    (void) ctx;
+
+    if (!alloc_pool_block_size(entry->pointer)) return false;
+
+    alloc_limit_refund(charged_size(entry));
+    if (profiling) alloc_profile_free(entry->site, entry->size);
+    return true;
+}
+
+void alloc_pool_reset(void)
+{
+    ENSURE_ALLOC_DEBUG_INIT();
+    alloc_tracef("alloc_pool_reset()");
+
+    if (tracking_is_enabled()) {
+        pthread_once(&shards_once, &init_shards);
+
+        for (size_t i = 0; i < TABLE_SHARDS; ++i) {
+            struct table_shard* shard = &allocation_shards[i];
+            pthread_mutex_lock(&shard->lock);
+            alloc_table_remove_if(&shard->table, &forget_pool_entry, NULL);
+            pthread_mutex_unlock(&shard->lock);
+        }
+    }
+
+    alloc_stats_forget(alloc_header_enabled
+                       ? pooled_header_bytes
+                       : alloc_pool_live_bytes());
+    pooled_header_bytes = 0;
+    alloc_pool_release_all();
 }
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Entry points into the allocation runtime for alloc_preload.c, which
+// replaces the C library's allocator, and for alloc_new.cxx, which
+// replaces C++'s. Each takes the call site to which the allocation
+// should be attributed.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void* rtipd_malloc_at(size_t size, void const* site);
+void* rtipd_calloc_at(size_t nmemb, size_t size, void const* site);
+void* rtipd_realloc_at(void* ptr, size_t size, void const* site);
+void* rtipd_aligned_alloc_at(size_t alignment, size_t size,
+                             void const* site);
+void  rtipd_free(void* ptr);
+
+// Sets up the runtime now, if it isn't already. It otherwise waits for
+// the first allocation, which in a test runner may come only in a forked
+// child, leaving each child to set it up (and report at exit) anew.
+void rtipd_alloc_init(void);
+
+// How many bytes the block at `ptr` holds, as malloc_usable_size(3)
+// would say. With headers that's just the size requested, and a pooled
+// block is the size of its pool's blocks.
+size_t rtipd_usable_size(void const* ptr);
+
+#ifdef __cplusplus
+}
+#else
+
+// True while the runtime itself is running on this thread. The
+// replacement allocator passes any calls made meanwhile straight to the
+// C library, since neither the runtime's own allocations nor those of
+// the stdio and pthread functions it calls should be counted (or
+// re-enter the runtime).
+extern _Thread_local bool rtipd_in_runtime;
+#endif
@@ -0,0 +1,234 @@
+#define _XOPEN_SOURCE 700
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "ipd_alloc_stats.h"
+#include "alloc_stats.h"
+#include "alloc_header.h"
+#include "alloc_pool.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include <pthread.h>
+
+#if defined(__GLIBC__)
+#   include <malloc.h>
+#   define USABLE_SIZE(P)  malloc_usable_size((void*)(P))
+#elif defined(__APPLE__)
+#   include <malloc/malloc.h>
+#   define USABLE_SIZE(P)  malloc_size(P)
+#else
+#   define USABLE_SIZE(P)  ((void)(P), (size_t)0)
+#endif
+
+// One thread's counters. Only the owning thread writes them, but other
+// threads read them when summing, hence the (relaxed) atomics.
+struct thread_stats
+{
+    _Atomic size_t       calls[ALLOC_STATS_CALLS];
+    _Atomic size_t       total_bytes;
+    _Atomic size_t       size_classes[ALLOC_STATS_SIZE_CLASSES];
+    bool                 registered;
+    struct thread_stats* next;
+};
+
+static _Thread_local struct thread_stats my_stats;
+
+// The counters of every live thread, plus the sum of the counters of
+// the threads that have exited, plus what to subtract to account for
+// `alloc_stats_reset()`.
+static pthread_mutex_t      stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_stats* all_stats  = NULL;
+static struct alloc_stats   retired;
+static struct alloc_stats   baseline;
+
+// Has a destructor to retire a thread's counters when it exits.
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t  stats_key;
+
+static _Atomic size_t live_bytes = 0;
+static _Atomic size_t peak_bytes = 0;
+
+static inline void bump(_Atomic size_t* counter, size_t n)
+{
+    atomic_store_explicit(
+            counter,
+            atomic_load_explicit(counter, memory_order_relaxed) + n,
+            memory_order_relaxed);
+}
+
+static inline size_t load(_Atomic size_t const* counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+// Adds thread counters `ts` to `acc`.
+static void accumulate(struct alloc_stats* acc, struct thread_stats* ts)
+{
+    acc->malloc_calls  += load(&ts->calls[ALLOC_STATS_MALLOC]);
+    acc->calloc_calls  += load(&ts->calls[ALLOC_STATS_CALLOC]);
+    acc->realloc_calls += load(&ts->calls[ALLOC_STATS_REALLOC]);
+    acc->free_calls    += load(&ts->calls[ALLOC_STATS_FREE]);
+    acc->total_bytes   += load(&ts->total_bytes);
+
+    for (size_t k = 0; k < ALLOC_STATS_SIZE_CLASSES; ++k)
+        acc->size_classes[k] += load(&ts->size_classes[k]);
+}
+
+static void retire_thread_stats(void* arg)
+{
+    struct thread_stats* ts = arg;
+
+    pthread_mutex_lock(&stats_lock);
+
+    accumulate(&retired, ts);
+
+    for (struct thread_stats** cur = &all_stats; *cur; cur = &(*cur)->next) {
+        if (*cur == ts) {
+            *cur = ts->next;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static void create_stats_key(void)
+{
+    pthread_key_create(&stats_key, &retire_thread_stats);
+}
+
+static void register_thread_stats(void)
+{
+    pthread_once(&stats_once, &create_stats_key);
+
+    pthread_mutex_lock(&stats_lock);
+    my_stats.next = all_stats;
+    all_stats = &my_stats;
+    pthread_mutex_unlock(&stats_lock);
+
+    pthread_setspecific(stats_key, &my_stats);
+    my_stats.registered = true;
+}
+
+static inline size_t size_class_of(size_t n)
+{
+    size_t k;
+
+#ifdef __GNUC__
+    k = n ? 8 * sizeof(unsigned long long) - __builtin_clzll(n) : 0;
+#else
+    for (k = 0; n; n >>= 1) ++k;
+#endif
+
+    return k < ALLOC_STATS_SIZE_CLASSES ? k : ALLOC_STATS_SIZE_CLASSES - 1;
+}
+
+static void update_live_bytes(size_t acquired, size_t released)
+{
+    if (acquired == released) return;
+
+    // Freeing a block we never counted, such as one from strdup(3) or
+    // from before we started, would take the count below zero, so we
+    // stop at zero instead.
+    if (acquired < released) {
+        size_t drop = released - acquired;
+        size_t live = atomic_load_explicit(&live_bytes, memory_order_relaxed);
+        while (!atomic_compare_exchange_weak_explicit(
+                    &live_bytes, &live, live > drop ? live - drop : 0,
+                    memory_order_relaxed, memory_order_relaxed))
+        { }
+        return;
+    }
+
+    size_t now = acquired - released +
+        atomic_fetch_add_explicit(&live_bytes, acquired - released,
+                                  memory_order_relaxed);
+
+    size_t peak = atomic_load_explicit(&peak_bytes, memory_order_relaxed);
+    while (now > peak && !atomic_compare_exchange_weak_explicit(
+                &peak_bytes, &peak, now,
+                memory_order_relaxed, memory_order_relaxed))
+    { }
+}
+
+size_t alloc_stats_block_size(void const* p)
+{
+    if (!p) return 0;
+
+    // A block with a header has exactly the size requested, since any
+    // more may belong to its canary.
+    if (alloc_header_enabled) return alloc_header_of(p)->size;
+
+    size_t pooled = alloc_pool_block_size(p);
+    return pooled ? pooled : USABLE_SIZE(p);
+}
+
+void alloc_stats_record(enum alloc_stats_call call,
+                        size_t requested,
+                        void const* result,
+                        size_t released)
+{
+    if (!my_stats.registered) register_thread_stats();
+
+    bump(&my_stats.calls[call], 1);
+
+    if (result) {
+        bump(&my_stats.total_bytes, requested);
+        bump(&my_stats.size_classes[size_class_of(requested)], 1);
+    }
+
+    update_live_bytes(alloc_stats_block_size(result), released);
+}
+
+void alloc_stats_forget(size_t released)
+{
+    update_live_bytes(0, released);
+}
+
+size_t alloc_stats_live_bytes(void)
+{
+    return atomic_load_explicit(&live_bytes, memory_order_relaxed);
+}
+
+// Requires `stats_lock`.
+static void sum_counters(struct alloc_stats* out)
+{
+    *out = retired;
+    for (struct thread_stats* ts = all_stats; ts; ts = ts->next)
+        accumulate(out, ts);
+}
+
+void alloc_stats_get(struct alloc_stats* out)
+{
+    struct alloc_stats raw;
+
+    pthread_mutex_lock(&stats_lock);
+    sum_counters(&raw);
+
+    out->malloc_calls  = raw.malloc_calls  - baseline.malloc_calls;
+    out->calloc_calls  = raw.calloc_calls  - baseline.calloc_calls;
+    out->realloc_calls = raw.realloc_calls - baseline.realloc_calls;
+    out->free_calls    = raw.free_calls    - baseline.free_calls;
+    out->total_bytes   = raw.total_bytes   - baseline.total_bytes;
+
+    for (size_t k = 0; k < ALLOC_STATS_SIZE_CLASSES; ++k)
+        out->size_classes[k] = raw.size_classes[k] - baseline.size_classes[k];
+
+    pthread_mutex_unlock(&stats_lock);
+
+    out->live_bytes = atomic_load(&live_bytes);
+    out->peak_bytes = atomic_load(&peak_bytes);
+    if (out->peak_bytes < out->live_bytes)
+        out->peak_bytes = out->live_bytes;
+}
+
+void alloc_stats_reset(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    sum_counters(&baseline);
+    pthread_mutex_unlock(&stats_lock);
+
+    atomic_store(&peak_bytes, atomic_load(&live_bytes));
+}
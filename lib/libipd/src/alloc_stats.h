@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+// Maintains the statistics behind <ipd_alloc_stats.h>, for alloc_rt.c.
+// Call counts and the size histogram are kept per thread and summed
+// when queried, so only the live byte count is shared between threads.
+
+enum alloc_stats_call
+{
+    ALLOC_STATS_MALLOC,
+    ALLOC_STATS_CALLOC,
+    ALLOC_STATS_REALLOC,
+    ALLOC_STATS_FREE,
+    ALLOC_STATS_CALLS
+};
+
+// Returns the allocator's usable size for block `p`, or 0 if `p` is
+// NULL or the platform can't tell us.
+size_t alloc_stats_block_size(void const* p);
+
+// Records one call. `requested` is the size asked for, `result` is the
+// block returned (if any), and `released` is the usable size of the
+// block given back (if any).
+void alloc_stats_record(enum alloc_stats_call call,
+                        size_t requested,
+                        void const* result,
+                        size_t released);
+
+// The bytes currently allocated, as alloc_stats_get() would report.
+size_t alloc_stats_live_bytes(void);
+
+// Records that `released` bytes of live blocks went away without a
+// call to free, as when alloc_pool_reset() discards the pool.
+void alloc_stats_forget(size_t released);
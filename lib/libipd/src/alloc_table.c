@@ -0,0 +1,140 @@
+#define LIBIPD_RAW_ALLOC
+
+#include "alloc_table.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Smallest slab we bother allocating.
+#define MIN_CAP   1024
+
+// Fibonacci hashing: multiply by 2^64 / φ and keep the top bits. This
+// mixes the (always zero) low bits of allocator pointers into the
+// bucket index for free.
+static inline size_t
+bucket_of(struct alloc_table const* t, void const* p)
+{
+    uint64_t h = (uint64_t)(uintptr_t)p * UINT64_C(0x9E3779B97F4A7C15);
+    return (size_t)(h >> t->shift);
+}
+
+static inline size_t
+next_slot(struct alloc_table const* t, size_t i)
+{
+    return (i + 1) & (t->cap - 1);
+}
+
+// Finds the slot holding `p`, or the empty slot where it would go.
+static size_t
+probe(struct alloc_table const* t, void const* p)
+{
+    size_t i = bucket_of(t, p);
+
+    while (t->slots[i].pointer && t->slots[i].pointer != p)
+        i = next_slot(t, i);
+
+    return i;
+}
+
+static bool
+grow(struct alloc_table* t)
+{
+    size_t new_cap = t->cap ? 2 * t->cap : MIN_CAP;
+    if (new_cap > SIZE_MAX / sizeof *t->slots) return false;
+
+    struct alloc_entry* new_slots = calloc(new_cap, sizeof *new_slots);
+    if (!new_slots) return false;
+
+    unsigned new_shift = 64;
+    for (size_t c = new_cap; c > 1; c >>= 1) --new_shift;
+
+    struct alloc_table bigger = {new_slots, new_cap, t->count, new_shift};
+
+    for (size_t i = 0; i < t->cap; ++i) {
+        if (t->slots[i].pointer) {
+            bigger.slots[probe(&bigger, t->slots[i].pointer)] = t->slots[i];
+        }
+    }
+
+    free(t->slots);
+    *t = bigger;
+    return true;
+}
+
+bool alloc_table_insert(struct alloc_table* t, struct alloc_entry entry)
+{
+    // Keep the load factor at or below 3/4:
+    if (4 * (t->count + 1) > 3 * t->cap && !grow(t))
+        return false;
+
+    size_t i = probe(t, entry.pointer);
+    if (!t->slots[i].pointer) ++t->count;
+
+    t->slots[i] = entry;
+    return true;
+}
+
+struct alloc_entry*
+alloc_table_find(struct alloc_table const* t, void const* p)
+{
+    if (!t->count || !p) return NULL;
+
+    size_t i = probe(t, p);
+    return t->slots[i].pointer ? &t->slots[i] : NULL;
+}
+
+bool alloc_table_remove(struct alloc_table* t,
+                        void const* p,
+                        struct alloc_entry* out)
+{
+    if (!t->count || !p) return false;
+
+    size_t hole = probe(t, p);
+    if (!t->slots[hole].pointer) return false;
+
+    if (out) *out = t->slots[hole];
+    --t->count;
+
+    // Backward-shift deletion: pull later members of the probe run
+    // into the hole whenever that doesn't move them before their home
+    // bucket, so that no tombstone is needed.
+    size_t mask = t->cap - 1;
+    for (size_t i = next_slot(t, hole); t->slots[i].pointer;
+            i = next_slot(t, i))
+    {
+        size_t home = bucket_of(t, t->slots[i].pointer);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            t->slots[hole] = t->slots[i];
+            hole = i;
+        }
+    }
+
+    t->slots[hole].pointer = NULL;
+    return true;
+}
+
+void alloc_table_remove_if(struct alloc_table* t,
+                           bool (*pred)(struct alloc_entry const*, void*),
+                           void* ctx)
+{
+    if (!t->count) return;
+
+    // Start just after an empty slot (there is always one). Removal
+    // only ever shifts entries backward within a probe run, and no run
+    // crosses that slot, so revisiting the current slot after each
+    // removal examines every entry exactly once.
+    size_t empty = 0;
+    while (t->slots[empty].pointer) ++empty;
+
+    for (size_t n = 1; n < t->cap; ++n) {
+        size_t i = (empty + n) & (t->cap - 1);
+        while (t->slots[i].pointer && pred(&t->slots[i], ctx))
+            alloc_table_remove(t, t->slots[i].pointer, NULL);
+    }
+}
+
+void alloc_table_clear(struct alloc_table* t)
+{
+    free(t->slots);
+    *t = (struct alloc_table) ALLOC_TABLE_INIT;
+}
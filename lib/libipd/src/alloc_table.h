@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// An open-addressing hash table mapping allocated pointers to their
+// sizes and a bit of other bookkeeping. All entries live in a single
+// contiguous slab that is grown (by doubling) as needed, and removal
+// uses backward-shift deletion, so there are no tombstones and lookups
+// stay short no matter how many insertions and removals have happened.
+
+struct alloc_entry
+{
+    void*       pointer;    // NULL means the slot is empty
+    size_t      size;
+    void const* site;       // where it was allocated, if known
+    unsigned    epoch;      // see `limit_epoch` in alloc_rt.c
+};
+
+struct alloc_table
+{
+    struct alloc_entry* slots;
+    size_t              cap;    // always 0 or a power of 2
+    size_t              count;
+    unsigned            shift;  // 64 - log2(cap), for hashing
+};
+
+#define ALLOC_TABLE_INIT  {NULL, 0, 0, 64}
+
+// Adds `entry`, replacing any previous entry with the same pointer.
+// Returns false if the table needed to grow but couldn't.
+bool alloc_table_insert(struct alloc_table*, struct alloc_entry entry);
+
+// Returns the entry for `p`, or NULL if there isn't one. The result
+// is invalidated by the next insertion or removal.
+struct alloc_entry* alloc_table_find(struct alloc_table const*,
+                                     void const* p);
+
+// Removes the entry for `p`, copying it to `*out` first (if `out` is
+// non-NULL). Returns false if `p` wasn't in the table.
+bool alloc_table_remove(struct alloc_table*,
+                        void const* p,
+                        struct alloc_entry* out);
+
+// Removes every entry for which `pred(entry, ctx)` returns true. The
+// predicate sees each entry exactly once, so it may act on the entries
+// it removes.
+void alloc_table_remove_if(struct alloc_table*,
+                           bool (*pred)(struct alloc_entry const*, void*),
+                           void* ctx);
+
+// Removes every entry and releases the slab.
+void alloc_table_clear(struct alloc_table*);
@@ -0,0 +1,221 @@
+#define _XOPEN_SOURCE 700
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "alloc_timeline.h"
+#include "alloc_timeline_format.h"
+#include "alloc_rt.h"
+#include "alloc_stats.h"
+#include "rt_env.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#define EV_TIMELINE        "RTIPD_ALLOC_TIMELINE"
+#define EV_TIMELINE_EVERY  "RTIPD_ALLOC_TIMELINE_EVERY"
+
+// One millisecond.
+#define DEFAULT_INTERVAL   UINT64_C(1000000)
+
+// When the buffer fills, we merge neighboring snapshots pairwise and
+// double the interval, so a long run costs bounded memory and still
+// covers the whole run, just more coarsely.
+#define MAX_SNAPSHOTS      ((size_t)1 << 14)
+
+static pid_t timeline_pid;
+
+static enum rtipd_timeline_unit timeline_unit = RTIPD_TIMELINE_NANOSECONDS;
+static _Atomic uint64_t         interval;
+
+static uint64_t         start_time;
+static _Atomic uint64_t next_due;           // in nanoseconds
+static _Atomic size_t   bytes_since  = 0;   // since the last snapshot
+static _Atomic size_t   window_peak  = 0;   // likewise
+static _Atomic size_t   allocations  = 0;
+
+// The snapshots so far. Only appended to while holding the lock.
+static pthread_mutex_t               snapshots_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rtipd_timeline_record* snapshots      = NULL;
+static size_t                        snapshots_used = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Parses the interval, which is a time with a unit (s, ms, us, or ns),
+// or else a size in bytes allocated as understood by `rtipd_env_size`.
+static void read_interval(void)
+{
+    char const* original = getenv(EV_TIMELINE_EVERY);
+    interval = DEFAULT_INTERVAL;
+    if (!original) return;
+
+    char* end;
+    double n = strtod(original, &end);
+    while (isspace(*end)) ++end;
+
+    static struct { char const* suffix; double ns; } const units[] = {
+        {"s", 1e9}, {"ms", 1e6}, {"us", 1e3}, {"ns", 1},
+    };
+
+    for (size_t i = 0; i < sizeof units / sizeof *units; ++i) {
+        if (end != original && strcmp(end, units[i].suffix) == 0) {
+            if (!(n * units[i].ns >= 1))
+                rtipd_bad_env_var(EV_TIMELINE_EVERY, original);
+            interval = (uint64_t)(n * units[i].ns);
+            return;
+        }
+    }
+
+    size_t bytes;
+    if (rtipd_env_size(EV_TIMELINE_EVERY, &bytes)) {
+        if (!bytes) rtipd_bad_env_var(EV_TIMELINE_EVERY, original);
+        interval      = bytes;
+        timeline_unit = RTIPD_TIMELINE_BYTES;
+    }
+}
+
+// Halves the number of snapshots by merging each pair into the later of
+// the two, keeping the greater peak, and doubles the interval to match.
+// Requires `snapshots_lock`.
+static void thin_snapshots(void)
+{
+    size_t n = 0;
+
+    for (size_t i = 0; i + 1 < snapshots_used; i += 2) {
+        struct rtipd_timeline_record merged = snapshots[i + 1];
+        if (merged.peak_bytes < snapshots[i].peak_bytes)
+            merged.peak_bytes = snapshots[i].peak_bytes;
+        snapshots[n++] = merged;
+    }
+
+    if (snapshots_used % 2) snapshots[n++] = snapshots[snapshots_used - 1];
+
+    snapshots_used = n;
+    interval *= 2;
+}
+
+static void take_snapshot(uint64_t now, size_t live_bytes)
+{
+    pthread_mutex_lock(&snapshots_lock);
+
+    if (!snapshots) snapshots = malloc(MAX_SNAPSHOTS * sizeof *snapshots);
+
+    if (snapshots) {
+        if (snapshots_used == MAX_SNAPSHOTS) thin_snapshots();
+
+        size_t peak = atomic_exchange_explicit(&window_peak, live_bytes,
+                                               memory_order_relaxed);
+        snapshots[snapshots_used++] = (struct rtipd_timeline_record) {
+            .time        = now - start_time,
+            .live_bytes  = live_bytes,
+            .peak_bytes  = peak > live_bytes ? peak : live_bytes,
+            .allocations = atomic_load_explicit(&allocations,
+                                                memory_order_relaxed),
+        };
+    }
+
+    pthread_mutex_unlock(&snapshots_lock);
+}
+
+void alloc_timeline_tick(bool allocated, size_t size)
+{
+    size_t live_bytes = alloc_stats_live_bytes();
+
+    if (allocated)
+        atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+
+    size_t peak = atomic_load_explicit(&window_peak, memory_order_relaxed);
+    while (live_bytes > peak && !atomic_compare_exchange_weak_explicit(
+                &window_peak, &peak, live_bytes,
+                memory_order_relaxed, memory_order_relaxed))
+    { }
+
+    // In either mode, only the thread that claims the snapshot (by
+    // resetting the counter it crossed) takes it.
+    if (timeline_unit == RTIPD_TIMELINE_BYTES) {
+        if (!allocated) return;
+
+        size_t since = size + atomic_fetch_add_explicit(
+                &bytes_since, size, memory_order_relaxed);
+        if (since < interval) return;
+
+        if (atomic_compare_exchange_strong(&bytes_since, &since, 0))
+            take_snapshot(now_ns(), live_bytes);
+    } else {
+        uint64_t now = now_ns();
+        uint64_t due = atomic_load_explicit(&next_due, memory_order_relaxed);
+        if (now < due) return;
+
+        if (atomic_compare_exchange_strong(&next_due, &due, now + interval))
+            take_snapshot(now, live_bytes);
+    }
+}
+
+static void write_timeline(void)
+{
+    // Forked children (such as test cases) inherit our handler and our
+    // stream, but the timeline belongs to the process that started it.
+    if (getpid() != timeline_pid) return;
+
+    rtipd_in_runtime = true;
+
+    // Opening the file only now means that when one process runs
+    // another, the timeline written last is left whole.
+    FILE* out = rtipd_env_open(EV_TIMELINE, "wb");
+    if (!out) {
+        rtipd_in_runtime = false;
+        return;
+    }
+
+    take_snapshot(now_ns(), alloc_stats_live_bytes());
+
+    pthread_mutex_lock(&snapshots_lock);
+
+    struct rtipd_timeline_header header = {
+        .magic       = RTIPD_TIMELINE_MAGIC,
+        .byte_order  = RTIPD_TIMELINE_BYTE_ORDER,
+        .version     = RTIPD_TIMELINE_VERSION,
+        .record_size = sizeof(struct rtipd_timeline_record),
+        .interval    = interval,
+        .unit        = (uint8_t)timeline_unit,
+    };
+
+    fwrite(&header, sizeof header, 1, out);
+    if (snapshots_used)
+        fwrite(snapshots, sizeof *snapshots, snapshots_used, out);
+    fclose(out);
+
+    free(snapshots);
+    snapshots = NULL;
+    snapshots_used = 0;
+
+    pthread_mutex_unlock(&snapshots_lock);
+    rtipd_in_runtime = false;
+}
+
+bool alloc_timeline_init(void)
+{
+    char const* dst = getenv(EV_TIMELINE);
+    if (!dst || !*dst) return false;
+
+    read_interval();
+
+    timeline_pid = getpid();
+    start_time   = now_ns();
+    next_due     = start_time + interval;
+
+    atexit(&write_timeline);
+    return true;
+}
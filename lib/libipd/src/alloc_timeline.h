@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Heap usage over time, for alloc_rt.c. When enabled (by the
+// RTIPD_ALLOC_TIMELINE environment variable), the allocation runtime
+// reports every call here, and every so often (in time, or in bytes
+// allocated) we take a snapshot of the live bytes. The snapshots are
+// written to a file at exit, for ipd-timeline(1).
+
+// Reads the environment and returns whether the timeline is enabled.
+// Call once.
+bool alloc_timeline_init(void);
+
+// Records a call, after alloc_stats.c has. If `allocated` then it
+// allocated `size` bytes.
+void alloc_timeline_tick(bool allocated, size_t size);
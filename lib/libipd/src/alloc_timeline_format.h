@@ -0,0 +1,44 @@
+#pragma once
+
+// The heap timeline format, written by alloc_timeline.c at exit when
+// RTIPD_ALLOC_TIMELINE is set and read by ipd-timeline(1).
+//
+// A timeline is a `struct rtipd_timeline_header` followed by fixed-size
+// `struct rtipd_timeline_record`s in time order, all in the writer's
+// native byte order.
+
+#include <stdint.h>
+
+#define RTIPD_TIMELINE_MAGIC       "IPDHEAPT"
+#define RTIPD_TIMELINE_VERSION     1
+#define RTIPD_TIMELINE_BYTE_ORDER  UINT32_C(0x01020304)
+
+enum rtipd_timeline_unit
+{
+    RTIPD_TIMELINE_NANOSECONDS = 1,
+    RTIPD_TIMELINE_BYTES,
+};
+
+struct rtipd_timeline_header
+{
+    char     magic[8];      // RTIPD_TIMELINE_MAGIC, without the 0
+    uint32_t byte_order;    // RTIPD_TIMELINE_BYTE_ORDER as written
+    uint16_t version;       // RTIPD_TIMELINE_VERSION
+    uint16_t record_size;   // sizeof (struct rtipd_timeline_record)
+    uint64_t interval;      // final sampling interval, in `unit`s
+    uint8_t  unit;          // an `enum rtipd_timeline_unit`
+    uint8_t  reserved[7];
+};
+
+struct rtipd_timeline_record
+{
+    uint64_t time;          // nanoseconds since the first allocation
+    uint64_t live_bytes;    // at the time of the snapshot
+    uint64_t peak_bytes;    // most live at once since the last snapshot
+    uint64_t allocations;   // calls that allocated, so far
+};
+
+_Static_assert(sizeof(struct rtipd_timeline_header) == 32,
+               "timeline header must be 32 bytes");
+_Static_assert(sizeof(struct rtipd_timeline_record) == 32,
+               "timeline records must be 32 bytes");
@@ -0,0 +1,48 @@
+#pragma once
+
+// The binary allocation trace format, written by alloc_rt.c when
+// RTIPD_TRACE_FORMAT=binary and read by ipd-trace(1).
+//
+// A trace is a `struct rtipd_trace_header` followed by any number of
+// fixed-size `struct rtipd_trace_record`s, all in the writer's native
+// byte order. Records from different threads are written in blocks,
+// so they are not globally sorted by timestamp.
+
+#include <stdint.h>
+
+#define RTIPD_TRACE_MAGIC       "IPDTRACE"
+#define RTIPD_TRACE_VERSION     1
+#define RTIPD_TRACE_BYTE_ORDER  UINT32_C(0x01020304)
+
+struct rtipd_trace_header
+{
+    char     magic[8];      // RTIPD_TRACE_MAGIC, without the 0
+    uint32_t byte_order;    // RTIPD_TRACE_BYTE_ORDER as written
+    uint16_t version;       // RTIPD_TRACE_VERSION
+    uint16_t record_size;   // sizeof (struct rtipd_trace_record)
+};
+
+enum rtipd_trace_op
+{
+    RTIPD_TRACE_MALLOC = 1,
+    RTIPD_TRACE_CALLOC,
+    RTIPD_TRACE_REALLOC,
+    RTIPD_TRACE_REALLOCF,
+    RTIPD_TRACE_FREE,
+};
+
+struct rtipd_trace_record
+{
+    uint64_t timestamp;     // CLOCK_MONOTONIC, in nanoseconds
+    uint64_t pointer;       // argument to free/realloc/reallocf, else 0
+    uint64_t result;        // pointer returned, or 0 if none/failed
+    uint64_t size;          // bytes requested (0 for free)
+    uint32_t thread;        // small per-process thread number, from 1
+    uint8_t  op;            // an `enum rtipd_trace_op`
+    uint8_t  reserved[3];
+};
+
+_Static_assert(sizeof(struct rtipd_trace_header) == 16,
+               "trace header must be 16 bytes");
+_Static_assert(sizeof(struct rtipd_trace_record) == 40,
+               "trace records must be 40 bytes");
@@ -0,0 +1,338 @@
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#define _XOPEN_SOURCE 700
+
+#include "libipd_bench.h"
+#include "rt_env.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define EV_SAMPLES  "RTIPD_BENCH_SAMPLES"
+#define EV_WARMUP   "RTIPD_BENCH_WARMUP"
+#define EV_OUTPUT   "RTIPD_BENCH_OUTPUT"
+
+enum output_format
+{
+    OUTPUT_CSV,
+    OUTPUT_JSON,
+};
+
+static bool               started       = false;
+static size_t             sample_count  = 20;
+static double             warmup_time   = 0.1;
+
+// Where results go besides stdout, if anywhere.
+static FILE*              output        = NULL;
+static bool               output_is_fd  = false;   // from `&N`
+static enum output_format output_format = OUTPUT_CSV;
+static unsigned long      output_count  = 0;
+
+static void start_benchmarking(void)
+{
+    if (started) return;
+    started = true;
+
+    unsigned long samples;
+    if (rtipd_env_ulong(EV_SAMPLES, &samples))
+        sample_count = samples ? samples : 1;
+    if (rtipd_env_double(EV_WARMUP, &warmup_time) && warmup_time < 0)
+        rtipd_bad_env_var(EV_WARMUP, getenv(EV_WARMUP));
+
+    char const* dest = getenv(EV_OUTPUT);
+    if (dest && *dest) bench_set_output(dest);
+}
+
+void bench_set_samples(size_t n)
+{
+    start_benchmarking();
+    sample_count = n ? n : 1;
+}
+
+void bench_set_warmup(double seconds)
+{
+    start_benchmarking();
+    warmup_time = seconds > 0 ? seconds : 0;
+}
+
+///
+/// OUTPUT
+///
+
+static void finish_output(void)
+{
+    if (!output) return;
+
+    if (output_format == OUTPUT_JSON)
+        fprintf(output, output_count ? "\n]\n" : "[]\n");
+
+    // Closing a stream from `&1` would close stdout too.
+    if (output_is_fd)
+        fflush(output);
+    else
+        fclose(output);
+
+    output = NULL;
+}
+
+bool bench_set_output(char const* dest)
+{
+    static bool atexit_installed = false;
+
+    start_benchmarking();
+    finish_output();
+    if (!dest) return true;
+
+    char const* colon = strchr(dest, ':');
+    size_t format_len = colon ? (size_t)(colon - dest) : 0;
+
+    if (format_len == 3 && strncmp(dest, "csv", 3) == 0) {
+        output_format = OUTPUT_CSV;
+    } else if (format_len == 4 && strncmp(dest, "json", 4) == 0) {
+        output_format = OUTPUT_JSON;
+    } else {
+        fprintf(stderr, "libipd: benchmark output ‘%s’ should be "
+                        "csv:FILE or json:FILE\n", dest);
+        return false;
+    }
+
+    output = rtipd_open_destination(colon + 1, "w");
+    if (!output) {
+        fprintf(stderr, "libipd: could not open benchmark output ‘%s’: %s\n",
+                colon + 1, strerror(errno));
+        return false;
+    }
+
+    // The output is ours, so programs we run shouldn't write over it.
+    unsetenv(EV_OUTPUT);
+
+    output_is_fd = colon[1] == '&';
+    output_count = 0;
+
+    if (!atexit_installed && atexit(&finish_output) == 0)
+        atexit_installed = true;
+
+    return true;
+}
+
+static void put_csv_string(char const* s)
+{
+    fputc('"', output);
+    for ( ; *s; ++s) {
+        if (*s == '"') fputc('"', output);
+        fputc(*s, output);
+    }
+    fputc('"', output);
+}
+
+static void put_json_string(char const* s)
+{
+    fputc('"', output);
+
+    for ( ; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        switch (c) {
+        case '"':  fputs("\\\"", output); break;
+        case '\\': fputs("\\\\", output); break;
+        case '\n': fputs("\\n", output);  break;
+        case '\r': fputs("\\r", output);  break;
+        case '\t': fputs("\\t", output);  break;
+        default:
+            if (c < 0x20)
+                fprintf(output, "\\u%04x", c);
+            else
+                fputc(c, output);
+        }
+    }
+
+    fputc('"', output);
+}
+
+static void output_csv(char const* name, char const* file, int line,
+                       struct bench_stats const* stats)
+{
+    if (!output_count)
+        fprintf(output, "name,file,line,samples,calls_per_sample,"
+                        "mean_ns,median_ns,stddev_ns,min_ns,max_ns\n");
+
+    put_csv_string(name);
+    fputc(',', output);
+    put_csv_string(file);
+    fprintf(output, ",%d,%zu,%zu,%.6g,%.6g,%.6g,%.6g,%.6g\n",
+            line, stats->samples, stats->calls_per_sample,
+            stats->mean, stats->median, stats->stddev,
+            stats->min, stats->max);
+}
+
+static void output_json(char const* name, char const* file, int line,
+                        struct bench_stats const* stats)
+{
+    fputs(output_count ? ",\n  {\"name\":" : "[\n  {\"name\":", output);
+    put_json_string(name);
+    fputs(",\"file\":", output);
+    put_json_string(file);
+    fprintf(output, ",\"line\":%d,\"samples\":%zu,\"calls_per_sample\":%zu,"
+                    "\"mean_ns\":%.6g,\"median_ns\":%.6g,\"stddev_ns\":%.6g,"
+                    "\"min_ns\":%.6g,\"max_ns\":%.6g}",
+            line, stats->samples, stats->calls_per_sample,
+            stats->mean, stats->median, stats->stddev,
+            stats->min, stats->max);
+}
+
+static void output_result(char const* name, char const* file, int line,
+                          struct bench_stats const* stats)
+{
+    if (!output) return;
+
+    switch (output_format) {
+    case OUTPUT_CSV:  output_csv(name, file, line, stats);  break;
+    case OUTPUT_JSON: output_json(name, file, line, stats); break;
+    }
+
+    ++output_count;
+    fflush(output);
+}
+
+// Formats a time given in nanoseconds into `buf`, in whatever unit
+// suits it.
+static char const* format_ns(char buf[static 32], double ns)
+{
+    if (ns < 1e3)
+        snprintf(buf, 32, "%.1f ns", ns);
+    else if (ns < 1e6)
+        snprintf(buf, 32, "%.2f µs", ns / 1e3);
+    else if (ns < 1e9)
+        snprintf(buf, 32, "%.2f ms", ns / 1e6);
+    else
+        snprintf(buf, 32, "%.2f s", ns / 1e9);
+    return buf;
+}
+
+static void print_result(char const* name, struct bench_stats const* stats)
+{
+    char mean[32], median[32], stddev[32], min[32];
+
+    printf("%s: mean %s, median %s, stddev %s, min %s\n"
+           "    (%zu sample%s of %zu call%s)\n",
+           name,
+           format_ns(mean, stats->mean),
+           format_ns(median, stats->median),
+           format_ns(stddev, stats->stddev),
+           format_ns(min, stats->min),
+           stats->samples, stats->samples == 1 ? "" : "s",
+           stats->calls_per_sample,
+           stats->calls_per_sample == 1 ? "" : "s");
+    fflush(stdout);
+}
+
+///
+/// MEASURING
+///
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+#ifdef LIBIPD_HAS_POSIX
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns how many seconds `calls` calls to `fn(arg)` take.
+static double time_calls(void (*fn)(void*), void* arg, size_t calls)
+{
+    double start = now_seconds();
+    for (size_t i = 0; i < calls; ++i) fn(arg);
+    return now_seconds() - start;
+}
+
+// Calls `fn(arg)` for at least `warmup_time` seconds, in rounds that
+// double the number of calls each time, and returns how many calls it
+// takes to fill a sample, judging by the last round.
+static size_t warm_up(void (*fn)(void*), void* arg)
+{
+    double const sample_time = warmup_time / 10;
+
+    size_t calls = 1;
+    double spent = 0, last;
+
+    for (;;) {
+        last   = time_calls(fn, arg, calls);
+        spent += last;
+        if (spent >= warmup_time || calls > SIZE_MAX / 2) break;
+        calls *= 2;
+    }
+
+    if (last <= 0) return calls;
+
+    double wanted = sample_time * calls / last;
+    if (wanted < 1) return 1;
+    if (wanted > SIZE_MAX / 2) return SIZE_MAX / 2;
+    return (size_t) wanted;
+}
+
+static int compare_doubles(void const* a, void const* b)
+{
+    double x = *(double const*) a, y = *(double const*) b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the `n` (at least 1) samples and summarizes them.
+static void summarize(double* samples, size_t n, struct bench_stats* stats)
+{
+    qsort(samples, n, sizeof *samples, &compare_doubles);
+
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += samples[i];
+    double mean = sum / n;
+
+    double squares = 0;
+    for (size_t i = 0; i < n; ++i)
+        squares += (samples[i] - mean) * (samples[i] - mean);
+
+    stats->mean   = mean;
+    stats->stddev = n > 1 ? sqrt(squares / (n - 1)) : 0;
+    stats->median = n % 2 ? samples[n / 2]
+                          : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    stats->min    = samples[0];
+    stats->max    = samples[n - 1];
+}
+
+struct bench_stats libipd_do_bench(
+        char const* name,
+        void (*fn)(void*),
+        void* arg,
+        char const* file,
+        int line)
+{
+    start_benchmarking();
+
+    size_t const n     = sample_count;
+    size_t const calls = warm_up(fn, arg);
+
+    double* samples = malloc(n * sizeof *samples);
+    if (!samples) {
+        perror("BENCH");
+        exit(11);
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        samples[i] = time_calls(fn, arg, calls) * 1e9 / calls;
+
+    struct bench_stats stats = {.samples = n, .calls_per_sample = calls};
+    summarize(samples, n, &stats);
+    free(samples);
+
+    output_result(name, file, line, &stats);
+    print_result(name, &stats);
+
+    return stats;
+}
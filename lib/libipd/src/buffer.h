@@ -1,6 +1,10 @@
 #pragma once
 
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 struct buffer
 {
@@ -46,3 +50,56 @@ bfread(struct buffer* buf, size_t pad, FILE* fin)
     buf->fill += count;
     return count;
 }
+
+// Makes room for `n` more bytes, growing geometrically. A zeroed
+// `struct buffer` is a valid empty buffer.
+static inline bool
+breserve(struct buffer* buf, size_t n)
+{
+    if (buf->fill + n <= buf->cap) return true;
+
+    size_t cap = buf->cap ? 2 * buf->cap : 64;
+    while (cap < buf->fill + n) cap *= 2;
+    return brealloc(buf, cap);
+}
+
+static inline bool
+bappend(struct buffer* buf, char const* s, size_t n)
+{
+    if (!breserve(buf, n)) return false;
+
+    memcpy(buf->data + buf->fill, s, n);
+    buf->fill += n;
+    return true;
+}
+
+static inline bool
+bputc(struct buffer* buf, char c)
+{
+    return bappend(buf, &c, 1);
+}
+
+static inline bool
+bputs(struct buffer* buf, char const* s)
+{
+    return bappend(buf, s, strlen(s));
+}
+
+static inline bool
+bprintf(struct buffer* buf, char const* format, ...)
+{
+    va_list ap;
+
+    va_start(ap, format);
+    int n = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+
+    if (n < 0 || !breserve(buf, (size_t)n + 1)) return false;
+
+    va_start(ap, format);
+    vsnprintf(buf->data + buf->fill, (size_t)n + 1, format, ap);
+    va_end(ap);
+
+    buf->fill += (size_t)n;
+    return true;
+}
@@ -0,0 +1,562 @@
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "check_format.h"
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Strings longer than LITERAL_MAX bytes show only their first and last
+// LITERAL_ENDS bytes.
+#define LITERAL_MAX    256
+#define LITERAL_ENDS   96
+
+// Mismatched strings show this many bytes on each side of the first
+// difference.
+#define WINDOW_BEFORE  48
+#define WINDOW_AFTER   48
+
+// Mismatched memory shows this many bytes on each side, and mismatched
+// arrays this many elements.
+#define BYTES_AROUND   8
+#define ELEMS_AROUND   4
+
+///
+/// LITERALS
+///
+
+static const char* c_escape_of_char(char c) {
+    switch (c) {
+        case '\a': return "a";
+        case '\b': return "b";
+        case '\f': return "f";
+        case '\n': return "n";
+        case '\r': return "r";
+        case '\t': return "t";
+        case '\v': return "v";
+        case '\\': return "\\";
+        default:   return NULL;
+    }
+}
+
+static void bput_escaped_char(struct buffer* buf, char c, char quote)
+{
+    const char* escaped = c_escape_of_char(c);
+
+    if (escaped) {
+        bputc(buf, '\\');
+        bputs(buf, escaped);
+    } else if (c == quote) {
+        bputc(buf, '\\');
+        bputc(buf, c);
+    } else if (isgraph((unsigned char) c) || c == ' ') {
+        bputc(buf, c);
+    } else {
+        bprintf(buf, "\\x%02x", (unsigned char) c);
+    }
+}
+
+static void bput_escaped(struct buffer* buf, char const* s, size_t len)
+{
+    for (size_t i = 0; i < len; ++i) bput_escaped_char(buf, s[i], '"');
+}
+
+static void bput_escaped_string(struct buffer* buf,
+                                char const* s, size_t len)
+{
+    bputc(buf, '"');
+    bput_escaped(buf, s, len);
+    bputc(buf, '"');
+}
+
+void bput_char_literal(struct buffer* buf, char c)
+{
+    if (c) {
+        bputc(buf, '\'');
+        bput_escaped_char(buf, c, '\'');
+        bputc(buf, '\'');
+    } else {
+        bputc(buf, '0');
+    }
+}
+
+void bput_string_literal(struct buffer* buf, const char* s)
+{
+    if (!s) {
+        bputs(buf, "(null)");
+        return;
+    }
+
+    size_t len = strlen(s);
+
+    if (len <= LITERAL_MAX) {
+        bput_escaped_string(buf, s, len);
+        return;
+    }
+
+    bput_escaped_string(buf, s, LITERAL_ENDS);
+    bprintf(buf, "...(%zu bytes elided)...", len - 2 * LITERAL_ENDS);
+    bput_escaped_string(buf, s + len - LITERAL_ENDS, LITERAL_ENDS);
+}
+
+void eprint_buffer(struct buffer* buf)
+{
+    if (buf->fill) {
+        fwrite(buf->data, 1, buf->fill, stderr);
+        fflush(stderr);
+    }
+
+    free(buf->data);
+    *buf = (struct buffer) {0};
+}
+
+///
+/// WINDOWS
+///
+
+// Appends the part of `s` around offset `diff` as a literal, with `...`
+// outside the quotes where it's cut off. Returns how many columns come
+// before the rendering of `s[diff]`.
+static size_t bput_window(struct buffer* buf,
+                          char const* s, size_t len, size_t diff)
+{
+    size_t start = diff > WINDOW_BEFORE ? diff - WINDOW_BEFORE : 0;
+    size_t end   = len - diff > WINDOW_AFTER ? diff + WINDOW_AFTER : len;
+
+    size_t begin = buf->fill;
+
+    if (start) bputs(buf, "...");
+    bputc(buf, '"');
+    bput_escaped(buf, s + start, diff - start);
+
+    size_t column = buf->fill - begin;
+
+    bput_escaped(buf, s + diff, end - diff);
+    bputc(buf, '"');
+    if (end < len) bputs(buf, "...");
+
+    return column;
+}
+
+///
+/// LINE SUMMARY
+///
+
+// Counts the lines in `s[start, end)`, where a final line needn't end
+// with a newline.
+static size_t count_lines(char const* s, size_t start, size_t end)
+{
+    size_t lines = 0;
+    char const* p    = s + start;
+    char const* stop = s + end;
+
+    while ((p = memchr(p, '\n', (size_t)(stop - p)))) {
+        ++lines;
+        ++p;
+    }
+
+    if (end > start && s[end - 1] != '\n') ++lines;
+
+    return lines;
+}
+
+// Finds the line of `s[*pos, end)` starting at `*pos`, advancing `*pos`
+// past it. Returns false if there are no more.
+static bool next_line(char const* s, size_t end,
+                      size_t* pos, char const** line, size_t* line_len)
+{
+    if (*pos >= end) return false;
+
+    char const* nl = memchr(s + *pos, '\n', end - *pos);
+    size_t stop = nl ? (size_t)(nl - s) : end;
+
+    *line     = s + *pos;
+    *line_len = stop - *pos;
+    *pos      = nl ? stop + 1 : end;
+    return true;
+}
+
+static uint64_t hash_line(char const* s, size_t len)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char) s[i];
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+struct line_slot
+{
+    char const* line;       // NULL if the slot is empty
+    size_t      len;
+    uint64_t    hash;
+    size_t      count;      // how many times it's in `want` but not `have`
+};
+
+// Counts the lines in `have[h_start, h_end)` that aren't matched by a
+// line in `want[w_start, w_end)`, and vice versa, as multisets. Returns
+// false if it can't get the memory.
+static bool count_unmatched_lines(char const* have,
+                                  size_t h_start, size_t h_end,
+                                  char const* want,
+                                  size_t w_start, size_t w_end, size_t w_lines,
+                                  size_t* only_have, size_t* only_want)
+{
+    size_t cap = 16;
+    while (cap < 2 * w_lines) cap *= 2;
+
+    struct line_slot* table = calloc(cap, sizeof *table);
+    if (!table) return false;
+
+    char const* line;
+    size_t len;
+    size_t pos = w_start;
+
+    while (next_line(want, w_end, &pos, &line, &len)) {
+        uint64_t h = hash_line(line, len);
+        size_t i = (size_t) h & (cap - 1);
+
+        while (table[i].line &&
+               !(table[i].hash == h && table[i].len == len &&
+                 memcmp(table[i].line, line, len) == 0))
+            i = (i + 1) & (cap - 1);
+
+        table[i] = (struct line_slot) {line, len, h, table[i].count + 1};
+    }
+
+    *only_have = 0;
+    *only_want = w_lines;
+    pos = h_start;
+
+    while (next_line(have, h_end, &pos, &line, &len)) {
+        uint64_t h = hash_line(line, len);
+        size_t i = (size_t) h & (cap - 1);
+
+        while (table[i].line &&
+               !(table[i].hash == h && table[i].len == len &&
+                 memcmp(table[i].line, line, len) == 0))
+            i = (i + 1) & (cap - 1);
+
+        if (table[i].line && table[i].count) {
+            --table[i].count;
+            --*only_want;
+        } else {
+            ++*only_have;
+        }
+    }
+
+    free(table);
+    return true;
+}
+
+static void bput_line_range(struct buffer* buf, size_t first, size_t count)
+{
+    if (count == 0)
+        bprintf(buf, "none after %zu", first - 1);
+    else if (count == 1)
+        bprintf(buf, "%zu", first);
+    else
+        bprintf(buf, "%zu-%zu", first, first + count - 1);
+}
+
+// Appends which lines differ, given that the strings first differ in
+// line number `first_line`, which starts at offset `mid_start`. The
+// lines before it are the same, and so are the lines in the longest
+// common suffix made of whole lines; in between, we count the lines in
+// each that the other lacks, by hashing, so this takes time linear in
+// the lengths.
+static void bput_line_summary(struct buffer* buf,
+                              char const* have, size_t have_len,
+                              char const* want, size_t want_len,
+                              size_t mid_start, size_t first_line)
+{
+    // The lines before `mid_start` are the same in both.
+    size_t same       = first_line - 1;
+    size_t total_have = same + count_lines(have, mid_start, have_len);
+    size_t total_want = same + count_lines(want, mid_start, want_len);
+
+    // Not worth it for single-line strings.
+    if (total_have < 2 && total_want < 2) return;
+
+    // The common suffix, not reaching back into the line with `diff`.
+    size_t limit  = (have_len < want_len ? have_len : want_len) - mid_start;
+    size_t suffix = 0;
+    while (suffix < limit &&
+           have[have_len - suffix - 1] == want[want_len - suffix - 1])
+        ++suffix;
+
+    // Trim it to whole lines by starting after its first newline.
+    size_t h_end = have_len, w_end = want_len;
+    for (size_t i = have_len - suffix; i < have_len; ++i) {
+        if (have[i] == '\n') {
+            h_end = i + 1;
+            w_end = want_len - (have_len - h_end);
+            break;
+        }
+    }
+
+    size_t h_lines = count_lines(have, mid_start, h_end);
+    size_t w_lines = count_lines(want, mid_start, w_end);
+
+    bputs(buf, "  lines: have ");
+    bput_line_range(buf, first_line, h_lines);
+    bprintf(buf, " of %zu, want ", total_have);
+    bput_line_range(buf, first_line, w_lines);
+    bprintf(buf, " of %zu", total_want);
+
+    size_t only_have, only_want;
+    if (count_unmatched_lines(have, mid_start, h_end,
+                              want, mid_start, w_end, w_lines,
+                              &only_have, &only_want))
+        bprintf(buf, "; %zu only in have, %zu only in want",
+                only_have, only_want);
+
+    bputc(buf, '\n');
+}
+
+///
+/// MISMATCHES
+///
+
+// Compares blocks with memcmp(3) first, since the strings may be
+// megabytes long.
+size_t first_byte_difference(void const* a, void const* b, size_t len)
+{
+    enum { BLOCK = 4096 };
+
+    unsigned char const* p = a;
+    unsigned char const* q = b;
+
+    size_t i = 0;
+    while (len - i >= BLOCK && memcmp(p + i, q + i, BLOCK) == 0) i += BLOCK;
+    while (i < len && p[i] == q[i]) ++i;
+
+    return i;
+}
+
+void bput_string_mismatch(struct buffer* buf,
+                          char const* have,
+                          char const* have_from,
+                          char const* want,
+                          char const* want_from)
+{
+    size_t have_len = strlen(have);
+    size_t want_len = strlen(want);
+    size_t diff     = first_byte_difference(have, want,
+                                            have_len < want_len
+                                            ? have_len : want_len);
+
+    size_t line_start = diff;
+    while (line_start && have[line_start - 1] != '\n') --line_start;
+    size_t line = count_lines(have, 0, line_start) + 1;
+
+    bprintf(buf, "  first difference: line %zu, column %zu (offset %zu)",
+            line, diff - line_start + 1, diff);
+    if (diff == have_len)
+        bputs(buf, "; have ends there");
+    else if (diff == want_len)
+        bputs(buf, "; want ends there");
+    bputc(buf, '\n');
+
+    static char const have_label[] = "  have: ";
+    static char const want_label[] = "  want: ";
+
+    bputs(buf, have_label);
+    bput_window(buf, have, have_len, diff);
+    if (have_from) bprintf(buf, "  (from: %s)", have_from);
+    bputc(buf, '\n');
+
+    bputs(buf, want_label);
+    size_t column = bput_window(buf, want, want_len, diff);
+    if (want_from) bprintf(buf, "  (from: %s)", want_from);
+    bputc(buf, '\n');
+
+    bprintf(buf, "%*s^\n", (int)(sizeof want_label - 1 + column), "");
+
+    bput_line_summary(buf, have, have_len, want, want_len,
+                      line_start, line);
+}
+
+///
+/// MEMORY AND ARRAYS
+///
+
+// Appends `(N things differ)` and ends the line.
+static void bput_differ_count(struct buffer* buf, size_t differ,
+                              char const* thing)
+{
+    if (differ == 1)
+        bprintf(buf, "(1 %s differs)\n", thing);
+    else
+        bprintf(buf, "(%zu %ss differ)\n", differ, thing);
+}
+
+// Appends the bytes of `p` from `start` to `end` in hex, returning how
+// many columns come before byte `diff`.
+static size_t bput_hex_window(struct buffer* buf, unsigned char const* p,
+                              size_t start, size_t end, size_t len,
+                              size_t diff)
+{
+    size_t begin  = buf->fill;
+    size_t column = 0;
+
+    if (start) bputs(buf, "... ");
+
+    for (size_t i = start; i < end; ++i) {
+        if (i > start) bputc(buf, ' ');
+        if (i == diff) column = buf->fill - begin;
+        bprintf(buf, "%02x", p[i]);
+    }
+
+    if (end < len) bputs(buf, " ...");
+
+    return column;
+}
+
+void bput_memory_mismatch(struct buffer* buf,
+                          void const* have,
+                          char const* have_from,
+                          void const* want,
+                          char const* want_from,
+                          size_t len,
+                          size_t diff,
+                          size_t differ)
+{
+    unsigned char const* h = have;
+    unsigned char const* w = want;
+
+    bprintf(buf, "  first difference: byte %zu of %zu ", diff, len);
+    bput_differ_count(buf, differ, "byte");
+
+    size_t start = diff > BYTES_AROUND ? diff - BYTES_AROUND : 0;
+    size_t end   = len - diff > BYTES_AROUND ? diff + BYTES_AROUND + 1 : len;
+
+    static char const have_label[] = "  have: ";
+    static char const want_label[] = "  want: ";
+
+    bputs(buf, have_label);
+    bput_hex_window(buf, h, start, end, len, diff);
+    if (have_from) bprintf(buf, "  (from: %s)", have_from);
+    bputc(buf, '\n');
+
+    bputs(buf, want_label);
+    size_t column = bput_hex_window(buf, w, start, end, len, diff);
+    if (want_from) bprintf(buf, "  (from: %s)", want_from);
+    bputc(buf, '\n');
+
+    bprintf(buf, "%*s^\n", (int)(sizeof want_label - 1 + column), "");
+}
+
+static long long load_signed(unsigned char const* p, size_t size)
+{
+    switch (size) {
+    case 1: { signed char v; memcpy(&v, p, 1); return v; }
+    case 2: { int16_t v; memcpy(&v, p, 2); return v; }
+    case 4: { int32_t v; memcpy(&v, p, 4); return v; }
+    default: { int64_t v; memcpy(&v, p, 8); return v; }
+    }
+}
+
+static unsigned long long load_unsigned(unsigned char const* p, size_t size)
+{
+    switch (size) {
+    case 1: return *p;
+    case 2: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case 4: { uint32_t v; memcpy(&v, p, 4); return v; }
+    default: { uint64_t v; memcpy(&v, p, 8); return v; }
+    }
+}
+
+static void bput_element(struct buffer* buf, enum libipd_elem_kind kind,
+                         unsigned char const* p, size_t size)
+{
+    // Sizes we can't load fall back to bytes.
+    bool loadable = size == 1 || size == 2 || size == 4 || size == 8;
+
+    if (kind == LIBIPD_ELEM_CHAR && size == 1) {
+        bput_char_literal(buf, (char) *p);
+    } else if (kind == LIBIPD_ELEM_SIGNED && loadable) {
+        bprintf(buf, "%lld", load_signed(p, size));
+    } else if (kind == LIBIPD_ELEM_UNSIGNED && loadable) {
+        bprintf(buf, "%llu", load_unsigned(p, size));
+    } else if (kind == LIBIPD_ELEM_FLOAT && size == sizeof(float)) {
+        float v;
+        memcpy(&v, p, sizeof v);
+        bprintf(buf, "%.9g", v);
+    } else if (kind == LIBIPD_ELEM_FLOAT && size == sizeof(double)) {
+        double v;
+        memcpy(&v, p, sizeof v);
+        bprintf(buf, "%.17g", v);
+    } else {
+        bputs(buf, "<");
+        for (size_t i = 0; i < size; ++i)
+            bprintf(buf, i ? " %02x" : "%02x", p[i]);
+        bputs(buf, ">");
+    }
+}
+
+// Appends the elements of `p` from `start` to `end` like an array
+// initializer, returning how many columns come before element `diff`.
+static size_t bput_element_window(struct buffer* buf, enum libipd_elem_kind kind,
+                                  unsigned char const* p, size_t size,
+                                  size_t start, size_t end, size_t count,
+                                  size_t diff)
+{
+    size_t begin  = buf->fill;
+    size_t column = 0;
+
+    bputs(buf, start ? "{..., " : "{");
+
+    for (size_t i = start; i < end; ++i) {
+        if (i > start) bputs(buf, ", ");
+        if (i == diff) column = buf->fill - begin;
+        bput_element(buf, kind, p + i * size, size);
+    }
+
+    bputs(buf, end < count ? ", ...}" : "}");
+
+    return column;
+}
+
+void bput_array_mismatch(struct buffer* buf,
+                         enum libipd_elem_kind kind,
+                         size_t elem_size,
+                         void const* have,
+                         char const* have_from,
+                         void const* want,
+                         char const* want_from,
+                         size_t count,
+                         size_t diff,
+                         size_t differ)
+{
+    unsigned char const* h = have;
+    unsigned char const* w = want;
+
+    bprintf(buf, "  first difference: index %zu of %zu ", diff, count);
+    bput_differ_count(buf, differ, "element");
+
+    size_t start = diff > ELEMS_AROUND ? diff - ELEMS_AROUND : 0;
+    size_t end   = count - diff > ELEMS_AROUND
+                   ? diff + ELEMS_AROUND + 1 : count;
+
+    static char const have_label[] = "  have: ";
+    static char const want_label[] = "  want: ";
+
+    bputs(buf, have_label);
+    bput_element_window(buf, kind, h, elem_size, start, end, count, diff);
+    if (have_from) bprintf(buf, "  (from: %s)", have_from);
+    bputc(buf, '\n');
+
+    bputs(buf, want_label);
+    size_t column = bput_element_window(buf, kind, w, elem_size,
+                                        start, end, count, diff);
+    if (want_from) bprintf(buf, "  (from: %s)", want_from);
+    bputc(buf, '\n');
+
+    bprintf(buf, "%*s^\n", (int)(sizeof want_label - 1 + column), "");
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "buffer.h"
+#include "libipd_test.h"
+
+#include <stddef.h>
+
+// Rendering for check failure messages, shared by test_rt.c and
+// program_test_rt.c. Messages are built in a buffer and then written
+// with one call, since eprintf flushes every time.
+
+// Appends `c` as a C character literal, or `0` for the null character.
+void bput_char_literal(struct buffer*, char c);
+
+// Appends `s` as a C string literal, or `(null)`. Long strings show only
+// their first and last few bytes.
+void bput_string_literal(struct buffer*, char const* s);
+
+// Appends `have: ...` and `want: ...` lines showing a window of each
+// string around where they first differ, with a caret under it, and a
+// summary of which lines differ. Each `from`, if not NULL, follows its
+// string as `(from: ...)`. Neither string may be NULL.
+void bput_string_mismatch(struct buffer*,
+                          char const* have,
+                          char const* have_from,
+                          char const* want,
+                          char const* want_from);
+
+// Returns the offset of the first byte where `a` and `b` differ, or
+// `len` if they agree that far.
+size_t first_byte_difference(void const* a, void const* b, size_t len);
+
+// Appends a line saying where the `len`-byte blocks `have` and `want`
+// first differ, at offset `diff`, and that `differ` bytes differ in all,
+// then `have: ...` and `want: ...` lines showing the bytes around it in
+// hex, with a caret under it.
+void bput_memory_mismatch(struct buffer*,
+                          void const* have,
+                          char const* have_from,
+                          void const* want,
+                          char const* want_from,
+                          size_t len,
+                          size_t diff,
+                          size_t differ);
+
+// Likewise for arrays of `count` elements of `elem_size` bytes each,
+// first differing at index `diff`, showing the elements around it as
+// `kind` says.
+void bput_array_mismatch(struct buffer*,
+                         enum libipd_elem_kind kind,
+                         size_t elem_size,
+                         void const* have,
+                         char const* have_from,
+                         void const* want,
+                         char const* want_from,
+                         size_t count,
+                         size_t diff,
+                         size_t differ);
+
+// Writes `buf` to stderr and frees it.
+void eprint_buffer(struct buffer* buf);
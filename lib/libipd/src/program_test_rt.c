@@ -6,6 +6,7 @@
 
 #include "ipd.h"
 #include "buffer.h"
+#include "check_format.h"
 #include "test_reporting.h"
 
 #include <ctype.h>
@@ -25,6 +26,8 @@
 #define COULD_NOT_CLOSE   251
 #define COULD_NOT_EXEC    252
 
+#define EV_EXEC_PRELOAD   "RTIPD_EXEC_PRELOAD"
+
 #define ARRAY_LEN(A)      (sizeof (A) / sizeof *(A))
 
 #define FOR_ARRAY(I, A)   for (size_t I = 0; I < ARRAY_LEN(A); ++I)
@@ -123,8 +126,6 @@ fdwrite_string(int fd, char const* str)
     return length == written;
 }
 
-static int fput_cstrlit(FILE* fout, char const* str);
-
 static bool
 check_output_string(
         char const *const file,
@@ -145,16 +146,10 @@ check_output_string(
     if (strcmp(out, expected)) {
         rtipd_test_log_check(false, file, line);
 
-        fprintf(stderr, "  reason: %s had mismatch in %s\n",
-                context, descr);
-
-        fprintf(stderr, "  have: ");
-        fput_cstrlit(stderr, out);
-        fprintf(stderr, "\n");
-
-        fprintf(stderr, "  want: ");
-        fput_cstrlit(stderr, expected);
-        fprintf(stderr, "\n");
+        struct buffer msg = {0};
+        bprintf(&msg, "  reason: %s had mismatch in %s\n", context, descr);
+        bput_string_mismatch(&msg, out, NULL, expected, NULL);
+        eprint_buffer(&msg);
 
         free(out);
         return false;
@@ -172,6 +167,11 @@ child_exec(fd_set_t* fd, const char* const argv[])
         if ( close(fd->a[i]) < 0 ) return COULD_NOT_CLOSE;
     }
 
+    // Lets the programs under test run with a preloaded library (such
+    // as libipd_preload.so) without preloading it into the test itself.
+    char const* preload = getenv(EV_EXEC_PRELOAD);
+    if (preload && *preload) setenv("LD_PRELOAD", preload, 1);
+
     execvp(argv[0], (char**)argv);
 
     return COULD_NOT_EXEC;
@@ -303,54 +303,6 @@ void libipd_do_check_command(
     do_check_exec(file, line, "CHECK_COMMAND", argv, in, out, err, code);
 }
 
-#define PUT(C) \
-    do { \
-        if (fputc(C, fout) < 0) return EOF; \
-        else ++count; \
-    } while (false)
-
-static int fput_cstrlit(FILE* fout, char const* str)
-{
-    size_t count = 0;
-
-    PUT('"');
-
-    char c;
-
-    while ( (c = *str++) ) {
-        switch (c) {
-        case '\\': case '\"':
-            PUT('\\'); PUT(c); break;
-        case '\a':
-            PUT('\\'); PUT('a'); break;
-        case '\b':
-            PUT('\\'); PUT('b'); break;
-        case '\f':
-            PUT('\\'); PUT('f'); break;
-        case '\n':
-            PUT('\\'); PUT('n'); break;
-        case '\r':
-            PUT('\\'); PUT('r'); break;
-        case '\t':
-            PUT('\\'); PUT('t'); break;
-        case '\v':
-            PUT('\\'); PUT('v'); break;
-        default:
-            if (isgraph(c) || c == ' ') {
-                PUT(c);
-            } else {
-                int res = fprintf(fout, "\\x%02x", c);
-                if (res < 0) return EOF;
-                else count += res;
-            }
-        }
-    }
-
-    PUT('"');
-
-    return count;
-}
-
 #else
 
 void* program_test_rt_needs_to_define_something____;
@@ -0,0 +1,126 @@
+#define _XOPEN_SOURCE 700
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "rt_env.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+noreturn void
+rtipd_bad_env_var(char const* name, char const* value)
+{
+    fprintf(stderr, "rtipd_alloc: could not understand %s value: ‘%s’\n",
+            name, value);
+    exit(254);
+}
+
+bool
+rtipd_env_size(char const* const name, size_t* const out)
+{
+    char *const original = getenv(name),
+         *begin = original,
+         *end;
+    unsigned long size;
+
+    if (!begin) return false;
+
+    while (isspace(*begin)) ++begin;
+    if (!*begin) return false;
+
+    size = strtoul(begin, &end, 10);
+    if (begin == end)
+        rtipd_bad_env_var(name, original);
+
+    while (isspace(*end)) ++end;
+
+    switch (*end) {
+    case 'B': case 'b': case 0:
+        *out = size;
+        return true;
+
+    case 'K': case 'k':
+        *out = size << 10;
+        return true;
+
+    case 'M': case 'm':
+        *out = size << 20;
+        return true;
+
+    case 'G': case 'g':
+        *out = size << 30;
+        return true;
+
+    default:
+        rtipd_bad_env_var(name, original);
+    }
+}
+
+// Returns the value of `name` with leading space skipped, or NULL if
+// it's unset or blank.
+static char const*
+env_value(char const* name)
+{
+    char const* value = getenv(name);
+    if (!value) return NULL;
+
+    while (isspace((unsigned char)*value)) ++value;
+    return *value ? value : NULL;
+}
+
+bool
+rtipd_env_ulong(char const* const name, unsigned long* const out)
+{
+    char const* value = env_value(name);
+    char* end;
+
+    if (!value) return false;
+
+    *out = strtoul(value, &end, 10);
+    while (isspace((unsigned char)*end)) ++end;
+    if (end == value || *end)
+        rtipd_bad_env_var(name, getenv(name));
+
+    return true;
+}
+
+bool
+rtipd_env_double(char const* const name, double* const out)
+{
+    char const* value = env_value(name);
+    char* end;
+
+    if (!value) return false;
+
+    *out = strtod(value, &end);
+    while (isspace((unsigned char)*end)) ++end;
+    if (end == value || *end)
+        rtipd_bad_env_var(name, getenv(name));
+
+    return true;
+}
+
+FILE*
+rtipd_open_destination(char const* dst, char const* mode)
+{
+    if (!dst || !*dst) {
+        return NULL;
+    } else if (dst[0] == '&' && dst[1] != 0) {
+        char* endptr;
+        long fd = strtol(&dst[1], &endptr, 10);
+        if (*endptr == 0 && 0 <= fd && fd <= (long)INT_MAX) {
+            return fdopen((int)fd, mode);
+        }
+        return NULL;
+    } else {
+        return fopen(dst, mode);
+    }
+}
+
+FILE*
+rtipd_env_open(char const* name, char const* mode)
+{
+    return rtipd_open_destination(getenv(name), mode);
+}
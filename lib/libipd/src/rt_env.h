@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdnoreturn.h>
+
+// Helpers for the runtime's environment variables.
+
+// Complains about the value of environment variable `name` and exits.
+noreturn void rtipd_bad_env_var(char const* name, char const* value);
+
+// Parses environment variable `name` as a size in bytes, optionally
+// followed by B, K, M, or G. Returns false if it's unset or blank, and
+// exits if it's malformed.
+bool rtipd_env_size(char const* name, size_t* out);
+
+// Like `rtipd_env_size`, but for a plain number, or a real number.
+bool rtipd_env_ulong(char const* name, unsigned long* out);
+bool rtipd_env_double(char const* name, double* out);
+
+// Opens the output destination named by environment variable `name`,
+// which may be a file name or `&n` for file descriptor `n`. Returns
+// NULL if it's unset or can't be opened.
+FILE* rtipd_env_open(char const* name, char const* mode);
+
+// Like `rtipd_env_open`, but for a destination that's already in hand.
+FILE* rtipd_open_destination(char const* dst, char const* mode);
@@ -0,0 +1,11 @@
+// The `main` function for test programs that define their tests with
+// TEST and don't define `main` themselves. Since it's alone in its
+// object file, the linker takes it from the library only when nothing
+// else defines `main`.
+
+#include "libipd_test.h"
+
+int main(int argc, char* argv[])
+{
+    return run_registered_tests(argc, argv);
+}
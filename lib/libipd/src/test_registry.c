@@ -0,0 +1,235 @@
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#include "libipd_test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Registered tests, in the order they were registered, which is the
+// order they're defined in within each file.
+static struct libipd_test_case* first_test = NULL;
+static struct libipd_test_case* last_test  = NULL;
+
+void libipd_register_test(struct libipd_test_case* test)
+{
+    test->next = NULL;
+
+    if (last_test)
+        last_test->next = test;
+    else
+        first_test = test;
+
+    last_test = test;
+}
+
+///
+/// MATCHING
+///
+
+// Whether `s` matches the shell-style `pattern`, in which `*` matches
+// any sequence of characters and `?` matches any one character.
+static bool glob_match(char const* pattern, char const* s, size_t s_len)
+{
+    char const* end = s + s_len;
+
+    // Where to resume after the most recent `*`, if the rest fails.
+    char const* star_pattern = NULL;
+    char const* star_s       = NULL;
+
+    while (s < end) {
+        if (*pattern == '*') {
+            star_pattern = ++pattern;
+            star_s       = s;
+        } else if (*pattern && (*pattern == '?' || *pattern == *s)) {
+            ++pattern;
+            ++s;
+        } else if (star_pattern) {
+            pattern = star_pattern;
+            s       = ++star_s;
+        } else {
+            return false;
+        }
+    }
+
+    while (*pattern == '*') ++pattern;
+    return !*pattern;
+}
+
+static bool is_tag_separator(char c)
+{
+    return c == ' ' || c == ',' || c == '\t';
+}
+
+// Whether any of the tags in `tags` matches `pattern`.
+static bool has_tag(char const* tags, char const* pattern)
+{
+    while (*tags) {
+        while (is_tag_separator(*tags)) ++tags;
+
+        size_t len = 0;
+        while (tags[len] && !is_tag_separator(tags[len])) ++len;
+
+        if (len && glob_match(pattern, tags, len)) return true;
+
+        tags += len;
+    }
+
+    return false;
+}
+
+///
+/// SELECTION
+///
+
+// What the command line asks for.
+struct selection
+{
+    bool   list;
+    int    argc;
+    char** argv;
+    size_t name_includes;       // how many PATTERNs don't start with `!`
+    size_t tag_includes;        // how many TAGs don't start with `!`
+};
+
+static char const* tag_option(char const* arg)
+{
+    static char const prefix[] = "--tag=";
+    size_t const len = sizeof prefix - 1;
+    return strncmp(arg, prefix, len) == 0 ? arg + len : NULL;
+}
+
+// Whether `test` is selected by the arguments in `sel`. A test is
+// selected if it matches some include (or there are none) of each
+// kind, and no exclude.
+static bool is_selected(struct selection const* sel,
+                        struct libipd_test_case const* test)
+{
+    bool name_included = sel->name_includes == 0;
+    bool tag_included  = sel->tag_includes == 0;
+
+    for (int i = 1; i < sel->argc; ++i) {
+        char const* arg = sel->argv[i];
+        char const* tag = tag_option(arg);
+
+        if (tag) {
+            if (*tag == '!') {
+                if (has_tag(test->tags, tag + 1)) return false;
+            } else if (has_tag(test->tags, tag)) {
+                tag_included = true;
+            }
+        } else if (*arg == '!') {
+            if (glob_match(arg + 1, test->name, strlen(test->name)))
+                return false;
+        } else if (*arg != '-') {
+            if (glob_match(arg, test->name, strlen(test->name)))
+                name_included = true;
+        }
+    }
+
+    return name_included && tag_included;
+}
+
+static void print_usage(FILE* fout, char const* program)
+{
+    fprintf(fout,
+            "Usage: %s [--list] [--tag=[!]TAG]... [[!]PATTERN]...\n"
+            "\n"
+            "Runs the tests whose names match a PATTERN and that have a\n"
+            "tag matching a TAG (or all of them, if none are given), but\n"
+            "not those matching a !PATTERN or with a tag matching a !TAG.\n"
+            "PATTERNs and TAGs may use the wildcards * and ?.\n"
+            "\n"
+            "  --list     list the selected tests instead of running them\n"
+            "  --help     show this message\n",
+            program);
+}
+
+// Fills in `sel` from the command line, returning whether it made sense.
+static bool parse_selection(struct selection* sel, int argc, char* argv[])
+{
+    *sel = (struct selection) {.argc = argc, .argv = argv};
+
+    for (int i = 1; i < argc; ++i) {
+        char const* arg = argv[i];
+        char const* tag = tag_option(arg);
+
+        if (strcmp(arg, "--list") == 0) {
+            sel->list = true;
+        } else if (tag) {
+            if (!*tag || (*tag == '!' && !tag[1])) {
+                fprintf(stderr, "%s: empty tag in ‘%s’\n", argv[0], arg);
+                return false;
+            }
+            if (*tag != '!') ++sel->tag_includes;
+        } else if (*arg == '-') {
+            fprintf(stderr, "%s: unknown option ‘%s’\n", argv[0], arg);
+            return false;
+        } else {
+            if (*arg != '!') ++sel->name_includes;
+        }
+    }
+
+    return true;
+}
+
+///
+/// RUNNING
+///
+
+static void list_test(struct libipd_test_case const* test)
+{
+    printf("%s", test->name);
+    if (*test->tags) printf("  [%s]", test->tags);
+    printf("  %s:%d\n", test->file, test->line);
+}
+
+int run_registered_tests(int argc, char* argv[])
+{
+    // In case we're called as run_registered_tests(0, NULL).
+    static char  program[]      = "test";
+    static char* default_argv[] = {program, NULL};
+    if (argc < 1 || !argv) {
+        argc = 1;
+        argv = default_argv;
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            print_usage(stdout, argv[0]);
+            return 0;
+        }
+    }
+
+    struct selection sel;
+    if (!parse_selection(&sel, argc, argv)) {
+        print_usage(stderr, argv[0]);
+        return 2;
+    }
+
+    size_t selected = 0;
+
+    for (struct libipd_test_case* test = first_test; test; test = test->next)
+    {
+        if (!is_selected(&sel, test)) continue;
+
+        ++selected;
+
+        if (sel.list)
+            list_test(test);
+        else
+            libipd_do_run_test(test->test_fn, test->name,
+                               test->file, test->line);
+    }
+
+    // Asking for tests that don't exist is probably a typo, which we
+    // shouldn't let pass as success.
+    if (!selected && first_test && argc > 1) {
+        fprintf(stderr, "%s: no tests selected\n", argv[0]);
+        return 2;
+    }
+
+    if (!sel.list) start_testing();
+
+    return 0;
+}
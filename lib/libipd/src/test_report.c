@@ -0,0 +1,413 @@
+#define LIBIPD_RAW_ALLOC
+#define LIBIPD_RAW_EXIT
+
+#define _XOPEN_SOURCE 700
+
+#include "test_report.h"
+#include "rt_env.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EV_REPORT  "RTIPD_REPORT"
+
+enum report_format
+{
+    REPORT_JUNIT,
+    REPORT_TAP,
+    REPORT_JSONL,
+};
+
+static FILE*              report_out    = NULL;
+static bool               report_is_fd  = false;   // from `&N`
+static bool               report_child  = false;   // after detaching
+static enum report_format report_format = REPORT_JSONL;
+static unsigned long      report_count  = 0;
+
+///
+/// ESCAPING
+///
+
+static void put_xml_escaped(char const* s)
+{
+    for ( ; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        switch (c) {
+        case '&':  fputs("&amp;", report_out);  break;
+        case '<':  fputs("&lt;", report_out);   break;
+        case '>':  fputs("&gt;", report_out);   break;
+        case '"':  fputs("&quot;", report_out); break;
+        case '\'': fputs("&apos;", report_out); break;
+        default:
+            // XML 1.0 has no way to write most control characters.
+            if (c < 0x20 && c != '\t' && c != '\n' && c != '\r')
+                fputc('?', report_out);
+            else
+                fputc(c, report_out);
+        }
+    }
+}
+
+// Writes `s` as a JSON string literal, which YAML takes too.
+static void put_json_string(char const* s)
+{
+    fputc('"', report_out);
+
+    for ( ; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        switch (c) {
+        case '"':  fputs("\\\"", report_out); break;
+        case '\\': fputs("\\\\", report_out); break;
+        case '\n': fputs("\\n", report_out);  break;
+        case '\r': fputs("\\r", report_out);  break;
+        case '\t': fputs("\\t", report_out);  break;
+        default:
+            if (c < 0x20)
+                fprintf(report_out, "\\u%04x", c);
+            else
+                fputc(c, report_out);
+        }
+    }
+
+    fputc('"', report_out);
+}
+
+// The file name without its directory or extension, which JUnit
+// consumers use to group tests.
+static void put_xml_classname(char const* file)
+{
+    char const* base = strrchr(file, '/');
+    base = base ? base + 1 : file;
+
+    char const* dot = strrchr(base, '.');
+    size_t len = dot && dot != base ? (size_t)(dot - base) : strlen(base);
+
+    char buf[256];
+    if (len >= sizeof buf) len = sizeof buf - 1;
+    memcpy(buf, base, len);
+    buf[len] = 0;
+
+    put_xml_escaped(buf);
+}
+
+// Describes why a test didn't pass, as in "2 of 5 checks failed, first
+// at foo.c:30".
+static void describe_failure(char* buf, size_t size,
+                             struct test_report const* test)
+{
+    int n = 0;
+
+    if (test->message)
+        n = snprintf(buf, size, "%s", test->message);
+    else if (test->failed_checks)
+        n = snprintf(buf, size, "%u of %u checks failed",
+                     test->failed_checks, test->checks);
+    else
+        n = snprintf(buf, size, "%s", test->outcome);
+
+    if (test->failure_file && n >= 0 && (size_t)n < size)
+        snprintf(buf + n, size - (size_t)n, ", first at %s:%d",
+                 test->failure_file, test->failure_line);
+}
+
+///
+/// JUNIT XML
+///
+
+static void junit_start(void)
+{
+    fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n", report_out);
+    fputs("<testsuite name=\"libipd\">\n", report_out);
+}
+
+static void junit_testcase_start(char const* name,
+                                 char const* file,
+                                 int line,
+                                 double seconds)
+{
+    fputs("  <testcase classname=\"", report_out);
+    put_xml_classname(file);
+    fputs("\" name=\"", report_out);
+    put_xml_escaped(name);
+    fputs("\" file=\"", report_out);
+    put_xml_escaped(file);
+    fprintf(report_out, "\" line=\"%d\" time=\"%.6f\"", line, seconds);
+}
+
+static void junit_test(struct test_report const* test)
+{
+    junit_testcase_start(test->name, test->file, test->line, test->seconds);
+
+    if (strcmp(test->outcome, "passed") == 0) {
+        fputs("/>\n", report_out);
+        return;
+    }
+
+    // Failed checks are failures; anything that kept the test from
+    // finishing is an error.
+    char const* element = strcmp(test->outcome, "failed") == 0
+        ? "failure" : "error";
+    char message[512];
+    describe_failure(message, sizeof message, test);
+
+    fprintf(report_out, ">\n    <%s type=\"", element);
+    put_xml_escaped(test->outcome);
+    fputs("\" message=\"", report_out);
+    put_xml_escaped(message);
+    fputs("\"/>\n  </testcase>\n", report_out);
+}
+
+static void junit_check(bool passed, char const* message,
+                        char const* file, int line)
+{
+    char name[256];
+    snprintf(name, sizeof name, "CHECK at %s:%d", file, line);
+    junit_testcase_start(name, file, line, 0);
+
+    if (passed) {
+        fputs("/>\n", report_out);
+        return;
+    }
+
+    fputs(">\n    <failure type=\"failed\" message=\"", report_out);
+    put_xml_escaped(message ? message : "check failed");
+    fputs("\"/>\n  </testcase>\n", report_out);
+}
+
+static void junit_finish(unsigned passed, unsigned failed, unsigned errors)
+{
+    fprintf(report_out, "  <!-- %u passed, %u failed, %u errors -->\n",
+            passed, failed, errors);
+    fputs("</testsuite>\n", report_out);
+}
+
+///
+/// TAP
+///
+
+static void tap_start(void)
+{
+    fputs("TAP version 13\n", report_out);
+}
+
+static void tap_test(struct test_report const* test)
+{
+    bool passed = strcmp(test->outcome, "passed") == 0;
+
+    fprintf(report_out, "%s %lu - ", passed ? "ok" : "not ok", report_count);
+    fputs(test->name, report_out);
+    fputs("\n  ---\n  outcome: ", report_out);
+    put_json_string(test->outcome);
+    fputs("\n  file: ", report_out);
+    put_json_string(test->file);
+    fprintf(report_out, "\n  line: %d\n  duration_ms: %.3f\n"
+            "  checks: %u\n  failed_checks: %u\n"
+            "  allocations: %zu\n  unfreed_bytes: %zu\n",
+            test->line, test->seconds * 1000,
+            test->checks, test->failed_checks,
+            test->allocations, test->unfreed_bytes);
+
+    if (!passed) {
+        char message[512];
+        describe_failure(message, sizeof message, test);
+        fputs("  message: ", report_out);
+        put_json_string(message);
+        fputc('\n', report_out);
+    }
+
+    fputs("  ...\n", report_out);
+}
+
+static void tap_check(bool passed, char const* message,
+                      char const* file, int line)
+{
+    fprintf(report_out, "%s %lu - CHECK at %s:%d\n",
+            passed ? "ok" : "not ok", report_count, file, line);
+
+    if (!passed && message) {
+        fputs("  ---\n  message: ", report_out);
+        put_json_string(message);
+        fputs("\n  ...\n", report_out);
+    }
+}
+
+static void tap_finish(unsigned passed, unsigned failed, unsigned errors)
+{
+    fprintf(report_out, "1..%lu\n", report_count);
+    fprintf(report_out, "# %u passed, %u failed, %u errors\n",
+            passed, failed, errors);
+}
+
+///
+/// JSON LINES
+///
+
+static void jsonl_test(struct test_report const* test)
+{
+    fputs("{\"type\":\"test\",\"name\":", report_out);
+    put_json_string(test->name);
+    fputs(",\"file\":", report_out);
+    put_json_string(test->file);
+    fprintf(report_out, ",\"line\":%d,\"outcome\":", test->line);
+    put_json_string(test->outcome);
+    fprintf(report_out,
+            ",\"seconds\":%.6f,\"checks\":%u,\"failed_checks\":%u"
+            ",\"allocations\":%zu,\"unfreed_bytes\":%zu",
+            test->seconds, test->checks, test->failed_checks,
+            test->allocations, test->unfreed_bytes);
+
+    if (test->message) {
+        fputs(",\"message\":", report_out);
+        put_json_string(test->message);
+    }
+
+    if (test->failure_file) {
+        fputs(",\"failure_file\":", report_out);
+        put_json_string(test->failure_file);
+        fprintf(report_out, ",\"failure_line\":%d", test->failure_line);
+    }
+
+    fputs("}\n", report_out);
+}
+
+static void jsonl_check(bool passed, char const* message,
+                        char const* file, int line, bool in_test)
+{
+    fputs("{\"type\":\"check\",\"file\":", report_out);
+    put_json_string(file);
+    fprintf(report_out, ",\"line\":%d,\"passed\":%s",
+            line, passed ? "true" : "false");
+
+    if (in_test) fputs(",\"in_test\":true", report_out);
+
+    if (message) {
+        fputs(",\"message\":", report_out);
+        put_json_string(message);
+    }
+
+    fputs("}\n", report_out);
+}
+
+static void jsonl_finish(unsigned passed, unsigned failed, unsigned errors)
+{
+    fprintf(report_out,
+            "{\"type\":\"summary\",\"passed\":%u,\"failed\":%u"
+            ",\"errors\":%u}\n",
+            passed, failed, errors);
+}
+
+///
+/// ENTRY POINTS
+///
+
+bool test_report_init(void)
+{
+    char const* value = getenv(EV_REPORT);
+    if (!value || !*value) return false;
+
+    char const* colon = strchr(value, ':');
+    if (!colon) rtipd_bad_env_var(EV_REPORT, value);
+
+    size_t len = (size_t)(colon - value);
+    if (len == 5 && strncmp(value, "junit", len) == 0)
+        report_format = REPORT_JUNIT;
+    else if (len == 3 && strncmp(value, "tap", len) == 0)
+        report_format = REPORT_TAP;
+    else if (len == 5 && strncmp(value, "jsonl", len) == 0)
+        report_format = REPORT_JSONL;
+    else
+        rtipd_bad_env_var(EV_REPORT, value);
+
+    report_out = rtipd_open_destination(colon + 1, "w");
+    if (!report_out) {
+        fprintf(stderr, "libipd: could not open test report ‘%s’: %s\n",
+                colon + 1, strerror(errno));
+        return false;
+    }
+
+    report_is_fd = colon[1] == '&';
+
+    // The report is ours, so programs we run shouldn't write over it.
+    unsetenv(EV_REPORT);
+
+    switch (report_format) {
+    case REPORT_JUNIT: junit_start(); break;
+    case REPORT_TAP:   tap_start();   break;
+    case REPORT_JSONL:                break;
+    }
+
+    fflush(report_out);
+    return true;
+}
+
+void test_report_test(struct test_report const* test)
+{
+    if (!report_out || report_child) return;
+
+    ++report_count;
+
+    switch (report_format) {
+    case REPORT_JUNIT: junit_test(test); break;
+    case REPORT_TAP:   tap_test(test);   break;
+    case REPORT_JSONL: jsonl_test(test); break;
+    }
+
+    fflush(report_out);
+}
+
+void test_report_check(bool passed,
+                       char const* message,
+                       char const* file,
+                       int line,
+                       bool in_test)
+{
+    if (!report_out) return;
+
+    // JUnit and TAP have nowhere to put a check inside a test but in
+    // the test's own record.
+    if (in_test && report_format != REPORT_JSONL) return;
+    if (!in_test && report_child) return;
+
+    ++report_count;
+
+    switch (report_format) {
+    case REPORT_JUNIT: junit_check(passed, message, file, line); break;
+    case REPORT_TAP:   tap_check(passed, message, file, line);   break;
+    case REPORT_JSONL:
+        jsonl_check(passed, message, file, line, in_test);
+        break;
+    }
+
+    fflush(report_out);
+}
+
+void test_report_finish(unsigned passed, unsigned failed, unsigned errors)
+{
+    if (!report_out || report_child) return;
+
+    switch (report_format) {
+    case REPORT_JUNIT: junit_finish(passed, failed, errors); break;
+    case REPORT_TAP:   tap_finish(passed, failed, errors);   break;
+    case REPORT_JSONL: jsonl_finish(passed, failed, errors); break;
+    }
+
+    // Closing a stream from `&1` would close stdout too, before we
+    // print the totals there.
+    if (report_is_fd)
+        fflush(report_out);
+    else
+        fclose(report_out);
+
+    report_out = NULL;
+}
+
+void test_report_detach(bool keep_checks)
+{
+    // Everything was flushed as it was written, so the child has nothing
+    // buffered to write twice. We don't close it, since it may share a
+    // descriptor, such as stdout, with the test.
+    report_child = true;
+    if (!keep_checks) report_out = NULL;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Machine-readable test results, for test_rt.c. When the RTIPD_REPORT
+// environment variable names a format and a destination (as in
+// `junit:results.xml`, `tap:&3`, or `jsonl:results.jsonl`), each test
+// and each check outside of a test (or, in JSONL, inside one too) is
+// written there as soon as it's reported. Nothing is kept but the
+// number of records so far, so suites of any size take the same memory.
+
+// How a test went, as RUN_TEST reports it.
+struct test_report
+{
+    char const* name;           // source of the test function expression
+    char const* file;           // where RUN_TEST was called
+    int         line;
+    char const* outcome;        // "passed", "failed", "errored", ...
+    char const* message;        // why it didn't pass, or NULL
+    double      seconds;        // wall-clock time
+    unsigned    checks;         // checks it ran
+    unsigned    failed_checks;  // checks that failed or errored
+    char const* failure_file;   // where the first of those was, or NULL
+    int         failure_line;
+    size_t      allocations;
+    size_t      unfreed_bytes;
+};
+
+// Reads the environment and opens the report, if any, returning whether
+// there is one. Call once, before reporting anything.
+bool test_report_init(void);
+
+// Records a test.
+void test_report_test(struct test_report const*);
+
+// Records a check. `message` may be NULL. Checks made `in_test` count
+// towards the test's record, so only JSONL records them on their own.
+void test_report_check(bool passed,
+                       char const* message,
+                       char const* file,
+                       int line,
+                       bool in_test);
+
+// Ends the report with the totals. Call once, at exit.
+void test_report_finish(unsigned passed, unsigned failed, unsigned errors);
+
+// In a child process that runs a test, stops reporting tests and
+// never ends the report, which belongs to the parent. If `keep_checks`
+// then the test's own checks are still recorded, through the stream
+// the child shares with its parent.
+void test_report_detach(bool keep_checks);
@@ -2,19 +2,37 @@
 #define LIBIPD_RAW_EXIT
 
 #define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE     // for wait4(2)
 
 #include "libipd_test.h"
 #include "libipd_io.h"
+#include "ipd_alloc_limit.h"
+#include "ipd_alloc_stats.h"
+#include "alloc_rt.h"
+#include "check_format.h"
+#include "rt_env.h"
+#include "test_report.h"
 #include "test_reporting.h"
 
 #include <ctype.h>
 #include <errno.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #ifdef LIBIPD_HAS_POSIX
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <setjmp.h>
+#   include <signal.h>
+#   include <sys/mman.h>
+#   include <sys/resource.h>
+#   include <sys/time.h>
 #   include <sys/types.h>
 #   include <sys/wait.h>
 #endif
@@ -24,16 +42,63 @@
 #define GREEN   "\33[0;32m"
 #define RVRED   "\33[0;41;37m"
 
+#define EV_FAIL_ON_LEAK  "RTIPD_FAIL_ON_LEAK"
+#define EV_JOBS          "RTIPD_JOBS"
+#define EV_TIMEOUT       "RTIPD_TEST_TIMEOUT"
+#define EV_RESOURCES     "RTIPD_TEST_RESOURCES"
+#define EV_SUMMARY       "RTIPD_TEST_SUMMARY"
+#define EV_IN_PROCESS    "RTIPD_TEST_IN_PROCESS"
+
 static bool atexit_installed = false;
 static bool tests_enabled    = false;
 static bool has_run_tests    = false;
+static bool fail_on_leak     = false;
+static bool show_resources   = false;
+
+// Whether RUN_TEST calls tests in this process; see IN-PROCESS TESTS.
+static bool in_process       = false;
+
+// Whether we're in the process running a test, as opposed to the one
+// reporting on tests.
+static bool in_test          = false;
 
 static unsigned pass_count   = 0;
 static unsigned fail_count   = 0;
 static unsigned error_count  = 0;
 
+// The checks made by tests that RUN_TEST has reported on, including
+// those that crashed partway through.
+static size_t   test_checks_passed = 0;
+static size_t   test_checks_failed = 0;
+
+// How many tests RUN_TEST may have running at once; see PARALLEL TESTS.
+static size_t   test_jobs    = 1;
+
+// How many seconds RUN_TEST gives each test, or 0 for no limit.
+static double   test_timeout = 0;
+
+static void finish_parallel_tests(void);
+static void print_test_summary(void);
+static void set_summary_size(size_t);
+static void forget_test_records(void);
+static void note_check(bool passed, char const* message,
+                       char const* file, int line);
+
+static size_t processor_count(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n > 0) return (size_t)n;
+#endif
+    return 1;
+}
+
 static void print_test_results(void)
 {
+    finish_parallel_tests();
+    print_test_summary();
+    test_report_finish(pass_count, fail_count, error_count);
+
     unsigned check_count = pass_count + fail_count + error_count;
     FILE* fout = fail_count || error_count ? stderr : stdout;
     bool const use_color = isatty(fileno(fout));
@@ -77,6 +142,13 @@ static void print_test_results(void)
         fprintf(fout, "%d of %d %ss passed.\n",
                 pass_count, check_count, label_style);
     }
+
+    size_t test_checks = test_checks_passed + test_checks_failed;
+    if (has_run_tests && test_checks) {
+        fprintf(fout, "(%zu of %zu check%s in those tests passed.)\n",
+                test_checks_passed, test_checks,
+                test_checks == 1 ? "" : "s");
+    }
 }
 
 static void exit_hook_function(void)
@@ -95,11 +167,32 @@ static void install_atexit(void)
 {
     if (atexit_installed) return;
 
+    unsigned long leaks, jobs, resources, summary, same_process;
+    if (rtipd_env_ulong(EV_FAIL_ON_LEAK, &leaks))
+        fail_on_leak = leaks != 0;
+    if (rtipd_env_ulong(EV_RESOURCES, &resources))
+        show_resources = resources != 0;
+    if (rtipd_env_ulong(EV_JOBS, &jobs))
+        test_jobs = jobs ? jobs : processor_count();
+    if (rtipd_env_double(EV_TIMEOUT, &test_timeout) && test_timeout < 0)
+        rtipd_bad_env_var(EV_TIMEOUT, getenv(EV_TIMEOUT));
+    if (rtipd_env_ulong(EV_SUMMARY, &summary))
+        set_summary_size(summary);
+    if (rtipd_env_ulong(EV_IN_PROCESS, &same_process))
+        in_process = same_process != 0;
+
+    test_report_init();
+
     if (atexit(&exit_hook_function)) {
         perror("atexit");
         exit(10);
     }
 
+    // Before any test forks, so that the heap profile and timeline
+    // belong to us rather than to each child. After our exit handler,
+    // so that theirs run first, since ours may not return.
+    rtipd_alloc_init();
+
     atexit_installed = true;
 }
 
@@ -109,11 +202,53 @@ void start_testing(void)
     tests_enabled = true;
 }
 
+void fail_tests_that_leak(bool enabled)
+{
+    start_testing();
+    finish_parallel_tests();
+    fail_on_leak = enabled;
+}
+
+void run_tests_in_parallel(size_t jobs)
+{
+    start_testing();
+    finish_parallel_tests();
+    test_jobs = jobs ? jobs : processor_count();
+}
+
+void run_tests_in_process(bool enabled)
+{
+    start_testing();
+    finish_parallel_tests();
+    in_process = enabled;
+}
+
+void set_test_timeout(double seconds)
+{
+    start_testing();
+    test_timeout = seconds > 0 ? seconds : 0;
+}
+
+void show_test_resources(bool enabled)
+{
+    start_testing();
+    finish_parallel_tests();
+    show_resources = enabled;
+}
+
+void summarize_test_resources(size_t n)
+{
+    start_testing();
+    finish_parallel_tests();
+    set_summary_size(n);
+}
+
 #define log_check rtipd_test_log_check
 
 bool rtipd_test_log_check(bool condition, const char* file, int line)
 {
     start_testing();
+    finish_parallel_tests();
 
     if (condition) {
         ++pass_count;
@@ -122,6 +257,7 @@ bool rtipd_test_log_check(bool condition, const char* file, int line)
         eprintf("\nCheck failed (%s:%d):\n", file, line);
     }
 
+    note_check(condition, NULL, file, line);
     return condition;
 }
 
@@ -132,6 +268,7 @@ void rtipd_test_log_error(
         char const* const message)
 {
     start_testing();
+    finish_parallel_tests();
 
     ++error_count;
     fprintf(stderr, "\nError in %s (%s:%d)", context, file, line);
@@ -141,6 +278,8 @@ void rtipd_test_log_error(
     } else {
         fprintf(stderr, "\n");
     }
+
+    note_check(false, message ? message : context, file, line);
 }
 
 void rtipd_test_log_perror(
@@ -152,96 +291,424 @@ void rtipd_test_log_perror(
                          errno ? strerror(errno) : NULL);
 }
 
-static const char* c_escape_of_char(char c) {
-    switch (c) {
-        case '\a': return "a";
-        case '\b': return "b";
-        case '\f': return "f";
-        case '\n': return "n";
-        case '\r': return "r";
-        case '\t': return "t";
-        case '\v': return "v";
-        case '\\': return "\\";
-        default:   return NULL;
-    }
+static void color_word(const char* color, const char* word)
+{
+    printf("%s%s%s.\n",
+            color ? color : "",
+            word,
+            color ? NORMAL : "");
+    fflush(stdout);
 }
 
-static void eprintf_escaped_char(char c, char quote)
+// Formats a duration into `buf`, as milliseconds if it's short.
+static char const* format_duration(char buf[static 32], double seconds)
 {
-    const char* escaped = c_escape_of_char(c);
-
-    if (escaped)
-        eprintf("\\%s", escaped);
-    else if (c == quote)
-        eprintf("\\%c", c);
-    else if (isgraph(c) || c == ' ')
-        eprintf("%c", c);
+    if (seconds < 1)
+        snprintf(buf, 32, "%.0f ms", seconds * 1000);
     else
-        eprintf("\\x%02x", (unsigned char) c);
-}
-
-static void eprintf_char_literal(char c) {
-    if (c) {
-        eprintf("'");
-        eprintf_escaped_char(c, '\'');
-        eprintf("'");
-    } else {
-        eprintf("0");
-    }
+        snprintf(buf, 32, "%.2f s", seconds);
+    return buf;
 }
 
-static void eprintf_string_literal(const char* s) {
-    if (s) {
-        eprintf("\"");
-        for ( ; *s; ++s) eprintf_escaped_char(*s, '"');
-        eprintf("\"");
-    } else {
-        eprintf("(null)");
-    }
+// Formats a size given in KiB into `buf`, in whatever unit suits it.
+static char const* format_kb(char buf[static 32], size_t kb)
+{
+    if (kb < 1024)
+        snprintf(buf, 32, "%zu KB", kb);
+    else if (kb < 1024 * 1024)
+        snprintf(buf, 32, "%.1f MB", kb / 1024.0);
+    else
+        snprintf(buf, 32, "%.2f GB", kb / (1024.0 * 1024));
+    return buf;
 }
 
-static void color_word(const char* color, const char* word)
+// Like `color_word`, but followed by a duration, as in “passed in 12
+// ms.”
+static void color_word_time(const char* color, const char* word,
+                            const char* preposition, double seconds)
 {
-    printf("%s%s%s.\n",
+    char duration[32];
+    printf("%s%s%s %s %s.\n",
             color ? color : "",
             word,
-            color ? NORMAL : "");
+            color ? NORMAL : "",
+            preposition,
+            format_duration(duration, seconds));
     fflush(stdout);
 }
 
+// Seconds since some fixed point, for timing tests.
+static double now_seconds(void)
+{
+    struct timespec ts;
+#ifdef LIBIPD_HAS_POSIX
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 enum test_outcome
 {
     OUTCOME_PASS = 0,
     OUTCOME_FAIL = 1,
     OUTCOME_ERROR = 2,
     OUTCOME_CRASH,
+    OUTCOME_TIMEOUT,
     OUTCOME_OS_ERROR,
 };
 
+// What a test allocated, as seen by the allocation runtime in the
+// process that ran it.
+struct test_usage
+{
+    bool   reported;        // false if the test didn't finish
+    size_t allocations;     // calls to malloc, calloc, and realloc
+    size_t total_bytes;     // requested by those calls
+    size_t peak_bytes;      // most live at once, beyond the starting point
+    size_t unfreed_bytes;   // still live at the end, likewise
+};
+
+// Starts measuring a test's allocations, saving the starting point in
+// `*before`.
+static void start_usage(struct alloc_stats* before)
+{
+    alloc_stats_get(before);
+    alloc_stats_reset();
+}
+
+static void finish_usage(struct alloc_stats const* before,
+                         struct test_usage* usage)
+{
+    struct alloc_stats after;
+    alloc_stats_get(&after);
+
+    usage->reported      = true;
+    usage->allocations   = after.malloc_calls + after.calloc_calls +
+                           after.realloc_calls;
+    usage->total_bytes   = after.total_bytes;
+    usage->peak_bytes    = after.peak_bytes > before->live_bytes
+                           ? after.peak_bytes - before->live_bytes : 0;
+    usage->unfreed_bytes = after.live_bytes > before->live_bytes
+                           ? after.live_bytes - before->live_bytes : 0;
+}
+
+// What a test's checks found, as seen by the process that ran it. A
+// child process keeps these in memory it shares with its parent, so
+// they're up to date even if the test crashes.
+struct test_checks
+{
+    bool     reported;          // false if we don't know
+    unsigned passed;
+    unsigned failed;            // including errors
+    char     first_file[256];   // where the first failure was, or ""
+    int      first_line;
+};
+
+// The test's checks so far, while `in_test`.
+static struct test_checks* current_checks = NULL;
+
+// Counts a check (or an error, which counts as a failed check) for the
+// report: in a test, towards the test's totals, and otherwise on its
+// own.
+static void note_check(bool passed, char const* message,
+                       char const* file, int line)
+{
+    test_report_check(passed, message, file, line, in_test);
+    if (!in_test) return;
+
+    if (passed) {
+        ++current_checks->passed;
+        return;
+    }
+
+    if (!current_checks->failed++) {
+        snprintf(current_checks->first_file,
+                 sizeof current_checks->first_file, "%s", file);
+        current_checks->first_line = line;
+    }
+}
+
+// Starts counting checks for a test in `*checks`.
+static void start_checks(struct test_checks* checks)
+{
+    *checks        = (struct test_checks) {.reported = true};
+    current_checks = checks;
+    in_test        = true;
+}
+
+static void finish_checks(void)
+{
+    in_test        = false;
+    current_checks = NULL;
+}
+
+// What a test cost the system, as seen by wait4(2).
+struct test_resources
+{
+    bool   reported;        // false if we couldn't find out
+    double user_seconds;    // CPU time
+    double system_seconds;  // likewise
+    size_t max_rss_kb;      // most memory resident at once, in KiB
+    long   minor_faults;    // page faults without I/O
+    long   major_faults;    // page faults with I/O
+    long   voluntary_switches;
+    long   involuntary_switches;
+};
+
+// Everything RUN_TEST learns from running a test.
+struct test_result
+{
+    enum test_outcome     outcome;
+    int                   signal;       // that killed it, if it crashed
+    struct test_usage     usage;
+    struct test_checks    checks;
+    struct test_resources resources;
+    double                elapsed;      // wall-clock seconds
+    double                timeout;      // seconds allowed, or 0
+};
+
+static void print_usage(struct test_usage const* usage)
+{
+    if (!usage->reported) return;
+
+    if (!usage->allocations) {
+        printf("no allocations, ");
+        return;
+    }
+
+    printf("%zu allocation%s (%zu bytes, peak %zu",
+           usage->allocations, usage->allocations == 1 ? "" : "s",
+           usage->total_bytes, usage->peak_bytes);
+    if (usage->unfreed_bytes)
+        printf(", %zu unfreed", usage->unfreed_bytes);
+    printf("), ");
+}
+
+static void print_resources(struct test_resources const* resources)
+{
+    if (!resources->reported) return;
+
+    char user[32], system[32], rss[32];
+    printf("    cpu %s user, %s system; max RSS %s; "
+           "%ld page faults (%ld major); "
+           "%ld context switches (%ld involuntary)\n",
+           format_duration(user, resources->user_seconds),
+           format_duration(system, resources->system_seconds),
+           format_kb(rss, resources->max_rss_kb),
+           resources->minor_faults + resources->major_faults,
+           resources->major_faults,
+           resources->voluntary_switches + resources->involuntary_switches,
+           resources->involuntary_switches);
+    fflush(stdout);
+}
+
+#ifdef LIBIPD_HAS_POSIX
+static double timeval_seconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void get_resources(struct rusage const* ru,
+                          struct test_resources* resources)
+{
+    resources->reported             = true;
+    resources->user_seconds         = timeval_seconds(ru->ru_utime);
+    resources->system_seconds       = timeval_seconds(ru->ru_stime);
+#ifdef __APPLE__
+    // Bytes, not KiB.
+    resources->max_rss_kb           = (size_t)ru->ru_maxrss / 1024;
+#else
+    resources->max_rss_kb           = (size_t)ru->ru_maxrss;
+#endif
+    resources->minor_faults         = ru->ru_minflt;
+    resources->major_faults         = ru->ru_majflt;
+    resources->voluntary_switches   = ru->ru_nvcsw;
+    resources->involuntary_switches = ru->ru_nivcsw;
+}
+
+// Finds what this process used between getrusage(2) calls `before` and
+// `after`, except for max RSS, which can only be the process's so far.
+static void get_resources_between(struct rusage const* before,
+                                  struct rusage const* after,
+                                  struct test_resources* resources)
+{
+    struct test_resources start;
+    get_resources(before, &start);
+    get_resources(after, resources);
+
+    resources->user_seconds         -= start.user_seconds;
+    resources->system_seconds       -= start.system_seconds;
+    resources->minor_faults         -= start.minor_faults;
+    resources->major_faults         -= start.major_faults;
+    resources->voluntary_switches   -= start.voluntary_switches;
+    resources->involuntary_switches -= start.involuntary_switches;
+}
+#endif // LIBIPD_HAS_POSIX
+
 #ifdef LIBIPD_HAS_POSIX
+// Runs the test in what is presumably a child process, counting its
+// checks in `*checks` and returning how it went. If `report_checks` then
+// the report still gets them one by one, if its format takes them.
 static enum test_outcome
-call_test_function(void (*test_fn)(void))
+run_test_body(void (*test_fn)(void), struct test_checks* checks,
+              bool report_checks)
+{
+    pass_count = fail_count = error_count = 0;
+    forget_test_records();
+    test_report_detach(report_checks);
+    start_checks(checks);
+
+    test_fn();
+
+    // Don't run our exit handler in here.
+    tests_enabled = false;
+
+    if (error_count) return OUTCOME_ERROR;
+    else if (fail_count) return OUTCOME_FAIL;
+    else return OUTCOME_PASS;
+}
+
+// What a child process tells its parent about its test. The child
+// updates `checks` as it goes and fills in `usage` at the end.
+struct test_channel
+{
+    struct test_usage  usage;
+    struct test_checks checks;
+};
+
+// A test running in a child process.
+struct test_child
 {
+    pid_t pid;
+    struct test_channel* channel;   // shared with the child
+    int   done_fd;          // read end of the pipe the child signals on
+    int   output_fd;        // read end of the output pipe, or -1
+    double deadline;        // from now_seconds(), or 0 for none
+    bool  timed_out;        // whether we killed it for running late
+};
+
+static void forget_parallel_tests(void);
+
+// Starts a child process running the test, which reports back through
+// `child->channel`, a page of memory that we share with it. It writes a
+// byte to the pipe to `child->done_fd` when it's done, or the pipe
+// closes if it dies first, so that we can wait for either with a
+// timeout. If `capture` then the child's stdout and stderr go to
+// another pipe, for us to read from `child->output_fd`. If `timeout`
+// isn't 0 then the child gets its own process group, so that we can
+// kill it and anything it starts.
+static bool start_test_child(struct test_child* child,
+                             void (*test_fn)(void),
+                             bool capture,
+                             double timeout)
+{
+    struct test_channel* channel = mmap(NULL, sizeof *channel,
+                                        PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (channel == MAP_FAILED) return false;
+
+    int fds[2], out[2] = {-1, -1};
+    if (pipe(fds) < 0) {
+        munmap(channel, sizeof *channel);
+        return false;
+    }
+
+    if (capture && pipe(out) < 0) {
+        munmap(channel, sizeof *channel);
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
     pid_t pid = fork();
-    if (pid < 0) return OUTCOME_OS_ERROR;
+    if (pid < 0) {
+        munmap(channel, sizeof *channel);
+        close(fds[0]);
+        close(fds[1]);
+        if (capture) {
+            close(out[0]);
+            close(out[1]);
+        }
+        return false;
+    }
 
     if (pid == 0) {
-        pass_count = fail_count = error_count = 0;
+        if (timeout) setpgid(0, 0);
+
+        close(fds[0]);
+        forget_parallel_tests();
+
+        if (capture) {
+            close(out[0]);
+            dup2(out[1], STDOUT_FILENO);
+            dup2(out[1], STDERR_FILENO);
+            close(out[1]);
+            // Keep stdout and stderr interleaved as on a terminal.
+            setvbuf(stdout, NULL, _IOLBF, 0);
+        }
 
-        test_fn();
+        struct alloc_stats before;
+        start_usage(&before);
+        enum test_outcome outcome =
+            run_test_body(test_fn, &channel->checks, true);
+        finish_usage(&before, &channel->usage);
+        finish_checks();
+
+        // Not just closing the pipe, since the test may have started
+        // processes that still have it open.
+        if (write(fds[1], "", 1) < 0) _exit(OUTCOME_ERROR);
+        exit(outcome);
+    }
 
-        // Don't run our exit handler in here.
-        tests_enabled = false;
+    // Both of us set the process group, so it's set before either of us
+    // relies on it.
+    if (timeout) setpgid(pid, pid);
 
-        if (error_count) exit(OUTCOME_ERROR);
-        else if (fail_count) exit(OUTCOME_FAIL);
-        else exit(OUTCOME_PASS);
-    }
+    close(fds[1]);
+    if (capture) close(out[1]);
 
-    int status;
-    int res = waitpid(pid, &status, 0);
-    if (res < 0) return OUTCOME_OS_ERROR;
+    child->pid       = pid;
+    child->channel   = channel;
+    child->done_fd   = fds[0];
+    child->output_fd = out[0];
+    child->deadline  = timeout ? now_seconds() + timeout : 0;
+    child->timed_out = false;
+    return true;
+}
+
+static void kill_test_child(struct test_child* child)
+{
+    kill(-child->pid, SIGKILL);
+    child->timed_out = true;
+}
+
+// Waits until the child signals that it's done or closes the pipe
+// dying, or its deadline passes, in which case we kill it.
+static void await_test_child(struct test_child* child)
+{
+    if (!child->deadline) return;
+
+    for (;;) {
+        double remaining = child->deadline - now_seconds();
+        if (remaining <= 0) {
+            kill_test_child(child);
+            return;
+        }
 
+        struct pollfd done = {child->done_fd, POLLIN, 0};
+        int res = poll(&done, 1, (int)(remaining * 1000) + 1);
+        if (res > 0 || (res < 0 && errno != EINTR)) return;
+    }
+}
+
+static enum test_outcome outcome_of_status(struct test_child const* child,
+                                           int status)
+{
     if (WIFEXITED(status)) {
         switch (WEXITSTATUS(status)) {
         case 0: return OUTCOME_PASS;
@@ -251,122 +718,1289 @@ call_test_function(void (*test_fn)(void))
     }
 
     if (WIFSIGNALED(status)) {
-        return OUTCOME_CRASH;
+        return child->timed_out ? OUTCOME_TIMEOUT : OUTCOME_CRASH;
     }
 
     // impossible?
     return OUTCOME_OS_ERROR;
 }
-#else // LIBIPD_HAS_POSIX
-static enum test_outcome
-call_test_function(void (*test_fn)(void))
+
+// Waits for the child to finish, storing how the test went in
+// `*result` (all but its timing).
+static void finish_test_child(struct test_child* child,
+                              struct test_result* result)
 {
-    unsigned old_fail_count = fail_count,
-             old_error_count = error_count;
+    await_test_child(child);
 
-    test_fn();
+    int status;
+    struct rusage ru;
+    pid_t waited = wait4(child->pid, &status, 0, &ru);
+    close(child->done_fd);
 
-    if (error_count > old_error_count)
-        return OUTCOME_ERROR;
-    else if (fail_count > old_fail_count)
-        return OUTCOME_FAIL;
-    else
-        return OUTCOME_PASS;
-}
-#endif // LIBIPD_HAS_POSIX
+    // The child is gone, so the channel holds whatever it got to.
+    result->usage  = child->channel->usage;
+    result->checks = child->channel->checks;
+    munmap(child->channel, sizeof *child->channel);
 
-bool libipd_do_run_test(
-        void (*test_fn)(void),
-        char const* source_expr,
-        char const* file,
-        int line)
-{
-    start_testing();
-    has_run_tests = true;
+    if (waited < 0) {
+        result->outcome = OUTCOME_OS_ERROR;
+        return;
+    }
 
-    bool const use_color = isatty(fileno(stdout));
+    result->outcome = outcome_of_status(child, status);
+    if (WIFSIGNALED(status)) result->signal = WTERMSIG(status);
+    get_resources(&ru, &result->resources);
+}
 
-    printf("%s... ", source_expr);
-    fflush(stdout);
+///
+/// IN-PROCESS TESTS
+///
 
-    enum test_outcome outcome = call_test_function(test_fn);
+// After run_tests_in_process(true), RUN_TEST calls each test directly,
+// rather than in a child process, which spares a program with a large
+// heap from copying its page tables for every test. A crash (or a
+// timeout) jumps back to RUN_TEST from a signal handler running on its
+// own stack, so that stack overflows are caught too, and so does a call
+// to exit(3) that goes through libipd_exit_rt. Whatever the test
+// corrupted or left locked stays that way, though.
 
-    switch (outcome) {
-    case OUTCOME_PASS:
-        color_word(use_color ? GREEN : NULL, "passed");
-        ++pass_count;
-        return true;
+// The signals that end an in-process test, besides SIGALRM, which is
+// for timeouts.
+static int const crash_signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL,
+                                    SIGABRT};
 
-    case OUTCOME_FAIL:
-        printf("\n%s ", source_expr);
-        color_word(use_color ? RED : NULL, "failed");
-        ++fail_count;
-        return false;
+#define CRASH_SIGNAL_COUNT  (sizeof crash_signals / sizeof *crash_signals)
 
-    case OUTCOME_ERROR:
-        printf("\n%s ", source_expr);
-        color_word(use_color ? RVRED : NULL, "errored");
-        ++error_count;
-        return false;
+// Why an in-process test jumped back, if it's not a signal number.
+#define JUMP_EXIT  (-1)
 
-    case OUTCOME_CRASH:
-        printf("\n%s ", source_expr);
-        color_word(use_color ? RVRED : NULL, "crashed");
-        ++error_count;
-        return false;
+static sigjmp_buf            in_process_jump;
+static volatile sig_atomic_t in_process_running = 0;
+static volatile sig_atomic_t in_process_reason  = 0;
+static int                   in_process_status  = 0;
 
-    default:
-        printf("\nunexpected error:\n");
-        fflush(stdout);
-        perror("RUN_TEST");
-        exit(11);
+static void in_process_signal_handler(int sig)
+{
+    if (!in_process_running) {
+        // Too late to jump back: let a crash crash, and ignore a late
+        // alarm.
+        if (sig != SIGALRM) signal(sig, SIG_DFL);
+        return;
     }
+
+    in_process_running = 0;
+    in_process_reason  = sig;
+    siglongjmp(in_process_jump, 1);
 }
 
-bool libipd_do_check(
-        bool condition,
-        const char* assertion,
-        const char* file,
-        int line)
+static void set_alarm(double seconds)
 {
-    if (log_check(condition, file, line)) return true;
-    eprintf("  assertion: %s\n", assertion);
-    return false;
+    struct itimerval timer = {{0, 0}, {0, 0}};
+    timer.it_value.tv_sec  = (time_t) seconds;
+    timer.it_value.tv_usec = (suseconds_t)
+        ((seconds - (double) timer.it_value.tv_sec) * 1e6);
+    if (seconds && !timer.it_value.tv_sec && !timer.it_value.tv_usec)
+        timer.it_value.tv_usec = 1;
+    setitimer(ITIMER_REAL, &timer, NULL);
 }
 
-bool libipd_do_check_char(
-        char have,
-        char want,
-        const char* expr_have,
-        const char* expr_want,
-        const char* file,
-        int line)
+// Calls `test_fn` with our signal handlers installed, storing in
+// `*reason` 0 if it returned, the signal if it crashed or timed out, or
+// JUMP_EXIT if it exited. Returns false if we couldn't set up.
+static bool call_protected(void (*test_fn)(void), double timeout,
+                           int* reason)
 {
-    if (log_check(have == want, file, line)) return true;
+    // Big enough for our handler, which runs on it only until it jumps.
+    static char* alt_stack = NULL;
+    size_t const alt_size  = SIGSTKSZ < 65536 ? 65536 : SIGSTKSZ;
 
-    eprintf("  have: ");
-    eprintf_char_literal(have);
-    eprintf("  (from: %s)\n", expr_have);
+    if (!alt_stack && !(alt_stack = malloc(alt_size))) return false;
 
-    eprintf("  want: ");
-    eprintf_char_literal(want);
-    eprintf("  (from: %s)\n", expr_want);
+    stack_t stack = {.ss_sp = alt_stack, .ss_size = alt_size}, old_stack;
+    if (sigaltstack(&stack, &old_stack) < 0) return false;
 
-    return false;
+    struct sigaction action = {.sa_handler = in_process_signal_handler,
+                               .sa_flags   = SA_ONSTACK};
+    sigemptyset(&action.sa_mask);
+
+    struct sigaction old_actions[CRASH_SIGNAL_COUNT], old_alarm;
+    for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i)
+        sigaction(crash_signals[i], &action, &old_actions[i]);
+    sigaction(SIGALRM, &action, &old_alarm);
+
+    in_process_reason = 0;
+
+    // Saves the signal mask, which a jump from a handler restores.
+    if (sigsetjmp(in_process_jump, 1) == 0) {
+        in_process_running = 1;
+        if (timeout) set_alarm(timeout);
+        test_fn();
+        in_process_running = 0;
+    }
+
+    if (timeout) set_alarm(0);
+
+    sigaction(SIGALRM, &old_alarm, NULL);
+    for (size_t i = 0; i < CRASH_SIGNAL_COUNT; ++i)
+        sigaction(crash_signals[i], &old_actions[i], NULL);
+    sigaltstack(&old_stack, NULL);
+
+    *reason = in_process_reason;
+    return true;
 }
 
-bool libipd_do_check_long(
-        long have,
-        long want,
-        const char* expr_have,
-        const char* expr_want,
-        const char* file,
-        int line)
+// Runs the test in this process, with its own counts of checks.
+static void call_test_in_process(void (*test_fn)(void),
+                                 struct test_result* result)
 {
-    if (log_check(have == want, file, line)) return true;
-    eprintf("  have: %ld  (from: %s)\n", have, expr_have);
-    eprintf("  want: %ld  (from: %s)\n", want, expr_want);
-    return false;
+    unsigned saved_pass  = pass_count,
+             saved_fail  = fail_count,
+             saved_error = error_count;
+    pass_count = fail_count = error_count = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+
+    struct rusage ru_before, ru_after;
+    getrusage(RUSAGE_SELF, &ru_before);
+
+    struct alloc_stats before;
+    start_usage(&before);
+    start_checks(&result->checks);
+
+    int reason;
+    bool called = call_protected(test_fn, result->timeout, &reason);
+
+    finish_checks();
+    finish_usage(&before, &result->usage);
+
+    getrusage(RUSAGE_SELF, &ru_after);
+    get_resources_between(&ru_before, &ru_after, &result->resources);
+
+    if (!called) {
+        result->outcome = OUTCOME_OS_ERROR;
+    } else if (reason == SIGALRM) {
+        result->outcome = OUTCOME_TIMEOUT;
+    } else if (reason > 0) {
+        result->outcome = OUTCOME_CRASH;
+        result->signal  = reason;
+    } else if (reason == JUMP_EXIT) {
+        // As a child process exiting would be judged.
+        int status = in_process_status ? in_process_status
+                                       : (int) fail_count;
+        result->outcome = status == 0 ? OUTCOME_PASS
+                        : status == 1 ? OUTCOME_FAIL
+                        : OUTCOME_ERROR;
+    } else if (error_count) {
+        result->outcome = OUTCOME_ERROR;
+    } else if (fail_count) {
+        result->outcome = OUTCOME_FAIL;
+    } else {
+        result->outcome = OUTCOME_PASS;
+    }
+
+    pass_count  = saved_pass;
+    fail_count  = saved_fail;
+    error_count = saved_error;
+}
+
+// Jumps back to RUN_TEST if we're in an in-process test.
+static void return_from_in_process_test(int status)
+{
+    if (!in_process_running) return;
+
+    eprintf("libipd: exit(%d) while testing\n", status);
+    in_process_running = 0;
+    in_process_reason  = JUMP_EXIT;
+    in_process_status  = status;
+    siglongjmp(in_process_jump, 1);
+}
+
+// Runs the test in a child process, which reports back through shared
+// memory, or in this process after run_tests_in_process(true).
+static void call_test_function(void (*test_fn)(void),
+                               struct test_result* result)
+{
+    if (in_process) {
+        call_test_in_process(test_fn, result);
+        return;
+    }
+
+    struct test_child child;
+    if (start_test_child(&child, test_fn, false, result->timeout))
+        finish_test_child(&child, result);
+    else
+        result->outcome = OUTCOME_OS_ERROR;
+}
+#else // LIBIPD_HAS_POSIX
+// Without fork(2) there's no stopping a test that runs too long, or
+// telling what it cost apart from the rest of the program.
+static void call_test_function(void (*test_fn)(void),
+                               struct test_result* result)
+{
+    unsigned old_fail_count = fail_count,
+             old_error_count = error_count;
+
+    struct alloc_stats before;
+    start_usage(&before);
+    start_checks(&result->checks);
+    test_fn();
+    finish_checks();
+    finish_usage(&before, &result->usage);
+
+    if (error_count > old_error_count)
+        result->outcome = OUTCOME_ERROR;
+    else if (fail_count > old_fail_count)
+        result->outcome = OUTCOME_FAIL;
+    else
+        result->outcome = OUTCOME_PASS;
+}
+#endif // LIBIPD_HAS_POSIX
+
+///
+/// RESOURCE SUMMARY
+///
+
+// We keep the `summary_size` slowest tests and the `summary_size` with
+// the largest resident sets, each sorted worst first, to list at exit.
+
+struct test_record
+{
+    char const* source_expr;
+    double      elapsed;
+    double      cpu_seconds;
+    size_t      max_rss_kb;     // 0 if unknown
+};
+
+static size_t              summary_size    = 0;
+static struct test_record* slowest         = NULL;
+static size_t              slowest_count   = 0;
+static struct test_record* hungriest       = NULL;
+static size_t              hungriest_count = 0;
+
+static void set_summary_size(size_t n)
+{
+    struct test_record* new_slowest   = realloc(slowest, n * sizeof *slowest);
+    struct test_record* new_hungriest = realloc(hungriest,
+                                                n * sizeof *hungriest);
+    if (n && (!new_slowest || !new_hungriest)) {
+        perror("RUN_TEST");
+        exit(11);
+    }
+
+    slowest   = n ? new_slowest : NULL;
+    hungriest = n ? new_hungriest : NULL;
+    summary_size = n;
+    if (slowest_count > n) slowest_count = n;
+    if (hungriest_count > n) hungriest_count = n;
+}
+
+// The parent reports on earlier tests, not us.
+static void forget_test_records(void)
+{
+    slowest_count = hungriest_count = 0;
+}
+
+static bool slower(struct test_record const* a, struct test_record const* b)
+{
+    return a->elapsed > b->elapsed;
+}
+
+static bool hungrier(struct test_record const* a,
+                     struct test_record const* b)
+{
+    return a->max_rss_kb > b->max_rss_kb;
+}
+
+// Inserts `record` into `records[0 .. *count]` if it's among the worst
+// `summary_size` according to `worse`.
+static void insert_record(struct test_record* records,
+                          size_t* count,
+                          struct test_record const* record,
+                          bool (*worse)(struct test_record const*,
+                                        struct test_record const*))
+{
+    size_t i = *count;
+    if (i == summary_size) {
+        if (!worse(record, &records[i - 1])) return;
+        --i;
+    } else {
+        ++*count;
+    }
+
+    for ( ; i > 0 && worse(record, &records[i - 1]); --i)
+        records[i] = records[i - 1];
+
+    records[i] = *record;
+}
+
+static void record_test(char const* source_expr,
+                        struct test_result const* result)
+{
+    if (!summary_size) return;
+
+    struct test_resources const* resources = &result->resources;
+    struct test_record record = {
+        .source_expr = source_expr,
+        .elapsed     = result->elapsed,
+        .cpu_seconds = resources->user_seconds + resources->system_seconds,
+        .max_rss_kb  = resources->max_rss_kb,
+    };
+
+    insert_record(slowest, &slowest_count, &record, slower);
+    if (resources->reported)
+        insert_record(hungriest, &hungriest_count, &record, hungrier);
+}
+
+static void print_records(char const* title,
+                          struct test_record const* records,
+                          size_t count)
+{
+    if (!count) return;
+
+    printf("\n%s:\n", title);
+    printf("%10s %10s %10s  %s\n", "wall", "cpu", "max RSS", "test");
+
+    for (size_t i = 0; i < count; ++i) {
+        char wall[32], cpu[32], rss[32];
+        printf("%10s %10s %10s  %s\n",
+               format_duration(wall, records[i].elapsed),
+               format_duration(cpu, records[i].cpu_seconds),
+               records[i].max_rss_kb
+                   ? format_kb(rss, records[i].max_rss_kb) : "-",
+               records[i].source_expr);
+    }
+}
+
+static void print_test_summary(void)
+{
+    print_records("Slowest tests", slowest, slowest_count);
+    print_records("Most memory", hungriest, hungriest_count);
+    fflush(stdout);
+}
+
+static bool report_outcome(char const* source_expr,
+                           struct test_result const* result);
+
+// Sends how a test went to the machine-readable report, if any.
+static void send_test_report(char const* source_expr,
+                             char const* file,
+                             int line,
+                             struct test_result const* result)
+{
+    struct test_checks const* checks = &result->checks;
+    char message[64];
+
+    struct test_report report = {
+        .name          = source_expr,
+        .file          = file,
+        .line          = line,
+        .seconds       = result->elapsed,
+        .checks        = checks->passed + checks->failed,
+        .failed_checks = checks->failed,
+        .failure_file  = checks->failed ? checks->first_file : NULL,
+        .failure_line  = checks->first_line,
+        .allocations   = result->usage.allocations,
+        .unfreed_bytes = result->usage.unfreed_bytes,
+    };
+
+    switch (result->outcome) {
+    case OUTCOME_PASS:
+        if (fail_on_leak && result->usage.unfreed_bytes) {
+            snprintf(message, sizeof message, "leaked %zu bytes",
+                     result->usage.unfreed_bytes);
+            report.outcome = "failed";
+            report.message = message;
+        } else {
+            report.outcome = "passed";
+        }
+        break;
+
+    case OUTCOME_FAIL:
+        report.outcome = "failed";
+        break;
+
+    case OUTCOME_CRASH:
+        report.outcome = "crashed";
+#ifdef LIBIPD_HAS_POSIX
+        report.message = strsignal(result->signal);
+#endif
+        break;
+
+    case OUTCOME_TIMEOUT:
+        snprintf(message, sizeof message, "timed out after %g s",
+                 result->timeout);
+        report.outcome = "timed out";
+        report.message = message;
+        break;
+
+    default:
+        report.outcome = "errored";
+        break;
+    }
+
+    test_report_test(&report);
+}
+
+// Prints how a test went, after its name, and counts it.
+static bool report_test(char const* source_expr,
+                        char const* file,
+                        int line,
+                        struct test_result const* result)
+{
+    send_test_report(source_expr, file, line, result);
+
+    test_checks_passed += result->checks.passed;
+    test_checks_failed += result->checks.failed;
+
+    bool passed = report_outcome(source_expr, result);
+    if (show_resources) print_resources(&result->resources);
+    record_test(source_expr, result);
+    return passed;
+}
+
+static bool report_outcome(char const* source_expr,
+                           struct test_result const* result)
+{
+    bool const use_color = isatty(fileno(stdout));
+
+    enum test_outcome const outcome = result->outcome;
+    struct test_usage const* usage  = &result->usage;
+    double const elapsed            = result->elapsed;
+
+    if (outcome == OUTCOME_PASS && fail_on_leak && usage->unfreed_bytes) {
+        printf("\n%s leaked %zu bytes, ", source_expr, usage->unfreed_bytes);
+        color_word_time(use_color ? RED : NULL, "failed", "in", elapsed);
+        ++fail_count;
+        return false;
+    }
+
+    switch (outcome) {
+    case OUTCOME_PASS:
+        print_usage(usage);
+        color_word_time(use_color ? GREEN : NULL, "passed", "in", elapsed);
+        ++pass_count;
+        return true;
+
+    case OUTCOME_FAIL:
+        printf("\n%s ", source_expr);
+        print_usage(usage);
+        color_word_time(use_color ? RED : NULL, "failed", "in", elapsed);
+        ++fail_count;
+        return false;
+
+    case OUTCOME_ERROR:
+        printf("\n%s ", source_expr);
+        print_usage(usage);
+        color_word_time(use_color ? RVRED : NULL, "errored", "in", elapsed);
+        ++error_count;
+        return false;
+
+    case OUTCOME_CRASH:
+        printf("\n%s ", source_expr);
+        color_word_time(use_color ? RVRED : NULL, "crashed", "in", elapsed);
+        ++error_count;
+        return false;
+
+    case OUTCOME_TIMEOUT:
+        printf("\n%s ", source_expr);
+        color_word_time(use_color ? RVRED : NULL, "timed out", "after",
+                        result->timeout);
+        ++error_count;
+        return false;
+
+    default:
+        printf("\nunexpected error:\n");
+        fflush(stdout);
+        perror("RUN_TEST");
+        exit(11);
+    }
+}
+
+#ifdef LIBIPD_HAS_POSIX
+
+///
+/// PARALLEL TESTS
+///
+
+// With more than one job, RUN_TEST starts the test and returns without
+// waiting for it, unless `test_jobs` tests are running already. Each
+// child's output goes to a buffer, and we print it along with the
+// test's result once every earlier test has been reported, so the
+// output comes out as if the tests ran one at a time. Anything else
+// that prints or counts results waits for the pending tests first.
+
+// A test that RUN_TEST has started but not yet reported.
+struct pending_test
+{
+    char const*        source_expr;
+    char const*        file;        // where RUN_TEST was called
+    int                line;
+    struct test_child  child;
+    bool               running;
+    char*              output;      // what the child has printed
+    size_t             output_len;
+    size_t             output_cap;
+    double             started;     // from now_seconds()
+    struct test_result result;      // complete once not `running`
+};
+
+// Pending tests in the order they were started, from `pending[first]`
+// to `pending[first + pending_count - 1]`.
+static struct pending_test* pending       = NULL;
+static size_t               pending_first = 0;
+static size_t               pending_count = 0;
+static size_t               pending_cap   = 0;
+static size_t               running_count = 0;
+
+_Noreturn static void parallel_os_error(void)
+{
+    printf("\nunexpected error:\n");
+    fflush(stdout);
+    perror("RUN_TEST");
+    exit(11);
+}
+
+// In a child, the other tests are none of its business.
+static void forget_parallel_tests(void)
+{
+    for (size_t i = 0; i < pending_count; ++i) {
+        struct pending_test* test = &pending[pending_first + i];
+        if (test->running) {
+            munmap(test->child.channel, sizeof *test->child.channel);
+            close(test->child.done_fd);
+            close(test->child.output_fd);
+        }
+        free(test->output);
+    }
+
+    free(pending);
+    pending       = NULL;
+    pending_first = pending_count = pending_cap = running_count = 0;
+}
+
+static struct pending_test* add_pending_test(void)
+{
+    if (pending_first + pending_count == pending_cap) {
+        if (pending_first) {
+            memmove(pending, pending + pending_first,
+                    pending_count * sizeof *pending);
+            pending_first = 0;
+        } else {
+            size_t new_cap = pending_cap ? 2 * pending_cap : 16;
+            struct pending_test* new_pending =
+                realloc(pending, new_cap * sizeof *pending);
+            if (!new_pending) parallel_os_error();
+            pending     = new_pending;
+            pending_cap = new_cap;
+        }
+    }
+
+    struct pending_test* test = &pending[pending_first + pending_count++];
+    *test = (struct pending_test) {0};
+    return test;
+}
+
+// Reads what `test` has printed, returning false at end of file.
+static bool read_test_output(struct pending_test* test)
+{
+    if (test->output_cap - test->output_len < 4096) {
+        size_t new_cap = test->output_cap ? 2 * test->output_cap : 8192;
+        char* new_output = realloc(test->output, new_cap);
+        if (!new_output) parallel_os_error();
+        test->output     = new_output;
+        test->output_cap = new_cap;
+    }
+
+    ssize_t got = read(test->child.output_fd,
+                       test->output + test->output_len,
+                       test->output_cap - test->output_len);
+    if (got < 0 && errno == EINTR) return true;
+    if (got <= 0) return false;
+
+    test->output_len += (size_t)got;
+    return true;
+}
+
+// Reads whatever is in `test`'s output pipe so far, without waiting for
+// more, since anything the test started in the background may hold the
+// pipe open for as long as it likes.
+static void drain_test_output(struct pending_test* test)
+{
+    int fd = test->child.output_fd;
+    if (fd < 0) return;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    while (read_test_output(test)) { }
+}
+
+// Reports pending tests, in order, until one is still running.
+static void report_finished_tests(void)
+{
+    while (pending_count && !pending[pending_first].running) {
+        struct pending_test* test = &pending[pending_first];
+
+        printf("%s... ", test->source_expr);
+        fflush(stdout);
+        if (test->output_len) {
+            fwrite(test->output, 1, test->output_len, stdout);
+            fflush(stdout);
+        }
+        free(test->output);
+
+        // Dequeue before reporting, so that if reporting exits, finishing
+        // the parallel tests on the way out doesn't report this one again.
+        ++pending_first;
+        --pending_count;
+        report_test(test->source_expr, test->file, test->line,
+                    &test->result);
+    }
+
+    if (!pending_count) pending_first = 0;
+}
+
+// Kills running tests whose time is up, and returns how many
+// milliseconds until the next one's is, or -1 if none has a deadline.
+static int kill_late_tests(void)
+{
+    double now  = now_seconds();
+    double next = 0;
+
+    for (size_t i = 0; i < pending_count; ++i) {
+        struct test_child* child = &pending[pending_first + i].child;
+        if (!pending[pending_first + i].running ||
+                !child->deadline || child->timed_out)
+            continue;
+
+        if (child->deadline <= now)
+            kill_test_child(child);
+        else if (!next || child->deadline < next)
+            next = child->deadline;
+    }
+
+    return next ? (int)((next - now) * 1000) + 1 : -1;
+}
+
+// Waits until at least one running test prints something or finishes,
+// or runs out of time. A test is finished when its child says so on
+// `done_fd` (or dies), not when its output reaches end of file, which
+// waits for anything else holding the pipe too.
+static void wait_for_tests(void)
+{
+    struct pollfd* polls  = malloc(2 * running_count * sizeof *polls);
+    size_t*        owners = malloc(2 * running_count * sizeof *owners);
+    if (!polls || !owners) parallel_os_error();
+
+    size_t n = 0;
+    for (size_t i = 0; i < pending_count; ++i) {
+        struct pending_test* test = &pending[pending_first + i];
+        if (!test->running) continue;
+
+        if (test->child.output_fd >= 0) {
+            polls[n]  = (struct pollfd) {test->child.output_fd, POLLIN, 0};
+            owners[n] = pending_first + i;
+            ++n;
+        }
+
+        polls[n]  = (struct pollfd) {test->child.done_fd, POLLIN, 0};
+        owners[n] = pending_first + i;
+        ++n;
+    }
+
+    int res = poll(polls, n, kill_late_tests());
+    if (res < 0 && errno != EINTR) parallel_os_error();
+    if (res == 0) kill_late_tests();
+
+    for (size_t j = 0; j < n; ++j) {
+        if (!polls[j].revents) continue;
+
+        struct pending_test* test = &pending[owners[j]];
+
+        if (polls[j].fd == test->child.output_fd) {
+            if (!read_test_output(test)) {
+                close(test->child.output_fd);
+                test->child.output_fd = -1;
+            }
+            continue;
+        }
+
+        // Drain the pipe before waiting too, so that the child can't
+        // block on a full pipe while it flushes stdout to exit.
+        drain_test_output(test);
+        finish_test_child(&test->child, &test->result);
+        test->result.elapsed = now_seconds() - test->started;
+        drain_test_output(test);
+        if (test->child.output_fd >= 0) close(test->child.output_fd);
+        test->child.output_fd = -1;
+        test->running = false;
+        --running_count;
+    }
+
+    free(polls);
+    free(owners);
+
+    report_finished_tests();
+}
+
+static bool start_parallel_test(void (*test_fn)(void),
+                                char const* source_expr,
+                                char const* file,
+                                int line,
+                                double timeout)
+{
+    while (running_count >= test_jobs) wait_for_tests();
+
+    struct pending_test* test = add_pending_test();
+    test->source_expr    = source_expr;
+    test->file           = file;
+    test->line           = line;
+    test->started        = now_seconds();
+    test->result.timeout = timeout;
+
+    if (!start_test_child(&test->child, test_fn, true, timeout)) {
+        --pending_count;
+        parallel_os_error();
+    }
+
+    test->running = true;
+    ++running_count;
+
+    // We don't know yet.
+    return true;
+}
+
+static void finish_parallel_tests(void)
+{
+    while (pending_count) wait_for_tests();
+}
+
+#else // LIBIPD_HAS_POSIX
+
+static void finish_parallel_tests(void)
+{ }
+
+#endif // LIBIPD_HAS_POSIX
+
+bool libipd_do_run_test(
+        void (*test_fn)(void),
+        char const* source_expr,
+        char const* file,
+        int line)
+{
+    start_testing();
+    return libipd_do_run_test_timeout(test_fn, source_expr, test_timeout,
+                                      file, line);
+}
+
+bool libipd_do_run_test_timeout(
+        void (*test_fn)(void),
+        char const* source_expr,
+        double timeout,
+        char const* file,
+        int line)
+{
+    start_testing();
+    has_run_tests = true;
+
+    if (timeout < 0) timeout = 0;
+
+#ifdef LIBIPD_HAS_POSIX
+    if (test_jobs > 1 && !in_process)
+        return start_parallel_test(test_fn, source_expr, file, line,
+                                   timeout);
+#endif
+
+    printf("%s... ", source_expr);
+    fflush(stdout);
+
+    struct test_result result = {.timeout = timeout};
+    double started = now_seconds();
+    call_test_function(test_fn, &result);
+    result.elapsed = now_seconds() - started;
+
+    return report_test(source_expr, file, line, &result);
+}
+
+///
+/// FIXTURES
+///
+
+// RUN_TESTS_WITH_FIXTURE calls its setup function here, before forking
+// a child for each test, so every child starts with a copy-on-write
+// copy of what it built. The teardown waits for the tests to finish, in
+// case they're running in parallel and need something it destroys.
+
+// Splits `exprs`, the source of RUN_TESTS_WITH_FIXTURE's test arguments,
+// at the top-level commas between them, storing each in `names`, which
+// has room for `count`. If there's no memory for the split names then
+// every name is all of `exprs`. The names are never freed, since the
+// summary of slowest and hungriest tests printed at exit may still
+// point to them, as it does to the source expressions of RUN_TEST.
+static void split_source_exprs(char const* exprs,
+                               char const* names[],
+                               size_t count)
+{
+    for (size_t i = 0; i < count; ++i) names[i] = exprs;
+
+    char* copy = malloc(strlen(exprs) + 1);
+    if (!copy) return;
+    strcpy(copy, exprs);
+
+    size_t i     = 0;
+    int    depth = 0;
+    char*  start = copy;
+
+    for (char* p = copy; ; ++p) {
+        if (*p == '(' || *p == '[' || *p == '{') {
+            ++depth;
+        } else if (*p == ')' || *p == ']' || *p == '}') {
+            --depth;
+        } else if (!*p || (*p == ',' && depth == 0)) {
+            bool last = !*p;
+            *p = '\0';
+            while (isspace((unsigned char) *start)) ++start;
+            if (i < count) names[i++] = start;
+            if (last) break;
+            start = p + 1;
+        }
+    }
+}
+
+bool libipd_do_run_tests_with_fixture(
+        void (*setup)(void),
+        void (*teardown)(void),
+        void (*test_fns[])(void),
+        size_t test_count,
+        char const* source_exprs,
+        char const* file,
+        int line)
+{
+    start_testing();
+
+    // So that our result counts only our tests.
+    finish_parallel_tests();
+    unsigned old_fail_count  = fail_count,
+             old_error_count = error_count;
+
+    char const** names = malloc(test_count * sizeof *names);
+    if (!names) {
+        perror("RUN_TESTS_WITH_FIXTURE");
+        exit(11);
+    }
+    split_source_exprs(source_exprs, names, test_count);
+
+    if (setup) setup();
+
+    for (size_t i = 0; i < test_count; ++i)
+        libipd_do_run_test(test_fns[i], names[i], file, line);
+
+    finish_parallel_tests();
+
+    if (teardown) teardown();
+
+    free(names);
+
+    return fail_count == old_fail_count && error_count == old_error_count;
+}
+
+#ifdef LIBIPD_HAS_POSIX
+
+///
+/// OUT-OF-MEMORY SWEEPS
+///
+
+// What one run of the test in an OOM sweep reports back to the parent.
+struct sweep_result
+{
+    enum test_outcome outcome;
+    size_t            allocations;  // attempted by the test
+    size_t            leaked;       // live bytes the test left behind
+    int               status;       // from waitpid(2), if no report
+};
+
+struct sweep_run
+{
+    pid_t  pid;
+    int    fd;                      // read end of the report pipe
+    double deadline;                // from now_seconds(), or 0 for none
+    bool   timed_out;               // whether we killed it for running late
+};
+
+// Without a test timeout, a run with a failing allocation gets this
+// many times as long as the normal run took, but at least a second.
+#define SWEEP_TIMEOUT_FACTOR  10
+#define SWEEP_TIMEOUT_MIN     1.0
+
+// Starts a child that runs the test with its `n`th allocation failing
+// (or none, if `n` is 0). If `quiet` then the test's output is
+// discarded. If `timeout` isn't 0 then the child gets its own process
+// group, so that we can kill it and anything it starts.
+static bool start_sweep_run(struct sweep_run* run,
+                            void (*test_fn)(void),
+                            size_t n,
+                            bool quiet,
+                            double timeout)
+{
+    int fds[2];
+    if (pipe(fds) < 0) return false;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+
+    if (pid == 0) {
+        if (timeout) setpgid(0, 0);
+
+        close(fds[0]);
+
+        if (quiet) {
+            int null_fd = open("/dev/null", O_WRONLY);
+            if (null_fd >= 0) {
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+                close(null_fd);
+            }
+        }
+
+        struct alloc_stats before, after;
+        struct sweep_result result = {0};
+
+        alloc_stats_get(&before);
+        alloc_fail_at(n);
+
+        struct test_checks checks;
+        result.outcome     = run_test_body(test_fn, &checks, false);
+        result.allocations = alloc_fail_count();
+
+        alloc_fail_at(0);
+        alloc_stats_get(&after);
+
+        if (after.live_bytes > before.live_bytes)
+            result.leaked = after.live_bytes - before.live_bytes;
+
+        if (write(fds[1], &result, sizeof result) < 0) _exit(1);
+
+        // Skip exit handlers, so that we don't, say, print a heap
+        // profile for every run.
+        fflush(stdout);
+        _exit(0);
+    }
+
+    // Both of us set the process group, so it's set before either of us
+    // relies on it.
+    if (timeout) setpgid(pid, pid);
+
+    close(fds[1]);
+    run->pid       = pid;
+    run->fd        = fds[0];
+    run->deadline  = timeout ? now_seconds() + timeout : 0;
+    run->timed_out = false;
+    return true;
+}
+
+// Waits until the child reports or dies, or its deadline passes, in
+// which case we kill it.
+static void await_sweep_run(struct sweep_run* run)
+{
+    if (!run->deadline) return;
+
+    for (;;) {
+        double remaining = run->deadline - now_seconds();
+
+        struct pollfd report = {run->fd, POLLIN, 0};
+        int res = poll(&report, 1,
+                       remaining > 0 ? (int)(remaining * 1000) + 1 : 0);
+        if (res > 0 || (res < 0 && errno != EINTR)) return;
+
+        if (res == 0 && remaining <= 0) {
+            kill(-run->pid, SIGKILL);
+            run->timed_out = true;
+            return;
+        }
+    }
+}
+
+// Waits for a run to finish. If it didn't report back, stores its exit
+// status in `result->status` and marks it as crashed, errored, or timed
+// out.
+static bool finish_sweep_run(struct sweep_run* run,
+                             struct sweep_result* result)
+{
+    await_sweep_run(run);
+
+    ssize_t got = read(run->fd, result, sizeof *result);
+    close(run->fd);
+
+    int status;
+    if (waitpid(run->pid, &status, 0) < 0) return false;
+
+    if (got != sizeof *result) {
+        *result = (struct sweep_result) {
+            .outcome = run->timed_out      ? OUTCOME_TIMEOUT :
+                       WIFSIGNALED(status) ? OUTCOME_CRASH : OUTCOME_ERROR,
+            .status  = status,
+        };
+    }
+
+    return true;
+}
+
+// Prints what went wrong with failing allocation `n`, if anything, and
+// returns whether something did.
+static bool report_sweep_run(size_t n,
+                             size_t total,
+                             double timeout,
+                             struct sweep_result const* result,
+                             struct sweep_result const* baseline,
+                             bool first_problem)
+{
+    char const* prefix = first_problem ? "\n" : "";
+
+    if (result->outcome == OUTCOME_TIMEOUT) {
+        char duration[32];
+        printf("%s  failing allocation %zu of %zu: timed out after %s\n",
+               prefix, n, total, format_duration(duration, timeout));
+        return true;
+    }
+
+    if (result->outcome == OUTCOME_CRASH) {
+        int sig = WTERMSIG(result->status);
+        printf("%s  failing allocation %zu of %zu: crashed (%s)\n",
+               prefix, n, total, strsignal(sig));
+        return true;
+    }
+
+    if (result->status) {
+        printf("%s  failing allocation %zu of %zu: exited with status %d\n",
+               prefix, n, total, WEXITSTATUS(result->status));
+        return true;
+    }
+
+    if (result->leaked > baseline->leaked) {
+        printf("%s  failing allocation %zu of %zu: leaked %zu bytes\n",
+               prefix, n, total, result->leaked - baseline->leaked);
+        return true;
+    }
+
+    return false;
+}
+
+// Sends how a sweep went to the machine-readable report, if any.
+static void send_sweep_report(char const* source_expr,
+                              char const* file,
+                              int line,
+                              char const* outcome,
+                              char const* message,
+                              double started,
+                              size_t allocations)
+{
+    char name[256];
+    snprintf(name, sizeof name, "%s (OOM sweep)", source_expr);
+
+    struct test_report report = {
+        .name        = name,
+        .file        = file,
+        .line        = line,
+        .outcome     = outcome,
+        .message     = message,
+        .seconds     = now_seconds() - started,
+        .allocations = allocations,
+    };
+
+    test_report_test(&report);
+}
+
+bool libipd_do_run_oom_sweep(
+        void (*test_fn)(void),
+        char const* source_expr,
+        char const* file,
+        int line)
+{
+    start_testing();
+    has_run_tests = true;
+
+    bool const use_color = isatty(fileno(stdout));
+    double const started = now_seconds();
+
+    finish_parallel_tests();
+
+    printf("%s (OOM sweep)... ", source_expr);
+    fflush(stdout);
+    fflush(stderr);
+
+    // First, a normal run to count the allocations.
+    struct sweep_run run;
+    struct sweep_result baseline;
+    double const baseline_started = now_seconds();
+
+    if (!start_sweep_run(&run, test_fn, 0, false, test_timeout) ||
+            !finish_sweep_run(&run, &baseline))
+        goto os_error;
+
+    if (baseline.outcome != OUTCOME_PASS || baseline.status) {
+        char const* outcome =
+            baseline.outcome == OUTCOME_FAIL    ? "failed" :
+            baseline.outcome == OUTCOME_CRASH   ? "crashed" :
+            baseline.outcome == OUTCOME_TIMEOUT ? "timed out" : "errored";
+        send_sweep_report(source_expr, file, line, outcome,
+                          "failed without failing allocations",
+                          started, 0);
+
+        printf("\n%s ", source_expr);
+        switch (baseline.outcome) {
+        case OUTCOME_FAIL:
+            color_word(use_color ? RED : NULL, "failed");
+            ++fail_count;
+            break;
+        case OUTCOME_CRASH:
+            color_word(use_color ? RVRED : NULL, "crashed");
+            ++error_count;
+            break;
+        case OUTCOME_TIMEOUT:
+            color_word_time(use_color ? RVRED : NULL, "timed out", "after",
+                            test_timeout);
+            ++error_count;
+            break;
+        default:
+            color_word(use_color ? RVRED : NULL, "errored");
+            ++error_count;
+            break;
+        }
+        return false;
+    }
+
+    // Then one run per allocation, a batch at a time. A failing
+    // allocation may send the test into a loop, so each run gets a
+    // deadline even if tests don't.
+    size_t const total = baseline.allocations;
+    size_t const jobs  = processor_count();
+    size_t problems    = 0;
+
+    double timeout = test_timeout;
+    if (!timeout) {
+        timeout = SWEEP_TIMEOUT_FACTOR * (now_seconds() - baseline_started);
+        if (timeout < SWEEP_TIMEOUT_MIN) timeout = SWEEP_TIMEOUT_MIN;
+    }
+
+    struct sweep_run* runs = malloc(jobs * sizeof *runs);
+    if (!runs) goto os_error;
+
+    for (size_t first = 1; first <= total; first += jobs) {
+        size_t batch = total - first + 1 < jobs ? total - first + 1 : jobs;
+
+        fflush(stdout);
+
+        for (size_t i = 0; i < batch; ++i) {
+            if (!start_sweep_run(&runs[i], test_fn, first + i, true,
+                                 timeout))
+                goto os_error;
+        }
+
+        for (size_t i = 0; i < batch; ++i) {
+            struct sweep_result result;
+            if (!finish_sweep_run(&runs[i], &result)) goto os_error;
+            if (report_sweep_run(first + i, total, timeout,
+                                 &result, &baseline, problems == 0))
+                ++problems;
+        }
+    }
+
+    free(runs);
+
+    if (problems) {
+        char message[64];
+        snprintf(message, sizeof message,
+                 "%zu of %zu failing allocations mishandled",
+                 problems, total);
+        send_sweep_report(source_expr, file, line, "failed", message,
+                          started, total);
+
+        printf("%s (OOM sweep) ", source_expr);
+        color_word(use_color ? RED : NULL, "failed");
+        ++fail_count;
+        return false;
+    }
+
+    send_sweep_report(source_expr, file, line, "passed", NULL,
+                      started, total);
+
+    printf("%zu allocation%s, ", total, total == 1 ? "" : "s");
+    color_word(use_color ? GREEN : NULL, "passed");
+    ++pass_count;
+    return true;
+
+os_error:
+    printf("\nunexpected error:\n");
+    fflush(stdout);
+    perror("RUN_OOM_SWEEP");
+    exit(11);
+}
+
+#else // LIBIPD_HAS_POSIX
+
+// Without fork(2) we can't survive the crashes, so just run the test.
+bool libipd_do_run_oom_sweep(
+        void (*test_fn)(void),
+        char const* source_expr,
+        char const* file,
+        int line)
+{
+    return libipd_do_run_test(test_fn, source_expr, file, line);
+}
+
+#endif // LIBIPD_HAS_POSIX
+
+bool libipd_do_check(
+        bool condition,
+        const char* assertion,
+        const char* file,
+        int line)
+{
+    if (log_check(condition, file, line)) return true;
+    eprintf("  assertion: %s\n", assertion);
+    return false;
+}
+
+bool libipd_do_check_char(
+        char have,
+        char want,
+        const char* expr_have,
+        const char* expr_want,
+        const char* file,
+        int line)
+{
+    if (log_check(have == want, file, line)) return true;
+
+    struct buffer buf = {0};
+
+    bputs(&buf, "  have: ");
+    bput_char_literal(&buf, have);
+    bprintf(&buf, "  (from: %s)\n", expr_have);
+
+    bputs(&buf, "  want: ");
+    bput_char_literal(&buf, want);
+    bprintf(&buf, "  (from: %s)\n", expr_want);
+
+    eprint_buffer(&buf);
+
+    return false;
+}
+
+bool libipd_do_check_long(
+        long have,
+        long want,
+        const char* expr_have,
+        const char* expr_want,
+        const char* file,
+        int line)
+{
+    if (log_check(have == want, file, line)) return true;
+    eprintf("  have: %ld  (from: %s)\n", have, expr_have);
+    eprintf("  want: %ld  (from: %s)\n", want, expr_want);
+    return false;
 }
 
 bool libipd_do_check_size(
@@ -416,13 +2050,21 @@ bool libipd_do_check_string(
         abort();
     }
 
-    eprintf("  have: ");
-    eprintf_string_literal(have);
-    eprintf("  (from: %s)\n", expr_have);
+    struct buffer buf = {0};
 
-    eprintf("  want: ");
-    eprintf_string_literal(want);
-    eprintf("  (from: %s)\n", expr_want);
+    if (have) {
+        bput_string_mismatch(&buf, have, expr_have, want, expr_want);
+    } else {
+        bputs(&buf, "  have: ");
+        bput_string_literal(&buf, have);
+        bprintf(&buf, "  (from: %s)\n", expr_have);
+
+        bputs(&buf, "  want: ");
+        bput_string_literal(&buf, want);
+        bprintf(&buf, "  (from: %s)\n", expr_want);
+    }
+
+    eprint_buffer(&buf);
 
     return false;
 }
@@ -441,8 +2083,235 @@ bool libipd_do_check_pointer(
     return false;
 }
 
+///
+/// ARRAY CHECKS
+///
+
+// Fails the check if there's something to compare but `have` or `want`
+// is NULL, returning whether it did.
+static bool fail_null_block(
+        size_t count,
+        void const* have,
+        void const* want,
+        const char* expr_have,
+        const char* expr_want,
+        const char* file,
+        int line)
+{
+    if (!count || (have && want)) return false;
+
+    log_check(false, file, line);
+    eprintf("  have: %p  (from: %s)\n", have, expr_have);
+    eprintf("  want: %p  (from: %s)\n", want, expr_want);
+    return true;
+}
+
+bool libipd_do_check_memory(
+        const void* have,
+        const void* want,
+        size_t size,
+        const char* expr_have,
+        const char* expr_want,
+        const char* file,
+        int line)
+{
+    if (fail_null_block(size, have, want, expr_have, expr_want, file, line))
+        return false;
+
+    size_t diff = first_byte_difference(have, want, size);
+    if (log_check(diff == size, file, line)) return true;
+
+    unsigned char const* h = have;
+    unsigned char const* w = want;
+
+    size_t differ = 0;
+    for (size_t i = diff; i < size; ++i) differ += h[i] != w[i];
+
+    struct buffer buf = {0};
+    bput_memory_mismatch(&buf, have, expr_have, want, expr_want,
+                         size, diff, differ);
+    eprint_buffer(&buf);
+
+    return false;
+}
+
+bool libipd_do_check_array(
+        const void* have,
+        const void* want,
+        size_t count,
+        size_t have_elem_size,
+        size_t want_elem_size,
+        enum libipd_elem_kind kind,
+        const char* expr_have,
+        const char* expr_want,
+        const char* file,
+        int line)
+{
+    if (have_elem_size != want_elem_size) {
+        log_check(false, file, line);
+        eprintf("  have: %zu-byte elements  (from: %s)\n",
+                have_elem_size, expr_have);
+        eprintf("  want: %zu-byte elements  (from: %s)\n",
+                want_elem_size, expr_want);
+        return false;
+    }
+
+    if (fail_null_block(count, have, want, expr_have, expr_want, file, line))
+        return false;
+
+    size_t const size = have_elem_size;
+    size_t diff = first_byte_difference(have, want, count * size) / size;
+    if (log_check(diff == count, file, line)) return true;
+
+    unsigned char const* h = have;
+    unsigned char const* w = want;
+
+    size_t differ = 0;
+    for (size_t i = diff; i < count; ++i)
+        differ += memcmp(h + i * size, w + i * size, size) != 0;
+
+    struct buffer buf = {0};
+    bput_array_mismatch(&buf, kind, size, have, expr_have, want, expr_want,
+                        count, diff, differ);
+    eprint_buffer(&buf);
+
+    return false;
+}
+
+struct tolerance
+{
+    double        abs;
+    double        rel;
+    unsigned long ulps;
+};
+
+static double magnitude(double x)
+{
+    return x < 0 ? -x : x;
+}
+
+// How many representable doubles apart `a` and `b` are, where 0.0 and
+// -0.0 count as the same.
+static uint64_t ulp_distance(double a, double b)
+{
+    int64_t ia, ib;
+    memcpy(&ia, &a, sizeof ia);
+    memcpy(&ib, &b, sizeof ib);
+
+    // Turns sign-and-magnitude into integers ordered like the doubles.
+    if (ia < 0) ia = INT64_MIN - ia;
+    if (ib < 0) ib = INT64_MIN - ib;
+
+    return ia > ib ? (uint64_t) ia - (uint64_t) ib
+                   : (uint64_t) ib - (uint64_t) ia;
+}
+
+static bool doubles_near(double a, double b, struct tolerance const* tol)
+{
+    if (a == b) return true;
+    if (isnan(a) || isnan(b)) return isnan(a) && isnan(b);
+    // Equal infinities matched above, and no tolerance reaches one.
+    if (isinf(a) || isinf(b)) return false;
+
+    double diff = magnitude(a - b);
+    double big  = magnitude(a) > magnitude(b) ? magnitude(a) : magnitude(b);
+
+    return diff <= tol->abs ||
+           diff <= tol->rel * big ||
+           ulp_distance(a, b) <= tol->ulps;
+}
+
+// Returns the index of the first element of `have` that isn't near the
+// one in `want`, or `count` if they all are. Blocks of elements get a
+// branch-free test that the compiler can vectorize first, and only the
+// blocks that fail it get doubles_near, which also handles NaNs,
+// infinities, and ULPs.
+static size_t first_far_double(double const* have, double const* want,
+                               size_t count, struct tolerance const* tol)
+{
+    enum { BLOCK = 8 };
+
+    double const abs = tol->abs, rel = tol->rel;
+    size_t i = 0;
+
+    for (; count - i >= BLOCK; i += BLOCK) {
+        int all_near = 1;
+
+        for (size_t j = i; j < i + BLOCK; ++j) {
+            double a    = have[j], b = want[j];
+            double diff = magnitude(a - b);
+            double big  = magnitude(a) > magnitude(b)
+                          ? magnitude(a) : magnitude(b);
+            all_near &= (a == b) |
+                        (((diff <= abs) | (diff <= rel * big)) &
+                         (big <= DBL_MAX));
+        }
+
+        if (all_near) continue;
+
+        for (size_t j = i; j < i + BLOCK; ++j)
+            if (!doubles_near(have[j], want[j], tol)) return j;
+    }
+
+    for (; i < count; ++i)
+        if (!doubles_near(have[i], want[i], tol)) return i;
+
+    return count;
+}
+
+bool libipd_do_check_double_array_near(
+        double const* have,
+        double const* want,
+        size_t count,
+        double abs_tolerance,
+        double rel_tolerance,
+        unsigned long ulp_tolerance,
+        const char* expr_have,
+        const char* expr_want,
+        const char* file,
+        int line)
+{
+    if (fail_null_block(count, have, want, expr_have, expr_want, file, line))
+        return false;
+
+    struct tolerance tol = {abs_tolerance, rel_tolerance, ulp_tolerance};
+
+    size_t diff = first_far_double(have, want, count, &tol);
+    if (log_check(diff == count, file, line)) return true;
+
+    size_t differ = 0;
+    for (size_t i = diff; i < count; ++i)
+        differ += !doubles_near(have[i], want[i], &tol);
+
+    struct buffer buf = {0};
+    bput_array_mismatch(&buf, LIBIPD_ELEM_FLOAT, sizeof(double),
+                        have, expr_have, want, expr_want,
+                        count, diff, differ);
+
+    double a = have[diff], b = want[diff];
+    if (isnan(a) || isnan(b))
+        bprintf(&buf, "  only one is NaN");
+    else if (isinf(a) && isinf(b))
+        bprintf(&buf, "  infinities of opposite signs");
+    else if (isinf(a) || isinf(b))
+        bprintf(&buf, "  only one is infinite");
+    else
+        bprintf(&buf, "  off by %g (%llu ULPs)", magnitude(a - b),
+                (unsigned long long) ulp_distance(a, b));
+    bprintf(&buf, "; allowed %g absolute, %g relative, %lu ULPs\n",
+            abs_tolerance, rel_tolerance, ulp_tolerance);
+
+    eprint_buffer(&buf);
+
+    return false;
+}
+
 _Noreturn void libipd_exit_rt(int result)
 {
+#ifdef LIBIPD_HAS_POSIX
+    return_from_in_process_test(result);
+#endif
+
     if (tests_enabled) {
         print_test_results();
         tests_enabled = false;
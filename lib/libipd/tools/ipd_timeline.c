@@ -0,0 +1,328 @@
+// ipd-timeline – charts heap timelines written by libipd when
+// RTIPD_ALLOC_TIMELINE is set. See ipd-timeline(1).
+
+#define _XOPEN_SOURCE 700
+
+#include "alloc_timeline_format.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#define DEFAULT_WIDTH    72
+#define DEFAULT_HEIGHT   16
+#define DEFAULT_PERCENT  80
+
+static char const* program_name = "ipd-timeline";
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: %s [-w WIDTH] [-h HEIGHT] [-p PERCENT] FILE\n"
+            "\n"
+            "  -w WIDTH     chart columns (default %d)\n"
+            "  -h HEIGHT    chart rows (default %d)\n"
+            "  -p PERCENT   list phases at or above this percentage of\n"
+            "               the peak (default %d)\n",
+            program_name, DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_PERCENT);
+    exit(2);
+}
+
+static unsigned long parse_option(char const* arg,
+                                  unsigned long min, unsigned long max)
+{
+    char* end;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (end == arg || *end || n < min || n > max) usage();
+    return n;
+}
+
+struct timeline
+{
+    struct rtipd_timeline_header  header;
+    struct rtipd_timeline_record* records;
+    size_t                        count;
+};
+
+static void read_timeline(char const* path, struct timeline* out)
+{
+    FILE* fin = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!fin) {
+        perror(path);
+        exit(1);
+    }
+
+    struct rtipd_timeline_header* header = &out->header;
+    if (fread(header, sizeof *header, 1, fin) != 1 ||
+            memcmp(header->magic, RTIPD_TIMELINE_MAGIC, sizeof header->magic))
+    {
+        fprintf(stderr, "%s: %s: not a heap timeline\n",
+                program_name, path);
+        exit(1);
+    }
+
+    if (header->byte_order != RTIPD_TIMELINE_BYTE_ORDER) {
+        fprintf(stderr, "%s: %s: timeline has foreign byte order\n",
+                program_name, path);
+        exit(1);
+    }
+
+    if (header->version != RTIPD_TIMELINE_VERSION ||
+            header->record_size != sizeof(struct rtipd_timeline_record))
+    {
+        fprintf(stderr, "%s: %s: unsupported timeline version %u\n",
+                program_name, path, (unsigned) header->version);
+        exit(1);
+    }
+
+    size_t cap = 0;
+    out->records = NULL;
+    out->count   = 0;
+
+    for (;;) {
+        if (out->count == cap) {
+            cap = cap ? 2 * cap : 1024;
+            out->records = realloc(out->records, cap * sizeof *out->records);
+            if (!out->records) {
+                perror(program_name);
+                exit(1);
+            }
+        }
+
+        size_t got = fread(out->records + out->count,
+                           sizeof *out->records, cap - out->count, fin);
+        out->count += got;
+        if (out->count < cap) break;
+    }
+
+    if (ferror(fin)) {
+        perror(path);
+        exit(1);
+    }
+
+    if (fin != stdin) fclose(fin);
+}
+
+///
+/// FORMATTING
+///
+
+static void format_bytes(char* buf, size_t size, uint64_t n)
+{
+    static char const* const units[] = {"B", "KiB", "MiB", "GiB", "TiB"};
+    double x = (double)n;
+    size_t u = 0;
+
+    while (x >= 1024 && u + 1 < sizeof units / sizeof *units) {
+        x /= 1024;
+        ++u;
+    }
+
+    if (u == 0)
+        snprintf(buf, size, "%" PRIu64 " B", n);
+    else
+        snprintf(buf, size, "%.1f %s", x, units[u]);
+}
+
+static void format_time(char* buf, size_t size, uint64_t ns)
+{
+    if (ns >= 1000000000u)
+        snprintf(buf, size, "%.2f s", ns / 1e9);
+    else if (ns >= 1000000u)
+        snprintf(buf, size, "%.2f ms", ns / 1e6);
+    else
+        snprintf(buf, size, "%.2f us", ns / 1e3);
+}
+
+///
+/// CHART
+///
+
+// Returns the index of the record with the greatest peak.
+static size_t find_peak(struct timeline const* tl)
+{
+    size_t best = 0;
+
+    for (size_t i = 1; i < tl->count; ++i) {
+        if (tl->records[i].peak_bytes > tl->records[best].peak_bytes)
+            best = i;
+    }
+
+    return best;
+}
+
+// Each column shows the greatest peak among the snapshots that fall in
+// its slice of time, or, if none do, the live bytes carried over from
+// the snapshot before. The column holding the overall peak is drawn
+// with '#' and the rest with ':'.
+static void print_chart(struct timeline const* tl, size_t width,
+                        size_t height)
+{
+    uint64_t* columns = calloc(width, sizeof *columns);
+    if (!columns) {
+        perror(program_name);
+        exit(1);
+    }
+
+    struct rtipd_timeline_record const* r = tl->records;
+    uint64_t duration = r[tl->count - 1].time + 1;
+    size_t peak_index = find_peak(tl);
+    size_t peak_column = (size_t)(r[peak_index].time * width / duration);
+    uint64_t top = r[peak_index].peak_bytes;
+
+    size_t i = 0;
+    uint64_t carried = 0;
+
+    for (size_t c = 0; c < width; ++c) {
+        uint64_t end = (c + 1) * duration / width;
+        uint64_t value = carried;
+
+        while (i < tl->count && r[i].time < end) {
+            if (r[i].peak_bytes > value) value = r[i].peak_bytes;
+            carried = r[i].live_bytes;
+            ++i;
+        }
+
+        columns[c] = value;
+    }
+
+    char label[32];
+
+    for (size_t row = height; row > 0; --row) {
+        // A column reaches this row if it's above the row's midpoint.
+        uint64_t threshold = top ? (top * (2 * row - 1) + 2 * height - 1)
+                                   / (2 * height)
+                                 : 1;
+
+        if (row == height || row == (height + 1) / 2 || row == 1) {
+            format_bytes(label, sizeof label, top * row / height);
+            printf("%10s |", label);
+        } else {
+            printf("%10s |", "");
+        }
+
+        for (size_t c = 0; c < width; ++c) {
+            if (columns[c] >= threshold && columns[c])
+                putchar(c == peak_column ? '#' : ':');
+            else
+                putchar(' ');
+        }
+
+        putchar('\n');
+    }
+
+    printf("%10s +", "0");
+    for (size_t c = 0; c < width; ++c) putchar('-');
+    putchar('\n');
+
+    format_time(label, sizeof label, duration - 1);
+    printf("%12s0%*s\n", "", (int)width - 1, label);
+
+    free(columns);
+}
+
+///
+/// PHASES
+///
+
+// Lists the runs of consecutive snapshots whose peaks are at least
+// `percent` of the overall peak.
+static void print_phases(struct timeline const* tl, unsigned long percent)
+{
+    struct rtipd_timeline_record const* r = tl->records;
+    uint64_t top = r[find_peak(tl)].peak_bytes;
+    uint64_t threshold = top / 100 * percent + top % 100 * percent / 100;
+    char start[32], duration[32], bytes[32];
+
+    printf("\nPhases at or above %lu%% of the peak:\n\n", percent);
+    printf("  %12s %12s %12s %12s\n",
+           "start", "duration", "peak", "allocations");
+
+    size_t i = 0;
+    while (i < tl->count) {
+        if (r[i].peak_bytes < threshold || !top) {
+            ++i;
+            continue;
+        }
+
+        // A snapshot's peak may have been reached any time since the
+        // one before, so the phase starts there.
+        uint64_t begin = i ? r[i - 1].time : 0;
+        uint64_t allocs_before = i ? r[i - 1].allocations : 0;
+        uint64_t phase_peak = 0;
+
+        while (i < tl->count && r[i].peak_bytes >= threshold) {
+            if (r[i].peak_bytes > phase_peak) phase_peak = r[i].peak_bytes;
+            ++i;
+        }
+
+        format_time(start, sizeof start, begin);
+        format_time(duration, sizeof duration, r[i - 1].time - begin);
+        format_bytes(bytes, sizeof bytes, phase_peak);
+        printf("  %12s %12s %12s %12" PRIu64 "\n",
+               start, duration, bytes,
+               r[i - 1].allocations - allocs_before);
+    }
+}
+
+static void print_summary(struct timeline const* tl)
+{
+    struct rtipd_timeline_record const* r = tl->records;
+    struct rtipd_timeline_record const* last = &r[tl->count - 1];
+    size_t peak_index = find_peak(tl);
+    char peak[32], when[32], live[32], every[32];
+
+    format_bytes(peak, sizeof peak, r[peak_index].peak_bytes);
+    format_time(when, sizeof when, r[peak_index].time);
+    format_bytes(live, sizeof live, last->live_bytes);
+
+    if (tl->header.unit == RTIPD_TIMELINE_BYTES)
+        format_bytes(every, sizeof every, tl->header.interval);
+    else
+        format_time(every, sizeof every, tl->header.interval);
+
+    printf("%zu snapshots, every %s%s; %" PRIu64 " allocations\n"
+           "peak %s by %s; %s live at exit\n\n",
+           tl->count, every,
+           tl->header.unit == RTIPD_TIMELINE_BYTES ? " allocated" : "",
+           last->allocations, peak, when, live);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t width = DEFAULT_WIDTH, height = DEFAULT_HEIGHT;
+    unsigned long percent = DEFAULT_PERCENT;
+    int opt;
+
+    if (argc > 0 && argv[0][0]) program_name = argv[0];
+
+    while ((opt = getopt(argc, argv, "w:h:p:")) != -1) {
+        switch (opt) {
+        case 'w': width   = parse_option(optarg, 8, 1000);  break;
+        case 'h': height  = parse_option(optarg, 2, 1000);  break;
+        case 'p': percent = parse_option(optarg, 1, 100);   break;
+        default:  usage();
+        }
+    }
+
+    if (optind + 1 != argc) usage();
+
+    struct timeline tl;
+    read_timeline(argv[optind], &tl);
+
+    if (!tl.count) {
+        printf("empty timeline\n");
+        return 0;
+    }
+
+    print_summary(&tl);
+    print_chart(&tl, width, height);
+    print_phases(&tl, percent);
+
+    free(tl.records);
+    return 0;
+}
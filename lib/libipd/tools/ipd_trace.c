@@ -0,0 +1,294 @@
+// ipd-trace – decodes binary allocation traces written by libipd when
+// RTIPD_TRACE_FORMAT=binary. See ipd-trace(1).
+
+#define _XOPEN_SOURCE 700
+
+#include "alloc_table.h"
+#include "alloc_trace_format.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_RECORDS  4096
+
+static char const* program_name = "ipd-trace";
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "Usage: %s [text|stats] FILE\n"
+            "\n"
+            "  text    print one line per recorded call (default)\n"
+            "  stats   print summary statistics\n",
+            program_name);
+    exit(2);
+}
+
+static FILE* open_trace(char const* path)
+{
+    FILE* fin = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+    if (!fin) {
+        perror(path);
+        exit(1);
+    }
+
+    struct rtipd_trace_header header;
+    if (fread(&header, sizeof header, 1, fin) != 1 ||
+            memcmp(header.magic, RTIPD_TRACE_MAGIC, sizeof header.magic))
+    {
+        fprintf(stderr, "%s: %s: not a binary allocation trace\n",
+                program_name, path);
+        exit(1);
+    }
+
+    if (header.byte_order != RTIPD_TRACE_BYTE_ORDER) {
+        fprintf(stderr, "%s: %s: trace has foreign byte order\n",
+                program_name, path);
+        exit(1);
+    }
+
+    if (header.version != RTIPD_TRACE_VERSION ||
+            header.record_size != sizeof(struct rtipd_trace_record))
+    {
+        fprintf(stderr, "%s: %s: unsupported trace version %u\n",
+                program_name, path, (unsigned) header.version);
+        exit(1);
+    }
+
+    return fin;
+}
+
+// Calls `visit` on every record in the trace, in file order.
+static void each_record(FILE* fin,
+                        void (*visit)(struct rtipd_trace_record const*,
+                                      void*),
+                        void* env)
+{
+    static struct rtipd_trace_record chunk[CHUNK_RECORDS];
+    size_t count;
+
+    while ((count = fread(chunk, sizeof *chunk, CHUNK_RECORDS, fin))) {
+        for (size_t i = 0; i < count; ++i)
+            visit(&chunk[i], env);
+    }
+
+    if (ferror(fin)) {
+        perror(program_name);
+        exit(1);
+    }
+}
+
+static char const* op_name(uint8_t op)
+{
+    switch (op) {
+    case RTIPD_TRACE_MALLOC:   return "malloc";
+    case RTIPD_TRACE_CALLOC:   return "calloc";
+    case RTIPD_TRACE_REALLOC:  return "realloc";
+    case RTIPD_TRACE_REALLOCF: return "reallocf";
+    case RTIPD_TRACE_FREE:     return "free";
+    default:                   return "?";
+    }
+}
+
+static void* as_pointer(uint64_t p)
+{
+    return (void*)(uintptr_t)p;
+}
+
+
+///
+/// TEXT
+///
+
+struct text_state
+{
+    bool     started;
+    uint64_t origin;
+};
+
+static void print_record(struct rtipd_trace_record const* r, void* env)
+{
+    struct text_state* st = env;
+
+    if (!st->started) {
+        st->origin  = r->timestamp;
+        st->started = true;
+    }
+
+    // Threads flush in blocks, so an early record can follow a late one:
+    int64_t rel = (int64_t)(r->timestamp - st->origin);
+    char sign = rel < 0 ? '-' : ' ';
+    uint64_t mag = rel < 0 ? (uint64_t)-rel : (uint64_t)rel;
+
+    printf("%c%" PRIu64 ".%09" PRIu64 " t%-3" PRIu32 " ",
+           sign, mag / 1000000000u, mag % 1000000000u, r->thread);
+
+    switch (r->op) {
+    case RTIPD_TRACE_MALLOC:
+    case RTIPD_TRACE_CALLOC:
+        printf("%s(%" PRIu64 ") = %p\n",
+               op_name(r->op), r->size, as_pointer(r->result));
+        break;
+
+    case RTIPD_TRACE_REALLOC:
+    case RTIPD_TRACE_REALLOCF:
+        printf("%s(%p, %" PRIu64 ") = %p\n",
+               op_name(r->op), as_pointer(r->pointer), r->size,
+               as_pointer(r->result));
+        break;
+
+    case RTIPD_TRACE_FREE:
+        printf("free(%p)\n", as_pointer(r->pointer));
+        break;
+
+    default:
+        printf("unknown op %u\n", (unsigned) r->op);
+        break;
+    }
+}
+
+
+///
+/// STATS
+///
+
+struct stats_state
+{
+    uint64_t           records;
+    uint64_t           calls[RTIPD_TRACE_FREE + 1];
+    uint64_t           failures;
+    uint64_t           bytes_requested;
+    uint64_t           live_bytes;
+    uint64_t           peak_bytes;
+    uint64_t           unmatched_frees;
+    uint32_t           threads;
+    uint64_t           first, last;
+    struct alloc_table live;
+};
+
+static void stats_add(struct stats_state* st, uint64_t p, uint64_t n)
+{
+    struct alloc_entry entry = {as_pointer(p), n, NULL, 0};
+
+    if (!alloc_table_insert(&st->live, entry)) {
+        perror(program_name);
+        exit(1);
+    }
+
+    st->live_bytes += n;
+    if (st->live_bytes > st->peak_bytes) st->peak_bytes = st->live_bytes;
+}
+
+static void stats_remove(struct stats_state* st, uint64_t p)
+{
+    struct alloc_entry entry;
+
+    if (alloc_table_remove(&st->live, as_pointer(p), &entry))
+        st->live_bytes -= entry.size;
+    else
+        ++st->unmatched_frees;
+}
+
+static void tally_record(struct rtipd_trace_record const* r, void* env)
+{
+    struct stats_state* st = env;
+
+    if (!st->records++) st->first = st->last = r->timestamp;
+    if (r->timestamp < st->first) st->first = r->timestamp;
+    if (r->timestamp > st->last)  st->last  = r->timestamp;
+    if (r->thread > st->threads)  st->threads = r->thread;
+
+    if (r->op <= RTIPD_TRACE_FREE) ++st->calls[r->op];
+
+    switch (r->op) {
+    case RTIPD_TRACE_MALLOC:
+    case RTIPD_TRACE_CALLOC:
+        st->bytes_requested += r->size;
+        if (r->result) stats_add(st, r->result, r->size);
+        else ++st->failures;
+        break;
+
+    case RTIPD_TRACE_REALLOC:
+    case RTIPD_TRACE_REALLOCF:
+        st->bytes_requested += r->size;
+        if (r->result) {
+            if (r->pointer) stats_remove(st, r->pointer);
+            stats_add(st, r->result, r->size);
+        } else {
+            ++st->failures;
+            // reallocf frees the old block when it fails:
+            if (r->op == RTIPD_TRACE_REALLOCF && r->pointer)
+                stats_remove(st, r->pointer);
+        }
+        break;
+
+    case RTIPD_TRACE_FREE:
+        if (r->pointer) stats_remove(st, r->pointer);
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void print_stats(struct stats_state const* st)
+{
+    double secs = (double)(st->last - st->first) * 1e-9;
+
+    printf("records:          %" PRIu64 "\n", st->records);
+    printf("threads:          %" PRIu32 "\n", st->threads);
+    printf("duration:         %.6f s\n", secs);
+
+    for (uint8_t op = RTIPD_TRACE_MALLOC; op <= RTIPD_TRACE_FREE; ++op)
+        printf("%-8s calls:   %" PRIu64 "\n", op_name(op), st->calls[op]);
+
+    printf("failed allocs:    %" PRIu64 "\n", st->failures);
+    printf("bytes requested:  %" PRIu64 "\n", st->bytes_requested);
+    printf("peak live bytes:  %" PRIu64 "\n", st->peak_bytes);
+    printf("live at end:      %" PRIu64 " bytes in %zu blocks\n",
+           st->live_bytes, st->live.count);
+    printf("unmatched frees:  %" PRIu64 "\n", st->unmatched_frees);
+
+    if (st->unmatched_frees)
+        printf("\n(Unmatched frees are expected in sampled traces, "
+               "which also\nundercount live and peak bytes.)\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+    if (argc > 0 && argv[0][0]) program_name = argv[0];
+
+    char const* command = "text";
+    char const* path;
+
+    if (argc == 2) {
+        path = argv[1];
+    } else if (argc == 3) {
+        command = argv[1];
+        path    = argv[2];
+    } else {
+        usage();
+    }
+
+    FILE* fin = open_trace(path);
+
+    if (strcmp(command, "text") == 0) {
+        struct text_state st = {false, 0};
+        each_record(fin, &print_record, &st);
+    } else if (strcmp(command, "stats") == 0) {
+        struct stats_state st;
+        memset(&st, 0, sizeof st);
+        st.live = (struct alloc_table) ALLOC_TABLE_INIT;
+        each_record(fin, &tally_record, &st);
+        print_stats(&st);
+        alloc_table_clear(&st.live);
+    } else {
+        usage();
+    }
+
+    return 0;
+}
@@ -0,0 +1,143 @@
+// Measures what the allocation runtime costs in each of its modes,
+// compared to calling the C library directly. Modes that are chosen by
+// environment variables at startup are run in a fresh copy of this
+// program with the variable set.
+
+#define _POSIX_C_SOURCE 200809L
+
+// We call the C library and the runtime side by side, so we ask for
+// the raw functions and name the runtime's explicitly.
+#define LIBIPD_RAW_ALLOC
+
+#include <ipd.h>
+#include <ipd_alloc_limit.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+void* rtipd_malloc(size_t);
+void  rtipd_free(void*);
+
+#define PAIRS   10000000
+#define BATCH   1000
+#define ROUNDS  10000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct allocator
+{
+    void* (*malloc)(size_t);
+    void  (*free)(void*);
+};
+
+static struct allocator const libc_allocator    = {malloc, free};
+static struct allocator const runtime_allocator = {rtipd_malloc, rtipd_free};
+
+// A malloc immediately followed by its free; returns ns per pair.
+static double pairs(struct allocator a)
+{
+    double start = now_ns();
+
+    for (size_t i = 0; i < PAIRS; ++i) {
+        void* volatile p = a.malloc(16 + i % 64);
+        a.free(p);
+    }
+
+    return (now_ns() - start) / PAIRS;
+}
+
+// Allocates a batch of blocks and then frees them all; returns ns per
+// malloc+free.
+static double batches(struct allocator a)
+{
+    static void* blocks[BATCH];
+    double start = now_ns();
+
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        for (size_t i = 0; i < BATCH; ++i)
+            blocks[i] = a.malloc(16 + i % 64);
+        for (size_t i = 0; i < BATCH; ++i)
+            a.free(blocks[i]);
+    }
+
+    return (now_ns() - start) / ((double)ROUNDS * BATCH);
+}
+
+static void row(char const* name, struct allocator a)
+{
+    double p = pairs(a);
+    double b = batches(a);
+    printf("%-26s %10.1f %10.1f\n", name, p, b);
+    fflush(stdout);
+}
+
+// Runs mode `name` in this program re-executed with `var` set to
+// `value` (and `var2` to `value2`, if given).
+static void row_in_child(char const* self, char const* name,
+                         char const* var, char const* value,
+                         char const* var2, char const* value2)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        setenv(var, value, 1);
+        if (var2) setenv(var2, value2, 1);
+        execl(self, self, name, (char*)NULL);
+        perror(self);
+        _exit(1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 2) {
+        if (strcmp(argv[1], "LIMIT_PEAK, headers") == 0)
+            alloc_limit_set_peak((size_t)1 << 40);
+        row(argv[1], runtime_allocator);
+        return 0;
+    }
+
+    printf("%-26s %10s %10s\n", "mode", "pairs", "batches");
+    printf("%-26s %10s %10s\n", "", "(ns/op)", "(ns/op)");
+
+    row("libc", libc_allocator);
+
+    row_in_child(argv[0], "NO_LIMIT, no stats",
+                 "RTIPD_ALLOC_STATS", "0", NULL, NULL);
+
+    alloc_limit_set_no_limit();
+    row("NO_LIMIT", runtime_allocator);
+
+    alloc_limit_set_total((size_t)1 << 40);
+    row("LIMIT_TOTAL", runtime_allocator);
+
+    alloc_limit_set_peak((size_t)1 << 40);
+    row("LIMIT_PEAK", runtime_allocator);
+
+    alloc_limit_set_no_limit();
+
+    row_in_child(argv[0], "LIMIT_PEAK, headers",
+                 "RTIPD_ALLOC_HEADERS", "1", NULL, NULL);
+    row_in_child(argv[0], "tracing (text)",
+                 "RTIPD_TRACE", "/dev/null", NULL, NULL);
+    row_in_child(argv[0], "tracing (binary)",
+                 "RTIPD_TRACE", "/dev/null",
+                 "RTIPD_TRACE_FORMAT", "binary");
+}
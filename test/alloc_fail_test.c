@@ -0,0 +1,118 @@
+// Tests allocation-failure injection and RUN_OOM_SWEEP.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+#include <ipd_alloc_limit.h>
+
+#include <stdbool.h>
+#include <string.h>
+
+struct list
+{
+    char*        word;
+    struct list* next;
+};
+
+static void free_list(struct list* list)
+{
+    while (list) {
+        struct list* next = list->next;
+        free(list->word);
+        free(list);
+        list = next;
+    }
+}
+
+// Builds a list of copies of `words`, cleaning up properly if any
+// allocation fails.
+static struct list* make_list(char const* const words[], size_t n)
+{
+    struct list* head = NULL;
+
+    while (n--) {
+        struct list* node = malloc(sizeof *node);
+        if (!node) goto fail;
+
+        node->word = malloc(strlen(words[n]) + 1);
+        if (!node->word) {
+            free(node);
+            goto fail;
+        }
+
+        strcpy(node->word, words[n]);
+        node->next = head;
+        head = node;
+    }
+
+    return head;
+
+fail:
+    free_list(head);
+    return NULL;
+}
+
+static void test_fail_at(void)
+{
+    alloc_fail_at(3);
+
+    void* a = malloc(1);
+    void* b = calloc(1, 1);
+    void* c = malloc(1);
+    void* d = realloc(NULL, 1);
+
+    CHECK( a != NULL );
+    CHECK( b != NULL );
+    CHECK_POINTER( c, NULL );
+    CHECK( d != NULL );
+    CHECK_SIZE( alloc_fail_count(), 4 );
+
+    free(a);
+    free(b);
+    free(d);
+}
+
+static size_t count_failures(double p, unsigned long seed)
+{
+    size_t failures = 0;
+
+    alloc_fail_randomly(p, seed);
+
+    for (int i = 0; i < 1000; ++i) {
+        void* block = malloc(8);
+        if (block) free(block);
+        else ++failures;
+    }
+
+    alloc_fail_at(0);
+    return failures;
+}
+
+static void test_fail_randomly(void)
+{
+    size_t some = count_failures(0.25, 7);
+    CHECK( 150 < some && some < 350 );
+    CHECK_SIZE( count_failures(0.25, 7), some );
+    CHECK_SIZE( count_failures(0, 7), 0 );
+    CHECK_SIZE( count_failures(1, 7), 1000 );
+}
+
+static void test_make_list(void)
+{
+    char const* const words[] = {"one", "two", "three", "four"};
+
+    struct list* list = make_list(words, 4);
+    if (!list) return;
+
+    CHECK_STRING( list->word, "one" );
+    CHECK_STRING( list->next->next->next->word, "four" );
+
+    free_list(list);
+}
+
+int main(void)
+{
+    RUN_TEST(test_fail_at);
+    RUN_TEST(test_fail_randomly);
+    RUN_OOM_SWEEP(test_make_list);
+}
@@ -0,0 +1,117 @@
+// Tests inline block headers and canaries. Run with RTIPD_ALLOC_CANARY=1.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+#include <ipd_alloc_limit.h>
+#include <ipd_alloc_stats.h>
+
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static size_t live_bytes(void)
+{
+    struct alloc_stats stats;
+    alloc_stats_get(&stats);
+    return stats.live_bytes;
+}
+
+static void test_header_sizes(void)
+{
+    size_t before = live_bytes();
+
+    char* s = malloc(13);
+    CHECK_SIZE( live_bytes(), before + 13 );
+
+    strcpy(s, "hello, world");
+    s = realloc(s, 200);
+    CHECK_STRING( s, "hello, world" );
+    CHECK_SIZE( live_bytes(), before + 200 );
+
+    free(s);
+    CHECK_SIZE( live_bytes(), before );
+}
+
+static void test_header_peak_limit(void)
+{
+    alloc_limit_set_peak(1000);
+
+    void* a = malloc(600);
+    CHECK( a != NULL );
+    CHECK_POINTER( malloc(600), NULL );
+
+    a = realloc(a, 900);
+    CHECK( a != NULL );
+    CHECK_POINTER( malloc(200), NULL );
+
+    free(a);
+    a = malloc(1000);
+    CHECK( a != NULL );
+    free(a);
+
+    alloc_limit_set_no_limit();
+}
+
+// A block from an old limit isn't refunded to a new one, however many
+// limits came in between.
+static void test_header_old_epoch(void)
+{
+    alloc_limit_set_peak(1000);
+    void* old = malloc(600);
+    CHECK( old != NULL );
+
+    for (int i = 0; i < 65536; ++i) alloc_limit_set_peak(1000);
+
+    free(old);
+    CHECK_POINTER( malloc(1200), NULL );
+
+    alloc_limit_set_no_limit();
+}
+
+// Runs `fn` in a child and returns the signal that killed it, or 0.
+static int crash_signal(void (*fn)(void))
+{
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Don't clutter the log with the child's report.
+        freopen("/dev/null", "w", stderr);
+        fn();
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+}
+
+static void overflow(void)
+{
+    char* volatile s = malloc(8);
+    memset(s, 'x', 9);
+    free(s);
+}
+
+static void double_free(void)
+{
+    char* s = malloc(8);
+    free(s);
+    free(s);
+}
+
+static void test_canaries(void)
+{
+    CHECK_INT( crash_signal(&overflow), SIGABRT );
+    CHECK_INT( crash_signal(&double_free), SIGABRT );
+}
+
+int main(void)
+{
+    RUN_TEST(test_header_sizes);
+    RUN_TEST(test_header_peak_limit);
+    RUN_TEST(test_header_old_epoch);
+    RUN_TEST(test_canaries);
+}
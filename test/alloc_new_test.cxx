@@ -0,0 +1,165 @@
+// Tests that operator new and delete go through the allocation runtime
+// when a C++ program is built with IPD_ALLOC. (It has its own `main`
+// rather than using Catch, which allocates.)
+
+#include <ipd_alloc_limit.h>
+#include <ipd_alloc_stats.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(A) \
+    do { \
+        if (!(A)) { \
+            std::fprintf(stderr, "%s:%d: check failed: %s\n", \
+                         __FILE__, __LINE__, #A); \
+            ++failures; \
+        } \
+    } while (false)
+
+static size_t live_bytes()
+{
+    alloc_stats s;
+    alloc_stats_get(&s);
+    return s.live_bytes;
+}
+
+static void test_new_is_counted()
+{
+    size_t before = live_bytes();
+    alloc_stats_reset();
+
+    int* p = new int(5);
+    int* a = new int[100];
+
+    alloc_stats s;
+    alloc_stats_get(&s);
+    CHECK( s.malloc_calls == 2 );
+    CHECK( s.total_bytes >= sizeof(int) * 101 );
+    CHECK( s.live_bytes >= before + sizeof(int) * 101 );
+
+    delete p;
+    delete[] a;
+
+    alloc_stats_get(&s);
+    CHECK( s.free_calls == 2 );
+    CHECK( s.live_bytes == before );
+}
+
+static void test_peak_limit_throws()
+{
+    alloc_limit_set_peak(1000);
+
+    std::vector<char> small(500);
+    CHECK( small.size() == 500 );
+
+    bool threw = false;
+    try {
+        std::vector<char> big(2000);
+    } catch (std::bad_alloc const&) {
+        threw = true;
+    }
+    CHECK( threw );
+
+    // Freeing refunds the limit, as in C.
+    small = std::vector<char>();
+    small.shrink_to_fit();
+    std::vector<char> again(900);
+    CHECK( again.size() == 900 );
+
+    alloc_limit_set_no_limit();
+}
+
+static void test_nothrow_returns_null()
+{
+    alloc_limit_set_total(64);
+
+    char* p = new (std::nothrow) char[128];
+    CHECK( p == nullptr );
+
+    char* q = new (std::nothrow) char[32];
+    CHECK( q != nullptr );
+    delete[] q;
+
+    alloc_limit_set_no_limit();
+}
+
+static int handler_calls = 0;
+
+static void relent()
+{
+    ++handler_calls;
+    alloc_limit_set_no_limit();
+}
+
+static void test_new_handler_retries()
+{
+    alloc_limit_set_peak(16);
+    std::set_new_handler(&relent);
+
+    auto s = std::make_unique<std::string>(100, 'x');
+    CHECK( handler_calls == 1 );
+    CHECK( s->size() == 100 );
+
+    std::set_new_handler(nullptr);
+}
+
+struct alignas(64) cache_line
+{
+    char bytes[64];
+};
+
+static void test_aligned_new()
+{
+    size_t before = live_bytes();
+    alloc_stats_reset();
+
+    auto* lines = new cache_line[3];
+    CHECK( reinterpret_cast<std::uintptr_t>(lines) % 64 == 0 );
+
+    alloc_stats s;
+    alloc_stats_get(&s);
+    CHECK( s.malloc_calls == 1 );
+
+    delete[] lines;
+
+    alloc_stats_get(&s);
+    CHECK( s.free_calls == 1 );
+    CHECK( s.live_bytes == before );
+}
+
+static void test_failure_injection()
+{
+    alloc_fail_at(2);
+
+    auto* a = new (std::nothrow) int;
+    auto* b = new (std::nothrow) int;
+    CHECK( a != nullptr );
+    CHECK( b == nullptr );
+
+    delete a;
+    alloc_fail_at(0);
+}
+
+int main()
+{
+    test_new_is_counted();
+    test_peak_limit_throws();
+    test_nothrow_returns_null();
+    test_new_handler_retries();
+    test_aligned_new();
+    test_failure_injection();
+
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
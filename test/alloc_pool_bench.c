@@ -0,0 +1,116 @@
+// Compares the C library allocator with the pooled backend on the
+// allocation patterns of linked data structures, and compares freeing
+// a structure node by node with alloc_pool_reset().
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+#include <ipd_alloc_pool.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define NODES   1000000
+#define ROUNDS  5
+
+struct node
+{
+    long         value;
+    struct node* next;
+};
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static struct node* build_list(size_t n)
+{
+    struct node* head = NULL;
+
+    for (size_t i = 0; i < n; ++i) {
+        struct node* node = malloc(sizeof *node);
+        node->value = (long)i;
+        node->next  = head;
+        head = node;
+    }
+
+    return head;
+}
+
+static void free_list(struct node* list)
+{
+    while (list) {
+        struct node* next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+// Builds and frees a list; returns ns per node.
+static double list_churn(bool reset)
+{
+    double start = now_ns();
+
+    for (int r = 0; r < ROUNDS; ++r) {
+        struct node* list = build_list(NODES);
+        if (reset) alloc_pool_reset();
+        else free_list(list);
+    }
+
+    return (now_ns() - start) / (ROUNDS * (double)NODES);
+}
+
+// Replaces random blocks of mixed small sizes; returns ns per
+// free+malloc.
+static double mixed_churn(void)
+{
+    enum { LIVE = 4096 };
+    static void* live[LIVE];
+    uint64_t rng = 88172645463325252u;
+
+    for (size_t i = 0; i < LIVE; ++i) live[i] = malloc(8 + i % 256);
+
+    double start = now_ns();
+    for (size_t k = 0; k < ROUNDS * (size_t)NODES; ++k) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+
+        size_t i = rng % LIVE;
+        free(live[i]);
+        live[i] = malloc(8 + rng % 512);
+    }
+    double ns = (now_ns() - start) / (ROUNDS * (double)NODES);
+
+    for (size_t i = 0; i < LIVE; ++i) free(live[i]);
+    return ns;
+}
+
+static void row(char const* name, double libc_ns, double pool_ns)
+{
+    printf("%-24s %10.1f %10.1f %9.2fx\n",
+           name, libc_ns, pool_ns, libc_ns / pool_ns);
+}
+
+int main(void)
+{
+    printf("%-24s %10s %10s %10s\n", "workload", "libc", "pool", "speedup");
+    printf("%-24s %10s %10s\n", "", "(ns/op)", "(ns/op)");
+
+    alloc_pool_disable();
+    double libc_list  = list_churn(false);
+    double libc_mixed = mixed_churn();
+
+    alloc_pool_enable();
+    double pool_list  = list_churn(false);
+    double pool_mixed = mixed_churn();
+    double pool_reset = list_churn(true);
+
+    row("list build+free", libc_list, pool_list);
+    row("list build+reset", libc_list, pool_reset);
+    row("mixed free+malloc", libc_mixed, pool_mixed);
+}
@@ -0,0 +1,88 @@
+// Tests the pooled allocation backend and alloc_pool_reset().
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+#include <ipd_alloc_limit.h>
+#include <ipd_alloc_pool.h>
+#include <ipd_alloc_stats.h>
+
+#include <string.h>
+
+static size_t live_bytes(void)
+{
+    struct alloc_stats stats;
+    alloc_stats_get(&stats);
+    return stats.live_bytes;
+}
+
+static void test_pool_blocks(void)
+{
+    alloc_pool_enable();
+
+    char* s = malloc(10);
+    strcpy(s, "pooled");
+
+    // Growing within the size class keeps the block; growing past the
+    // largest class moves it to the C library.
+    CHECK_POINTER( realloc(s, 16), s );
+    s = realloc(s, 4000);
+    CHECK_STRING( s, "pooled" );
+    s = realloc(s, 100);
+    CHECK_STRING( s, "pooled" );
+
+    memset(s, 'x', 100);
+    free(s);
+
+    unsigned char* z = calloc(25, 4);
+    size_t nonzero = 0;
+    for (size_t i = 0; i < 100; ++i) nonzero += z[i] != 0;
+    CHECK_SIZE( nonzero, 0 );
+    free(z);
+
+    alloc_pool_disable();
+}
+
+static void test_pool_stats(void)
+{
+    void* blocks[100];
+
+    alloc_pool_enable();
+    size_t before = live_bytes();
+
+    for (size_t i = 0; i < 100; ++i) blocks[i] = malloc(24);
+    CHECK_SIZE( live_bytes(), before + 100 * 32 );
+
+    for (size_t i = 0; i < 100; ++i) free(blocks[i]);
+    CHECK_SIZE( live_bytes(), before );
+}
+
+static void test_pool_reset(void)
+{
+    alloc_pool_enable();
+    size_t before = live_bytes();
+
+    for (size_t i = 0; i < 10000; ++i) malloc(1 + i % 700);
+    CHECK( live_bytes() > before );
+
+    alloc_pool_reset();
+    CHECK_SIZE( live_bytes(), before );
+
+    // Reset blocks are refunded to a peak limit, too.
+    alloc_limit_set_peak(64 * 1024);
+    size_t count = 0;
+    while (malloc(64)) ++count;
+    CHECK_SIZE( count, 1024 );
+
+    alloc_pool_reset();
+    CHECK( malloc(64) != NULL );
+
+    alloc_limit_set_no_limit();
+}
+
+int main(void)
+{
+    RUN_TEST(test_pool_blocks);
+    RUN_TEST(test_pool_stats);
+    RUN_TEST(test_pool_reset);
+}
@@ -0,0 +1,79 @@
+// Measures the cost of free() and realloc() under a peak allocation
+// limit as the number of live blocks grows. With constant-time
+// tracking the ns/op columns should stay roughly flat.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+#include <ipd_alloc_limit.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define OPS  200000
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// xorshift, so the access pattern doesn't favor any part of the table
+static size_t next_index(uint64_t* state, size_t n)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return (size_t)(*state % n);
+}
+
+static void run(size_t live)
+{
+    void** blocks = malloc(live * sizeof *blocks);
+    if (!blocks) {
+        perror("alloc_table_bench");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < live; ++i) {
+        blocks[i] = malloc(16);
+    }
+
+    uint64_t rng = 88172645463325252u;
+
+    double start = now_ns();
+    for (size_t k = 0; k < OPS; ++k) {
+        size_t i = next_index(&rng, live);
+        free(blocks[i]);
+        blocks[i] = malloc(16);
+    }
+    double free_ns = (now_ns() - start) / OPS;
+
+    start = now_ns();
+    for (size_t k = 0; k < OPS; ++k) {
+        size_t i = next_index(&rng, live);
+        blocks[i] = realloc(blocks[i], k % 2 ? 16 : 48);
+    }
+    double realloc_ns = (now_ns() - start) / OPS;
+
+    for (size_t i = 0; i < live; ++i) {
+        free(blocks[i]);
+    }
+    free(blocks);
+
+    printf("%10zu %14.1f %14.1f\n", live, free_ns, realloc_ns);
+}
+
+int main(void)
+{
+    alloc_limit_set_peak(SIZE_MAX / 2);
+
+    printf("%10s %14s %14s\n", "live", "free+malloc", "realloc");
+    printf("%10s %14s %14s\n", "blocks", "(ns/op)", "(ns/op)");
+
+    for (size_t live = 1000; live <= 1000000; live *= 10) {
+        run(live);
+    }
+}
@@ -0,0 +1,159 @@
+// Hammers rtipd_malloc/rtipd_free from several threads at once, checks
+// that the limit accounting and statistics come out exact, and reports
+// how throughput scales with the number of threads.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+#include <ipd_alloc_limit.h>
+#include <ipd_alloc_stats.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#define MAX_THREADS     8
+#define OPS_PER_THREAD  200000
+#define WINDOW          64
+#define PEAK_LIMIT      ((size_t)1 << 30)
+#define BLOCK           64
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Each thread keeps a small window of live blocks of varying sizes,
+// replacing a pseudo-random one on every step.
+static void* churn(void* arg)
+{
+    uint64_t rng = (uintptr_t)arg * 2654435761u + 1;
+    void* live[WINDOW] = {NULL};
+
+    for (size_t k = 0; k < OPS_PER_THREAD; ++k) {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+
+        size_t i = rng % WINDOW;
+        free(live[i]);
+        live[i] = k % 3 == 0
+            ? realloc(NULL, 8 + rng % 512)
+            : malloc(8 + rng % 512);
+    }
+
+    for (size_t i = 0; i < WINDOW; ++i)
+        free(live[i]);
+
+    return NULL;
+}
+
+// Allocates fixed-size blocks until the limit says no, returning the
+// number it got. (The blocks are leaked on purpose.)
+static void* drain(void* arg)
+{
+    (void) arg;
+
+    size_t count = 0;
+    while (malloc(BLOCK)) ++count;
+
+    return (void*)(uintptr_t)count;
+}
+
+static double run_threads(size_t n, void* (*fn)(void*), size_t* sum)
+{
+    pthread_t threads[MAX_THREADS];
+
+    double start = now_s();
+
+    for (size_t i = 0; i < n; ++i)
+        pthread_create(&threads[i], NULL, fn, (void*)(uintptr_t)(i + 1));
+
+    for (size_t i = 0; i < n; ++i) {
+        void* result;
+        pthread_join(threads[i], &result);
+        if (sum) *sum += (uintptr_t)result;
+    }
+
+    return now_s() - start;
+}
+
+static void test_peak_accounting(void)
+{
+    alloc_limit_set_peak(PEAK_LIMIT);
+    run_threads(MAX_THREADS, &churn, NULL);
+
+    // Every byte should have been given back:
+    void* all = malloc(PEAK_LIMIT);
+    CHECK( all != NULL );
+    CHECK_POINTER( malloc(1), NULL );
+    free(all);
+}
+
+static void test_total_accounting(void)
+{
+    size_t const blocks = 10000;
+    size_t got = 0;
+
+    alloc_limit_set_total(blocks * BLOCK);
+    run_threads(MAX_THREADS, &drain, &got);
+
+    CHECK_SIZE( got, blocks );
+}
+
+static void test_stats_accounting(void)
+{
+    size_t const replaced = OPS_PER_THREAD / 3 + (OPS_PER_THREAD % 3 != 0);
+    struct alloc_stats stats;
+
+    alloc_limit_set_no_limit();
+    alloc_stats_get(&stats);
+    size_t live_before = stats.live_bytes;
+
+    alloc_stats_reset();
+    run_threads(MAX_THREADS, &churn, NULL);
+    alloc_stats_get(&stats);
+
+    CHECK_SIZE( stats.live_bytes, live_before );
+    CHECK( stats.peak_bytes > live_before );
+    CHECK_SIZE( stats.realloc_calls, MAX_THREADS * replaced );
+    CHECK_SIZE( stats.malloc_calls,
+                MAX_THREADS * (OPS_PER_THREAD - replaced) );
+    CHECK_SIZE( stats.calloc_calls, 0 );
+    CHECK_SIZE( stats.free_calls, MAX_THREADS * (OPS_PER_THREAD + WINDOW) );
+
+    // Every block is between 8 and 519 bytes:
+    size_t in_range = 0;
+    for (size_t k = 4; k <= 10; ++k)
+        in_range += stats.size_classes[k];
+    CHECK_SIZE( in_range, MAX_THREADS * OPS_PER_THREAD );
+}
+
+static void report_scaling(void)
+{
+    double base = 0;
+
+    alloc_limit_set_peak(PEAK_LIMIT);
+
+    printf("\n%8s %14s %9s\n", "threads", "Mops/s", "speedup");
+
+    for (size_t n = 1; n <= MAX_THREADS; n *= 2) {
+        double secs = run_threads(n, &churn, NULL);
+        double mops = n * OPS_PER_THREAD / secs * 1e-6;
+        if (n == 1) base = mops;
+        printf("%8zu %14.2f %8.2fx\n", n, mops, mops / base);
+    }
+
+    alloc_limit_set_no_limit();
+}
+
+int main(void)
+{
+    RUN_TEST(test_peak_accounting);
+    RUN_TEST(test_total_accounting);
+    RUN_TEST(test_stats_accounting);
+    report_scaling();
+}
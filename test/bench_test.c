@@ -0,0 +1,34 @@
+// Checks that BENCH calibrates, summarizes, and writes its output.
+// CMake runs it with short settings and checks what it prints.
+
+#include <ipd.h>
+
+#define COUNT 1000
+
+static long numbers[COUNT];
+
+static void sum_numbers(void* arg)
+{
+    long const* p = arg;
+    long sum = 0;
+    for (size_t i = 0; i < COUNT; ++i) sum += p[i];
+    bench_do_not_optimize(&sum);
+}
+
+static void do_nothing(void* arg)
+{
+    bench_do_not_optimize(arg);
+}
+
+int main(void)
+{
+    for (size_t i = 0; i < COUNT; ++i) numbers[i] = (long) i;
+
+    struct bench_stats sum = BENCH("sum \"1000\"", sum_numbers, numbers);
+    struct bench_stats nothing = BENCH("nothing", do_nothing, NULL);
+
+    CHECK( sum.min <= sum.median && sum.median <= sum.max );
+    CHECK( sum.min <= sum.mean && sum.mean <= sum.max );
+    CHECK( sum.calls_per_sample >= 1 );
+    CHECK( nothing.calls_per_sample > sum.calls_per_sample );
+}
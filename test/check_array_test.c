@@ -0,0 +1,107 @@
+// Tests CHECK_ARRAY_EQ, CHECK_MEMORY_EQ, and CHECK_DOUBLE_ARRAY_NEAR.
+// Some checks are supposed to fail, so CMake checks the output instead
+// of the exit status.
+
+#include <ipd.h>
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define COUNT 10000
+
+static int    ints_a[COUNT], ints_b[COUNT];
+static double doubles_a[COUNT], doubles_b[COUNT];
+
+static void fill(void)
+{
+    for (int i = 0; i < COUNT; ++i) {
+        ints_a[i]    = ints_b[i]    = i * i;
+        doubles_a[i] = doubles_b[i] = i / 7.0;
+    }
+}
+
+// The next double up from positive `x`.
+static double next_up(double x)
+{
+    int64_t bits;
+    memcpy(&bits, &x, sizeof bits);
+    ++bits;
+    memcpy(&x, &bits, sizeof x);
+    return x;
+}
+
+static void test_equal(void)
+{
+    fill();
+
+    CHECK_ARRAY_EQ( ints_a, ints_b, COUNT );
+    CHECK_MEMORY_EQ( ints_a, ints_b, sizeof ints_a );
+    CHECK_MEMORY_EQ( NULL, NULL, 0 );
+    CHECK_ARRAY_EQ( "hello", "help!", 3 );
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 0, 0, 0 );
+}
+
+static void test_near(void)
+{
+    fill();
+
+    doubles_b[100] = next_up(doubles_a[100]);
+    doubles_a[400] = doubles_b[400] = NAN;
+    doubles_a[0]   = -0.0;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 0, 0, 1 );
+
+    doubles_b[200] = doubles_a[200] * (1 + 1e-10);
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 0, 1e-9, 1 );
+
+    doubles_b[300] = doubles_a[300] + 1e-6;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 1e-5, 1e-9, 1 );
+
+    doubles_a[500] = doubles_b[500] = INFINITY;
+    doubles_a[600] = doubles_b[600] = -INFINITY;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 1e-5, 1e-9, 1 );
+}
+
+static void test_different(void)
+{
+    fill();
+
+    ints_b[7000] = -1;
+    ints_b[9999] = -1;
+    CHECK_ARRAY_EQ( ints_a, ints_b, COUNT );
+
+    CHECK_MEMORY_EQ( "abcdefghijklmnopqrstuvwxyz",
+                     "abcdefghijklmnopqrsTuvwxyz", 26 );
+
+    char short_have[] = {'a', 'b', 'c'}, short_want[] = {'a', 'x', 'c'};
+    CHECK_ARRAY_EQ( short_have, short_want, 3 );
+
+    doubles_b[3] = doubles_a[3] + 1e-3;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 1e-6, 0, 4 );
+
+    fill();
+    doubles_a[5] = NAN;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 1e-6, 0, 4 );
+
+    fill();
+    doubles_a[20] = INFINITY;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 0, 1e-9, 0 );
+
+    fill();
+    doubles_a[30] = INFINITY;
+    doubles_b[30] = DBL_MAX;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 0, 0, 1 );
+
+    fill();
+    doubles_a[40] = INFINITY;
+    doubles_b[40] = -INFINITY;
+    CHECK_DOUBLE_ARRAY_NEAR( doubles_a, doubles_b, COUNT, 0, 1e-9, 4 );
+}
+
+int main(void)
+{
+    RUN_TEST(test_equal);
+    RUN_TEST(test_near);
+    RUN_TEST(test_different);
+}
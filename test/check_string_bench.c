@@ -0,0 +1,86 @@
+// Measures how long a failing CHECK_STRING takes to report, for strings
+// of several sizes, against printing the strings one eprintf per byte
+// as the failure messages used to. Failure messages go to /dev/null.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static char* make_string(size_t len, char last)
+{
+    char* s = malloc(len + 1);
+    for (size_t i = 0; i < len; ++i) s[i] = "abc\n"[i % 4];
+    s[len - 1] = last;
+    s[len] = 0;
+    return s;
+}
+
+// The old way: one flushed write per byte.
+static void eprintf_per_byte(char const* s)
+{
+    eprintf("\"");
+    for ( ; *s; ++s) {
+        if (*s == '\n') eprintf("\\n");
+        else eprintf("%c", *s);
+    }
+    eprintf("\"");
+}
+
+static void bench(size_t len, int rounds, bool per_byte)
+{
+    char* have = make_string(len, 'x');
+    char* want = make_string(len, 'y');
+
+    double start = now_ns();
+
+    for (int r = 0; r < rounds; ++r) {
+        if (per_byte) {
+            eprintf("  have: ");
+            eprintf_per_byte(have);
+            eprintf("\n  want: ");
+            eprintf_per_byte(want);
+            eprintf("\n");
+        } else {
+            CHECK_STRING( have, want );
+        }
+    }
+
+    double us = (now_ns() - start) / rounds / 1e3;
+    printf("%10zu bytes  %-16s %12.1f us per failure\n",
+           len, per_byte ? "eprintf per byte" : "CHECK_STRING", us);
+
+    free(have);
+    free(want);
+}
+
+int main(void)
+{
+    if (!freopen("/dev/null", "w", stderr)) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    bench(100, 1000, false);
+    bench(100, 1000, true);
+    bench(1000, 1000, false);
+    bench(1000, 100, true);
+    bench(1000000, 100, false);
+    bench(1000000, 1, true);
+    bench(10000000, 10, false);
+
+    // Every check failed on purpose, so skip the failing exit status.
+    fflush(stdout);
+    _exit(0);
+}
@@ -0,0 +1,34 @@
+// Tests how a failing CHECK_STRING describes where long strings
+// differ. Every check here fails, so CMake checks the output instead of
+// the exit status.
+
+#include <ipd.h>
+
+#include <string.h>
+
+// 1000 lines of "line N".
+static char* make_lines(void)
+{
+    char* s = malloc(16 * 1000);
+    char* p = s;
+    for (int i = 1; i <= 1000; ++i) p += sprintf(p, "line %d\n", i);
+    return s;
+}
+
+int main(void)
+{
+    char* have = make_lines();
+    char* want = make_lines();
+
+    // Changes line 500 ("line 500" to "line 5X0") and drops line 700.
+    char* p = strstr(want, "line 500\n");
+    p[6] = 'X';
+    p = strstr(want, "line 700\n");
+    memmove(p, p + 9, strlen(p + 9) + 1);
+
+    CHECK_STRING( have, want );
+    CHECK_STRING( "abc", "abcdef" );
+
+    free(have);
+    free(want);
+}
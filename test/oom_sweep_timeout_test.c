@@ -0,0 +1,25 @@
+// Tests that RUN_OOM_SWEEP gives up on runs that hang once an
+// allocation fails. The sweep is supposed to fail, so CMake checks the
+// output instead of the exit status.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+static void test_hangs_without_memory(void)
+{
+    void* a = malloc(8);
+    void* b = malloc(8);
+
+    // Waits forever for memory that never comes.
+    if (!b) for (;;) { }
+
+    CHECK( a != NULL );
+    free(a);
+    free(b);
+}
+
+int main(void)
+{
+    RUN_OOM_SWEEP(test_hangs_without_memory);
+}
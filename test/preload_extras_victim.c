@@ -0,0 +1,81 @@
+// A program that knows nothing of libipd and uses glibc's less common
+// allocation functions, for running with the allocation runtime
+// preloaded and block headers, canaries, or pooling turned on. Exits
+// with status 0 if each block held what the runtime said it could.
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int check_usable_size(void)
+{
+    char* small = malloc(10);
+    if (!small) return 1;
+
+    size_t n = malloc_usable_size(small);
+    if (n < 10 || n > 4096) {
+        fprintf(stderr, "malloc_usable_size gave %zu for 10 bytes\n", n);
+        return 1;
+    }
+
+    // All of it is ours to use, so this mustn't trip a canary.
+    memset(small, 'x', n);
+    free(small);
+    return 0;
+}
+
+static int check_reallocarray(void)
+{
+    int* a = reallocarray(NULL, 100, sizeof *a);
+    if (!a) return 1;
+    for (int i = 0; i < 100; ++i) a[i] = i;
+
+    int* b = reallocarray(a, 1000, sizeof *b);
+    if (!b) return 1;
+    for (int i = 0; i < 100; ++i) {
+        if (b[i] != i) {
+            fprintf(stderr, "reallocarray lost element %d\n", i);
+            return 1;
+        }
+    }
+
+    // Volatile, so that the compiler doesn't warn that it's too much.
+    size_t volatile too_many = SIZE_MAX;
+
+    errno = 0;
+    if (reallocarray(b, too_many, 2) || errno != ENOMEM) {
+        fprintf(stderr, "reallocarray didn't catch overflow\n");
+        return 1;
+    }
+
+    free(b);
+    return 0;
+}
+
+static int check_pvalloc(void)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    char* p = pvalloc(100);
+    if (!p) return 1;
+
+    if ((uintptr_t)p % page != 0 || malloc_usable_size(p) < page) {
+        fprintf(stderr, "pvalloc didn't give a whole page\n");
+        return 1;
+    }
+
+    memset(p, 'y', page);
+    free(p);
+    return 0;
+}
+
+int main(void)
+{
+    return check_usable_size() || check_reallocarray() || check_pvalloc();
+}
@@ -0,0 +1,48 @@
+// A program that knows nothing of libipd, for running with the
+// allocation runtime preloaded and a peak limit of 64 KiB. Exits with
+// status 0 if the limit was enforced and freeing gave the memory back.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BLOCK       1024
+#define MAX_BLOCKS  1024
+
+static size_t fill(void* blocks[])
+{
+    size_t n = 0;
+    while (n < MAX_BLOCKS && (blocks[n] = malloc(BLOCK))) ++n;
+    return n;
+}
+
+int main(void)
+{
+    static void* blocks[MAX_BLOCKS];
+
+    size_t first = fill(blocks);
+    if (first == MAX_BLOCKS || errno != ENOMEM) {
+        fprintf(stderr, "limit not enforced (%zu blocks)\n", first);
+        return 1;
+    }
+
+    for (size_t i = 0; i < first; ++i) free(blocks[i]);
+
+    size_t second = fill(blocks);
+    if (second != first) {
+        fprintf(stderr, "got %zu blocks, then %zu\n", first, second);
+        return 1;
+    }
+
+    for (size_t i = 0; i < second; ++i) free(blocks[i]);
+
+    void* aligned;
+    if (posix_memalign(&aligned, 64, 128 * BLOCK) != ENOMEM) {
+        fprintf(stderr, "posix_memalign not limited\n");
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+// Tests TEST, TAGGED_TEST, and the runner that libipd supplies when the
+// program doesn't define `main`. CMake runs it with several selections.
+
+#include <ipd.h>
+
+#include <string.h>
+
+TEST(string_length)
+{
+    CHECK_SIZE( strlen("hello"), 5 );
+}
+
+TAGGED_TEST(string_copy, "string, fast")
+{
+    char buf[8];
+    strcpy(buf, "hello");
+    CHECK_STRING( buf, "hello" );
+}
+
+TAGGED_TEST(arithmetic, "fast")
+{
+    CHECK_INT( 6 * 7, 42 );
+}
+
+TAGGED_TEST(counting_up, "slow")
+{
+    long sum = 0;
+    for (long i = 1; i <= 1000000; ++i) sum += i;
+    CHECK_INT( sum, 500000500000 );
+}
@@ -0,0 +1,35 @@
+// Tests that RUN_TEST finishes a parallel test when the test returns,
+// even though it leaves a process behind that holds its stdout open.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <unistd.h>
+
+static void test_leaves_sleeper(void)
+{
+    printf("starting sleeper\n");
+    fflush(stdout);
+
+    if (fork() == 0) {
+        sleep(20);
+        _exit(0);
+    }
+
+    CHECK( 1 + 1 == 2 );
+}
+
+static void test_fast(void)
+{
+    CHECK( 2 + 2 == 4 );
+}
+
+int main(void)
+{
+    run_tests_in_parallel(2);
+
+    RUN_TEST(test_leaves_sleeper);
+    RUN_TEST(test_fast);
+    RUN_TEST(test_leaves_sleeper);
+}
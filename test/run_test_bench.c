@@ -0,0 +1,93 @@
+// Measures what RUN_TEST costs per test when it forks a child for each
+// test and when it runs them in this process, as the heap grows. Each
+// combination runs in a fresh copy of this program, with test output
+// sent to /dev/null.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define TESTS  500
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void test_tiny(void)
+{
+    CHECK_INT( 6 * 7, 42 );
+}
+
+static void measure(char const* mode, size_t heap_mb)
+{
+    int out = dup(STDOUT_FILENO);
+    if (out < 0 || !freopen("/dev/null", "w", stdout)) {
+        perror("/dev/null");
+        _exit(1);
+    }
+
+    // Touch every page, as a program that loaded a big dataset would.
+    size_t size = heap_mb << 20;
+    char* heap = size ? malloc(size) : NULL;
+    if (size && !heap) {
+        perror("malloc");
+        _exit(1);
+    }
+    if (heap) memset(heap, 1, size);
+
+    run_tests_in_process(strcmp(mode, "in-process") == 0);
+
+    double start = now_ns();
+    for (int i = 0; i < TESTS; ++i) RUN_TEST(test_tiny);
+    double us = (now_ns() - start) / TESTS / 1e3;
+
+    dprintf(out, "%8zu MB  %-12s %10.1f us per test\n", heap_mb, mode, us);
+    free(heap);
+}
+
+static void measure_in_child(char const* self, char const* mode,
+                             char const* heap_mb)
+{
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        execl(self, self, mode, heap_mb, (char*)NULL);
+        perror(self);
+        _exit(1);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc == 3) {
+        measure(argv[1], strtoul(argv[2], NULL, 10));
+        return 0;
+    }
+
+    printf("%8s     %-12s %10s\n", "heap", "mode", "RUN_TEST");
+    fflush(stdout);
+
+    char const* const heaps[] = {"0", "256", "1024"};
+    for (size_t i = 0; i < sizeof heaps / sizeof *heaps; ++i) {
+        measure_in_child(argv[0], "fork", heaps[i]);
+        measure_in_child(argv[0], "in-process", heaps[i]);
+    }
+}
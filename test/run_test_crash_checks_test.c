@@ -0,0 +1,29 @@
+// Tests that RUN_TEST counts the checks a test made before crashing.
+// The tests are supposed to fail, so CMake checks the output instead of
+// the exit status.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <unistd.h>
+
+static void test_checks_then_crashes(void)
+{
+    CHECK( 1 + 1 == 2 );
+    CHECK_INT( 2 + 2, 4 );
+    CHECK_INT( 1 + 1, 3 );
+    *(int volatile*)0 = 0;
+}
+
+static void test_checks_then_exits(void)
+{
+    CHECK( 1 + 1 == 2 );
+    _exit(0);
+}
+
+int main(void)
+{
+    RUN_TEST(test_checks_then_crashes);
+    RUN_TEST(test_checks_then_exits);
+}
@@ -0,0 +1,62 @@
+// Tests that RUN_TESTS_WITH_FIXTURE builds its fixture once, shares it
+// with every test, and keeps one test's changes from the next.
+
+#include <ipd.h>
+
+#include <stdlib.h>
+
+#define TABLE_SIZE  (1 << 20)
+
+static int  setup_calls = 0;
+static int* table       = NULL;
+
+static void build_table(void)
+{
+    ++setup_calls;
+    table = malloc(TABLE_SIZE * sizeof *table);
+    for (int i = 0; i < TABLE_SIZE; ++i) table[i] = i * 3;
+}
+
+static void free_table(void)
+{
+    free(table);
+    table = NULL;
+    printf("torn down after %d setup\n", setup_calls);
+}
+
+static void test_sees_table(void)
+{
+    CHECK_INT( setup_calls, 1 );
+    CHECK_INT( table[0], 0 );
+    CHECK_INT( table[TABLE_SIZE - 1], 3 * (TABLE_SIZE - 1) );
+}
+
+static void test_scribbles_on_table(void)
+{
+    for (int i = 0; i < TABLE_SIZE; ++i) table[i] = -1;
+    CHECK_INT( table[12], -1 );
+}
+
+static void test_sees_clean_table(void)
+{
+    CHECK_INT( table[12], 36 );
+}
+
+static void test_fails(void)
+{
+    CHECK_INT( table[1], 4 );
+}
+
+int main(void)
+{
+    bool passed = RUN_TESTS_WITH_FIXTURE(build_table, free_table,
+                                         test_sees_table,
+                                         test_scribbles_on_table,
+                                         test_sees_clean_table);
+    printf("first suite %s\n", passed ? "passed" : "failed");
+
+    passed = RUN_TESTS_WITH_FIXTURE(build_table, NULL, test_fails);
+    printf("second suite %s\n", passed ? "passed" : "failed");
+
+    free(table);
+}
@@ -0,0 +1,79 @@
+// Tests RUN_TEST's in-process mode, which should still catch crashes,
+// timeouts, and exits. Several tests are supposed to fail, so CMake
+// checks the output instead of the exit status.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <signal.h>
+#include <stdlib.h>
+
+// Tests share our globals when they run in this process.
+static int runs = 0;
+
+static void test_counts_runs(void)
+{
+    ++runs;
+    CHECK_INT( runs, 1 );
+}
+
+static void test_sees_earlier_run(void)
+{
+    CHECK_INT( runs, 1 );
+}
+
+static void test_fails(void)
+{
+    CHECK_INT( 1 + 1, 3 );
+}
+
+static void test_segfaults(void)
+{
+    raise(SIGSEGV);
+}
+
+static void test_aborts(void)
+{
+    abort();
+}
+
+static volatile int depth_limit = 1 << 30;
+
+static int recurse(int depth)
+{
+    volatile char frame[256];
+    frame[0] = (char)depth;
+    if (depth >= depth_limit) return frame[0];
+    return recurse(depth + 1) + frame[0];
+}
+
+static void test_overflows_stack(void)
+{
+    CHECK( recurse(0) );
+}
+
+static void test_exits_with_error(void)
+{
+    exit(3);
+}
+
+static void test_spins(void)
+{
+    for (;;) { }
+}
+
+int main(void)
+{
+    run_tests_in_process(true);
+
+    RUN_TEST(test_counts_runs);
+    RUN_TEST(test_sees_earlier_run);
+    RUN_TEST(test_fails);
+    RUN_TEST(test_segfaults);
+    RUN_TEST(test_aborts);
+    RUN_TEST(test_overflows_stack);
+    RUN_TEST(test_exits_with_error);
+    RUN_TEST_TIMEOUT(test_spins, 0.2);
+    RUN_TEST(test_sees_earlier_run);
+}
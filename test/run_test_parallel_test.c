@@ -0,0 +1,54 @@
+// Tests that RUN_TEST reports tests in order when they run in parallel,
+// even though the earlier ones finish last. One test is supposed to
+// fail, so CMake checks the output instead of the exit status.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <time.h>
+
+static void nap(long ms)
+{
+    struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+    nanosleep(&ts, NULL);
+}
+
+static void test_slow(void)
+{
+    printf("slow says hi\n");
+    nap(300);
+    CHECK( 1 + 1 == 2 );
+    printf("slow says bye\n");
+}
+
+static void test_medium_fails(void)
+{
+    nap(150);
+    CHECK_INT( 1 + 1, 3 );
+}
+
+static void test_fast(void)
+{
+    printf("fast says hi\n");
+}
+
+static void test_crashes(void)
+{
+    *(int volatile*)0 = 0;
+}
+
+int main(void)
+{
+    run_tests_in_parallel(4);
+
+    RUN_TEST(test_slow);
+    RUN_TEST(test_medium_fails);
+    RUN_TEST(test_fast);
+    RUN_TEST(test_crashes);
+
+    // Waits for the four above.
+    CHECK( 2 + 2 == 4 );
+
+    RUN_TEST(test_fast);
+}
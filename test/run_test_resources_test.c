@@ -0,0 +1,40 @@
+// Tests RUN_TEST's resource reports and its summary of the slowest and
+// hungriest tests.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <string.h>
+#include <time.h>
+
+static void test_idle(void)
+{
+    CHECK( 1 + 1 == 2 );
+}
+
+static void test_sleeps(void)
+{
+    struct timespec ts = {0, 200 * 1000000};
+    nanosleep(&ts, NULL);
+    CHECK( 1 + 1 == 2 );
+}
+
+static void test_touches_memory(void)
+{
+    size_t size = 64 << 20;
+    char* p = malloc(size);
+    CHECK( p );
+    if (p) memset(p, 1, size);
+    free(p);
+}
+
+int main(void)
+{
+    show_test_resources(true);
+    summarize_test_resources(2);
+
+    RUN_TEST(test_idle);
+    RUN_TEST(test_sleeps);
+    RUN_TEST(test_touches_memory);
+}
@@ -0,0 +1,39 @@
+// Tests RUN_TEST's time limits. Two of the tests are supposed to time
+// out, so CMake checks the output instead of the exit status.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <unistd.h>
+
+static void test_quick(void)
+{
+    CHECK( 1 + 1 == 2 );
+}
+
+static void test_spins(void)
+{
+    for (;;) { }
+}
+
+// The grandchild holds the report pipe open, so if it weren't killed
+// along with the test, RUN_TEST would wait for it.
+static void test_forks_a_sleeper(void)
+{
+    if (fork() == 0) {
+        for (;;) pause();
+    }
+
+    for (;;) pause();
+}
+
+int main(void)
+{
+    set_test_timeout(10);
+
+    RUN_TEST(test_quick);
+    RUN_TEST_TIMEOUT(test_spins, 0.2);
+    RUN_TEST_TIMEOUT(test_forks_a_sleeper, 0.2);
+    RUN_TEST(test_quick);
+}
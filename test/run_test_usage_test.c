@@ -0,0 +1,49 @@
+// Tests RUN_TEST's per-test allocation report and its leak rule. The
+// leaky test is supposed to fail, so CMake checks the output instead of
+// the exit status.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <ipd.h>
+
+#include <string.h>
+
+static void test_no_allocations(void)
+{
+    CHECK( 1 + 1 == 2 );
+}
+
+static void test_balanced(void)
+{
+    char* a = malloc(16);
+    char* b = malloc(32);
+    CHECK( a && b );
+    free(a);
+    free(b);
+}
+
+static void test_leaky(void)
+{
+    CHECK( malloc(16) );
+}
+
+// strdup(3) allocates behind the runtime's back, so freeing its result
+// mustn't take the live byte count below where it started.
+static void test_frees_uncounted(void)
+{
+    char* s = strdup("not counted");
+    CHECK( s );
+    free(s);
+}
+
+int main(void)
+{
+    RUN_TEST(test_no_allocations);
+    RUN_TEST(test_balanced);
+    RUN_TEST(test_leaky);
+
+    fail_tests_that_leak(true);
+    RUN_TEST(test_balanced);
+    RUN_TEST(test_leaky);
+    RUN_TEST(test_frees_uncounted);
+}